@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "agg.h"
+
+#define AGG_INITCAP 1024
+
+
+static int parseAttr(const char* tok, UINT* attr) {
+    return isdigit(tok[0]) && sscanf(tok, "%u", attr) == 1 ? 0 : -1;
+}
+
+
+int parseAgg(char* q, AggSpec* spec, char** source) {
+
+    static const char* funcs[] = {"count", "sum", "min", "max", "avg"};
+
+    spec->ngroup = 0;
+    spec->nfuncs = 0;
+
+    char tok[50];
+    int n;
+    char* p = q;
+    if (sscanf(p, "%49s%n", tok, &n) != 1 || strcmp(tok, "agg") != 0) return -1;
+    p += n;
+
+    int by = 0;
+    while (sscanf(p, "%49s%n", tok, &n) == 1) {
+        p += n;
+
+        if (strcmp(tok, "from") == 0) {
+            while (*p == ' ') p++;
+            *source = p;
+            return spec->nfuncs > 0 && isalpha(*p) ? 0 : -1;
+        }
+
+        if (strcmp(tok, "by") == 0) {
+            if (by) return -1;
+            by = 1;
+            continue;
+        }
+
+        if (by) {
+            if (spec->ngroup == AGG_MAXGROUP || parseAttr(tok, &spec->group[spec->ngroup]) == -1) return -1;
+            spec->ngroup++;
+            continue;
+        }
+
+        // a function followed by its attribute, "*" for count
+        int f = -1;
+        for (int i = 0; i <= AGG_AVG; i++) {
+            if (strcmp(tok, funcs[i]) == 0) f = i;
+        }
+        if (f == -1 || spec->nfuncs == AGG_MAXFUNCS || sscanf(p, "%49s%n", tok, &n) != 1) return -1;
+        p += n;
+
+        spec->func[spec->nfuncs] = f;
+        spec->attr[spec->nfuncs] = 0;
+        if (!(f == AGG_COUNT && strcmp(tok, "*") == 0) && parseAttr(tok, &spec->attr[spec->nfuncs]) == -1) return -1;
+        spec->nfuncs++;
+    }
+
+    return -1;
+
+}
+
+
+static size_t tableBytes(const Aggregator* ag, const UINT64 cap) {
+    return cap * (sizeof(UINT) + sizeof(int64_t) * ag->words);
+}
+
+
+Aggregator* newAggregator(const AggSpec* spec, const size_t mem) {
+
+    Aggregator* ag = malloc(sizeof(Aggregator));
+    ag->spec = *spec;
+    ag->width = spec->ngroup + spec->nfuncs;
+    ag->words = spec->ngroup + 1 + spec->nfuncs;
+    ag->mem = mem;
+    ag->level = 0;
+    ag->bad = 0;
+    ag->nspilled = 0;
+    memset(ag->parts, 0, sizeof(ag->parts));
+
+    ag->cap = AGG_INITCAP;
+    while (ag->cap > 16 && tableBytes(ag, ag->cap) > mem) ag->cap /= 2;
+    ag->ngroups = 0;
+    ag->hashes = calloc(ag->cap, sizeof(UINT));
+    ag->groups = malloc(sizeof(int64_t) * ag->words * ag->cap);
+    ag->proj = malloc(sizeof(INT) * ag->width);
+    memCharge(MEM_AGG, tableBytes(ag, ag->cap));
+
+    rowbufInit(&ag->out, queryArena(), ag->width);
+    ag->out.op = MEM_AGG;
+
+    return ag;
+
+}
+
+
+void freeAggregator(Aggregator* ag) {
+    if (ag == NULL) return;
+    for (int p = 0; p < AGG_NPARTS; p++) {
+        if (ag->parts[p] != NULL) fclose(ag->parts[p]);
+    }
+    memRelease(tableBytes(ag, ag->cap));
+    free(ag->hashes);
+    free(ag->groups);
+    free(ag->proj);
+    free(ag);
+}
+
+
+// hash of the group key, seeded by the spill level so every level partitions differently, never 0
+static UINT hashKey(const INT* key, const UINT n, const int level) {
+    UINT64 h = 0x9E3779B97F4A7C15ULL * (level + 1);
+    for (UINT k = 0; k < n; k++) {
+        h ^= (UINT)key[k];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    return (UINT)h == 0 ? 1 : (UINT)h;
+}
+
+
+static void grow(Aggregator* ag) {
+
+    UINT64 cap = ag->cap * 2;
+    UINT* hashes = calloc(cap, sizeof(UINT));
+    int64_t* groups = malloc(sizeof(int64_t) * ag->words * cap);
+
+    for (UINT64 i = 0; i < ag->cap; i++) {
+        if (ag->hashes[i] == 0) continue;
+        UINT64 j = ag->hashes[i] & (cap - 1);
+        while (hashes[j] != 0) j = (j + 1) & (cap - 1);
+        hashes[j] = ag->hashes[i];
+        memcpy(groups + j * ag->words, ag->groups + i * ag->words, sizeof(int64_t) * ag->words);
+    }
+
+    memCharge(MEM_AGG, tableBytes(ag, cap));
+    memRelease(tableBytes(ag, ag->cap));
+    free(ag->hashes);
+    free(ag->groups);
+    ag->hashes = hashes;
+    ag->groups = groups;
+    ag->cap = cap;
+
+}
+
+
+// group of key, a new group is created if it fits the budget or force is set
+// return NULL if the table is full
+static int64_t* findGroup(Aggregator* ag, const INT* key, const UINT h, const int force) {
+
+    UINT n = ag->spec.ngroup;
+
+    for (UINT64 i = h & (ag->cap - 1); ag->hashes[i] != 0; i = (i + 1) & (ag->cap - 1)) {
+        if (ag->hashes[i] != h) continue;
+        int64_t* g = ag->groups + i * ag->words;
+        UINT k = 0;
+        while (k < n && g[k] == key[k]) k++;
+        if (k == n) return g;
+    }
+
+    // the table is kept at most half full, the last spill level ignores the budget
+    if ((ag->ngroups + 1) * 2 > ag->cap) {
+        if (!force && ag->level < AGG_MAXLEVEL && tableBytes(ag, ag->cap * 2) > ag->mem) return NULL;
+        grow(ag);
+    }
+
+    UINT64 i = h & (ag->cap - 1);
+    while (ag->hashes[i] != 0) i = (i + 1) & (ag->cap - 1);
+    ag->hashes[i] = h;
+    ag->ngroups++;
+
+    int64_t* g = ag->groups + i * ag->words;
+    for (UINT k = 0; k < n; k++) g[k] = key[k];
+    int64_t* st = g + n;
+    st[0] = 0;
+    for (UINT f = 0; f < ag->spec.nfuncs; f++) {
+        if (ag->spec.func[f] == AGG_MIN) st[1 + f] = INT64_MAX;
+        else if (ag->spec.func[f] == AGG_MAX) st[1 + f] = INT64_MIN;
+        else st[1 + f] = 0;
+    }
+    return g;
+
+}
+
+
+// fold a projected row into the table, rows of new groups go to a spill partition once the table is full
+static void aggAdd(Aggregator* ag, const INT* proj) {
+
+    UINT n = ag->spec.ngroup;
+    UINT h = hashKey(proj, n, ag->level);
+    int64_t* g = findGroup(ag, proj, h, 0);
+
+    if (g == NULL) {
+        int p = (h >> 24) % AGG_NPARTS;
+        if (ag->parts[p] == NULL) ag->parts[p] = tempFile();
+        if (ag->parts[p] != NULL) {
+            fwrite(proj, sizeof(INT), ag->width, ag->parts[p]);
+            ag->nspilled++;
+            log_spill_tuples(1);
+            return;
+        }
+        g = findGroup(ag, proj, h, 1);
+    }
+
+    int64_t* st = g + n;
+    const INT* vals = proj + n;
+    st[0]++;
+    for (UINT f = 0; f < ag->spec.nfuncs; f++) {
+        switch (ag->spec.func[f]) {
+            case AGG_COUNT: st[1 + f]++; break;
+            case AGG_SUM:
+            case AGG_AVG: st[1 + f] += vals[f]; break;
+            case AGG_MIN: if (vals[f] < st[1 + f]) st[1 + f] = vals[f]; break;
+            case AGG_MAX: if (vals[f] > st[1 + f]) st[1 + f] = vals[f]; break;
+        }
+    }
+
+}
+
+
+void aggConsume(void* ctx, const INT* row, const UINT width) {
+
+    Aggregator* ag = ctx;
+    if (ag->bad) return;
+
+    UINT n = ag->spec.ngroup;
+    for (UINT k = 0; k < n; k++) {
+        if (ag->spec.group[k] >= width) ag->bad = 1;
+        else ag->proj[k] = row[ag->spec.group[k]];
+    }
+    for (UINT f = 0; f < ag->spec.nfuncs; f++) {
+        if (ag->spec.attr[f] >= width) ag->bad = 1;
+        else ag->proj[n + f] = row[ag->spec.attr[f]];
+    }
+    if (ag->bad) return;
+
+    aggAdd(ag, ag->proj);
+
+}
+
+
+static INT clampInt(const int64_t v) {
+    return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (INT)v;
+}
+
+
+// move the groups of the table to the result and empty it
+static void drain(Aggregator* ag) {
+
+    UINT n = ag->spec.ngroup;
+
+    for (UINT64 i = 0; i < ag->cap; i++) {
+        if (ag->hashes[i] == 0) continue;
+        int64_t* g = ag->groups + i * ag->words;
+        int64_t* st = g + n;
+        INT* out = rowbufAppend(&ag->out);
+        for (UINT k = 0; k < n; k++) out[k] = g[k];
+        for (UINT f = 0; f < ag->spec.nfuncs; f++) {
+            int64_t v = st[1 + f];
+            if (ag->spec.func[f] == AGG_AVG) v = st[0] > 0 ? v / st[0] : 0;
+            out[n + f] = clampInt(v);
+        }
+    }
+
+    memset(ag->hashes, 0, sizeof(UINT) * ag->cap);
+    ag->ngroups = 0;
+
+}
+
+
+// aggregate every spill partition on its own, one level down
+static void processSpill(Aggregator* ag) {
+
+    FILE* parts[AGG_NPARTS];
+    memcpy(parts, ag->parts, sizeof(parts));
+    memset(ag->parts, 0, sizeof(ag->parts));
+    ag->level++;
+
+    for (int p = 0; p < AGG_NPARTS; p++) {
+        if (parts[p] == NULL) continue;
+        rewind(parts[p]);
+        while (fread(ag->proj, sizeof(INT), ag->width, parts[p]) == ag->width) aggAdd(ag, ag->proj);
+        fclose(parts[p]);
+        drain(ag);
+        processSpill(ag);
+    }
+
+    ag->level--;
+
+}
+
+
+static UINT sort_ngroup;
+
+static int cmpGroups(const void* a, const void* b) {
+    const INT* x = a;
+    const INT* y = b;
+    for (UINT k = 0; k < sort_ngroup; k++) {
+        if (x[k] != y[k]) return x[k] < y[k] ? -1 : 1;
+    }
+    return 0;
+}
+
+
+_Table* aggFinish(Aggregator* ag) {
+
+    if (ag->bad) {
+        trace("Aggregated attribute out of range\n");
+        return NULL;
+    }
+
+    drain(ag);
+    if (ag->nspilled > 0) trace("\nagg: %lu rows spilled\n", (unsigned long)ag->nspilled);
+    processSpill(ag);
+
+    // without groups there is one row, also for an empty input
+    if (ag->spec.ngroup == 0 && ag->out.nrows == 0) {
+        memset(rowbufAppend(&ag->out), 0, sizeof(INT) * ag->width);
+    }
+
+    sort_ngroup = ag->spec.ngroup;
+    if (ag->out.nrows > 1) qsort(ag->out.rows, ag->out.nrows, sizeof(INT) * ag->width, cmpGroups);
+
+    _Table* result = rowbufTable(&ag->out);
+    log_emit_tuples(result->ntuples);
+    return result;
+
+}
@@ -0,0 +1,63 @@
+#ifndef AGG_H
+#define AGG_H
+#include <stdio.h>
+#include <stddef.h>
+#include "db.h"
+#include "arena.h"
+
+#define AGG_MAXGROUP 8 // group attributes
+#define AGG_MAXFUNCS 16 // aggregates per query
+#define AGG_NPARTS 16 // spill partitions per level
+#define AGG_MAXLEVEL 4 // spill levels, the last level grows past the budget
+
+typedef enum AggFunc{
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG
+} AggFunc;
+
+// "agg func attr ... [by attr ...] from source"
+typedef struct AggSpec{
+    UINT ngroup;
+    UINT group[AGG_MAXGROUP];
+    UINT nfuncs;
+    AggFunc func[AGG_MAXFUNCS];
+    UINT attr[AGG_MAXFUNCS]; // unused for count *
+} AggSpec;
+
+// hash aggregation of the rows of one query
+// the rows are projected on the group and aggregated attributes: [group keys | function inputs]
+typedef struct Aggregator{
+    AggSpec spec;
+    UINT width; // of a projected row
+    UINT words; // int64 words per group: keys, row count, one state per function
+    size_t mem; // budget of the hash table in bytes
+    int level; // spill level of the rows being aggregated
+    int bad; // an attribute is outside the input rows
+    UINT64 cap; // power of 2
+    UINT64 ngroups;
+    UINT* hashes; // 0 for an empty slot
+    int64_t* groups;
+    INT* proj;
+    FILE* parts[AGG_NPARTS]; // rows of groups that did not fit, NULL until used
+    UINT64 nspilled;
+    RowBuf out;
+} Aggregator;
+
+// parse the query q, *source points to the source query after "from"
+// return -1 if q is malformed
+int parseAgg(char* q, AggSpec* spec, char** source);
+
+Aggregator* newAggregator(const AggSpec* spec, const size_t mem);
+void freeAggregator(Aggregator* ag);
+
+// RowSink consumer, ctx is the Aggregator
+void aggConsume(void* ctx, const INT* row, const UINT width);
+
+// aggregate the spilled rows and return the groups in the query arena, ordered on the group attributes
+// [group attributes | aggregates], NULL if an attribute was outside the input rows
+_Table* aggFinish(Aggregator* ag);
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arena.h"
+#include "cache.h"
+
+#define ALIGN 16
+
+Arena qarena = {NULL, NULL, NULL, ARENA_CHUNK, 0, 0};
+RowSink* qsink = NULL;
+UINT64 qlimit = NO_LIMIT;
+static __thread Arena* tarena = NULL;
+
+// memory governor, workers charge the operator set by the caller of schedRun()
+static size_t inuse = 0;
+static MemOp mem_op = MEM_OTHER;
+
+
+static size_t alignUp(const size_t n) {
+    return (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+}
+
+
+Arena* queryArena() {
+    return tarena != NULL ? tarena : &qarena;
+}
+
+
+void setThreadArena(Arena* a) {
+    tarena = a;
+}
+
+
+MemOp memOperator(const MemOp op) {
+    MemOp prev = mem_op;
+    mem_op = op;
+    return prev;
+}
+
+
+void memCharge(const MemOp op, const size_t n) {
+    Stats* st = get_stats();
+    UINT64 now = __sync_add_and_fetch(&inuse, n);
+    __sync_fetch_and_add(&st->mem_op[op], n);
+    UINT64 peak = __atomic_load_n(&st->mem_peak, __ATOMIC_RELAXED);
+    while (now > peak && !__sync_bool_compare_and_swap(&st->mem_peak, peak, now)) {
+        peak = __atomic_load_n(&st->mem_peak, __ATOMIC_RELAXED);
+    }
+}
+
+
+void memRelease(const size_t n) {
+    __sync_sub_and_fetch(&inuse, n);
+}
+
+
+size_t memInUse() {
+    return __atomic_load_n(&inuse, __ATOMIC_RELAXED);
+}
+
+
+size_t memAvailable() {
+    Conf* cf = get_conf();
+    size_t used = memInUse();
+    size_t global = used + getCacheStats()->bytes;
+    size_t query = used < cf->work_mem ? cf->work_mem - used : 0;
+    size_t all = global < cf->global_mem ? cf->global_mem - global : 0;
+    return query < all ? query : all;
+}
+
+
+FILE* tempFile() {
+    char path[160];
+    snprintf(path, sizeof(path), "%s/tmpXXXXXX", get_db()->path);
+    int fd = mkstemp(path);
+    if (fd == -1) return NULL;
+    unlink(path);
+    FILE* fp = fdopen(fd, "w+b");
+    if (fp == NULL) close(fd);
+    return fp;
+}
+
+
+void setQuerySink(RowSink* sink) {
+    qsink = sink;
+}
+
+
+RowSink* querySink() {
+    return qsink;
+}
+
+
+void setQueryLimit(const UINT64 n) {
+    qlimit = n;
+}
+
+
+UINT64 queryLimit() {
+    return qlimit;
+}
+
+
+void arenaInit(Arena* a, const size_t chunk_size) {
+    a->head = NULL;
+    a->spare = NULL;
+    a->last = NULL;
+    a->chunk_size = chunk_size;
+    a->used = 0;
+    a->peak = 0;
+}
+
+
+static ArenaChunk* newChunk(Arena* a, const size_t n) {
+
+    // reuse a spare chunk when it is large enough
+    if (a->spare != NULL && a->spare->size >= n) {
+        ArenaChunk* c = a->spare;
+        a->spare = c->next;
+        c->used = 0;
+        return c;
+    }
+
+    size_t size = n > a->chunk_size ? n : a->chunk_size;
+    ArenaChunk* c = malloc(sizeof(ArenaChunk) + size);
+    c->size = size;
+    c->used = 0;
+    return c;
+
+}
+
+
+void* arenaAlloc(Arena* a, const size_t n) {
+
+    size_t need = alignUp(n == 0 ? 1 : n);
+
+    if (a->head == NULL || a->head->used + need > a->head->size) {
+        ArenaChunk* c = newChunk(a, need);
+        c->next = a->head;
+        a->head = c;
+    }
+
+    void* p = a->head->data + a->head->used;
+    a->head->used += need;
+    a->last = p;
+
+    a->used += need;
+    if (a->used > a->peak) a->peak = a->used;
+    memCharge(mem_op, need);
+
+    return p;
+
+}
+
+
+// grow in place if p is the most recent allocation and its chunk has room, otherwise copy
+void* arenaRealloc(Arena* a, void* p, const size_t old_n, const size_t new_n) {
+
+    if (p == NULL) return arenaAlloc(a, new_n);
+
+    size_t old_need = alignUp(old_n == 0 ? 1 : old_n);
+    size_t new_need = alignUp(new_n == 0 ? 1 : new_n);
+    if (new_need <= old_need) return p;
+
+    if (p == a->last && (char*)p + new_need <= a->head->data + a->head->size) {
+        a->head->used += new_need - old_need;
+        a->used += new_need - old_need;
+        if (a->used > a->peak) a->peak = a->used;
+        memCharge(mem_op, new_need - old_need);
+        return p;
+    }
+
+    void* q = arenaAlloc(a, new_n);
+    memcpy(q, p, old_n);
+    return q;
+
+}
+
+
+// release every allocation, chunks are kept for the next query
+void arenaReset(Arena* a) {
+
+    while (a->head != NULL) {
+        ArenaChunk* c = a->head;
+        a->head = c->next;
+        c->next = a->spare;
+        a->spare = c;
+    }
+
+    a->last = NULL;
+    memRelease(a->used);
+    a->used = 0;
+
+}
+
+
+void arenaFree(Arena* a) {
+
+    arenaReset(a);
+
+    while (a->spare != NULL) {
+        ArenaChunk* c = a->spare;
+        a->spare = c->next;
+        free(c);
+    }
+
+}
+
+
+void rowbufInit(RowBuf* rb, Arena* a, const UINT width) {
+    rb->arena = a;
+    rb->width = width;
+    rb->nrows = 0;
+    rb->cap = 0;
+    rb->rows = NULL;
+    rb->sink = NULL;
+    rb->pending = 0;
+    rb->op = -1;
+    rb->spillable = 0;
+    rb->spill = NULL;
+    rb->limit = NO_LIMIT;
+}
+
+
+void rowbufStream(RowBuf* rb, RowSink* sink) {
+    rb->sink = sink;
+}
+
+
+void rowbufSpill(RowBuf* rb) {
+    rb->op = MEM_RESULT;
+    rb->spillable = 1;
+}
+
+
+void rowbufLimit(RowBuf* rb, const UINT64 limit) {
+    rb->limit = limit;
+}
+
+
+int rowbufFull(const RowBuf* rb) {
+    return rb->nrows >= rb->limit;
+}
+
+
+// hand the rows of the last batch to the sink, or append them to the spill file
+static void flushPending(RowBuf* rb) {
+    if (rb->spill == NULL) {
+        for (UINT i = 0; i < rb->pending; i++) {
+            rb->sink->consume(rb->sink->ctx, rb->rows + (size_t)i * rb->width, rb->width);
+        }
+    } else if (rb->pending > 0) {
+        fwrite(rb->rows, sizeof(INT) * rb->width, rb->pending, rb->spill);
+        log_spill_tuples(rb->pending);
+    }
+    rb->pending = 0;
+}
+
+
+// grow the block of rb to cap rows, charged to the operator of rb
+static void growRows(RowBuf* rb, const UINT64 cap, const int copy) {
+    MemOp prev = mem_op;
+    if (rb->op >= 0) memOperator(rb->op);
+    size_t n = sizeof(INT) * rb->width;
+    rb->rows = copy ? arenaRealloc(rb->arena, rb->rows, n * rb->cap, n * cap) : arenaAlloc(rb->arena, n * cap);
+    rb->cap = cap;
+    if (rb->op >= 0) memOperator(prev);
+}
+
+
+// move the rows of rb to a temporary file, from now on its block holds one batch
+static int startSpill(RowBuf* rb) {
+    rb->spill = tempFile();
+    if (rb->spill == NULL) return 0;
+    rb->pending = rb->nrows;
+    flushPending(rb);
+    trace("\nresult: spilling after %lu rows\n", (unsigned long)rb->nrows);
+    return 1;
+}
+
+
+INT* rowbufAppendN(RowBuf* rb, const UINT n) {
+
+    // the caller fills in n rows, past the limit they land in the block but are not counted
+    UINT64 room = rb->nrows < rb->limit ? rb->limit - rb->nrows : 0;
+    UINT keep = n < room ? n : (UINT)room;
+
+    // rows that would not fit the budget are spilled, growing by at least the block already held
+    if (rb->spill == NULL && rb->sink == NULL && rb->spillable && rb->nrows + n > rb->cap) {
+        size_t grow = sizeof(INT) * rb->width * (rb->cap > n ? rb->cap : n);
+        if (grow > memAvailable()) startSpill(rb);
+    }
+
+    // one block is reused, the rows of a batch are complete once the next batch is appended
+    if (rb->sink != NULL || rb->spill != NULL) {
+        flushPending(rb);
+        if (n > rb->cap) growRows(rb, n, 0);
+        rb->pending = keep;
+        rb->nrows += keep;
+        return rb->rows;
+    }
+
+    if (rb->nrows + n > rb->cap) {
+        UINT64 cap = rb->cap == 0 ? 64 : rb->cap * 2;
+        while (cap < rb->nrows + n) cap *= 2;
+        growRows(rb, cap, 1);
+    }
+
+    INT* rows = rb->rows + (size_t)rb->nrows * rb->width;
+    rb->nrows += keep;
+    return rows;
+
+}
+
+
+INT* rowbufAppend(RowBuf* rb) {
+    return rowbufAppendN(rb, 1);
+}
+
+
+_Table* rowbufTable(RowBuf* rb) {
+
+    if (rb->sink != NULL || rb->spill != NULL) {
+        flushPending(rb);
+        _Table* t = arenaAlloc(rb->arena, sizeof(_Table));
+        t->nattrs = rb->width;
+        t->ntuples = 0;
+        t->spill = rb->spill;
+        if (rb->spill != NULL) {
+            t->ntuples = rb->nrows;
+            fflush(rb->spill);
+            rewind(rb->spill);
+        }
+        return t;
+    }
+
+    _Table* t = arenaAlloc(rb->arena, sizeof(_Table) + rb->nrows * sizeof(Tuple));
+    t->nattrs = rb->width;
+    t->ntuples = rb->nrows;
+    t->spill = NULL;
+
+    for (UINT64 i = 0; i < rb->nrows; i++) {
+        t->tuples[i] = rb->rows + (size_t)i * rb->width;
+    }
+
+    return t;
+
+}
@@ -0,0 +1,115 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include "db.h"
+
+#define ARENA_CHUNK (1 << 20) // default chunk size, larger requests get a chunk of their own
+
+typedef struct ArenaChunk{
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    size_t pad; // keeps data 16-byte aligned
+    char data[];
+} ArenaChunk;
+
+// region allocator: bump allocation from large chunks, everything is released at once
+// the bytes handed out are charged to the memory governor, see memOperator()
+typedef struct Arena{
+    ArenaChunk* head; // chunk currently allocated from
+    ArenaChunk* spare; // chunks kept by arenaReset() for reuse
+    void* last; // most recent allocation, can be grown in place
+    size_t chunk_size;
+    size_t used; // bytes handed out since the last reset
+    size_t peak;
+} Arena;
+
+void arenaInit(Arena* a, const size_t chunk_size);
+void* arenaAlloc(Arena* a, const size_t n);
+void* arenaRealloc(Arena* a, void* p, const size_t old_n, const size_t new_n);
+void arenaReset(Arena* a);
+void arenaFree(Arena* a);
+
+// memory governor: the arenas and the operators allocating on their own charge the bytes they hold,
+// work_mem bounds those of a query and global_mem those of the queries and the result cache together
+// nothing fails past a budget, operators that can spill ask memAvailable() before growing and
+// write to temporary files once it is exceeded
+
+// operator charged by the arenas from now on, return the previous one
+MemOp memOperator(const MemOp op);
+
+// bytes taken or given back outside the arenas
+void memCharge(const MemOp op, const size_t n);
+void memRelease(const size_t n);
+
+// bytes held by the queries
+size_t memInUse();
+
+// bytes a query can still take before it exceeds one of the budgets
+size_t memAvailable();
+
+// anonymous temporary file in the database folder, removed once closed, NULL if it cannot be created
+FILE* tempFile();
+
+// arena of the running query, reset when the next query starts
+// a thread with an arena of its own gets that one instead
+Arena* queryArena();
+
+// arena queryArena() returns in the calling thread, NULL for the query arena
+void setThreadArena(Arena* a);
+
+// consumer of the result rows of a query, instead of a materialized result
+typedef struct RowSink{
+    void (*consume)(void* ctx, const INT* row, const UINT width);
+    void* ctx;
+} RowSink;
+
+// sink the result of the running query streams to, NULL materializes it
+void setQuerySink(RowSink* sink);
+RowSink* querySink();
+
+#define NO_LIMIT UINT64_MAX
+
+// rows the result of the running query is cut to, NO_LIMIT for all of them
+void setQueryLimit(const UINT64 n);
+UINT64 queryLimit();
+
+// growable block of fixed-width rows allocated from an arena
+typedef struct RowBuf{
+    Arena* arena;
+    UINT width;
+    UINT64 nrows;
+    UINT64 cap;
+    INT* rows;
+    RowSink* sink; // rows are streamed to the sink, see rowbufStream()
+    UINT pending; // rows of the last batch not yet handed to the sink or written to the spill file
+    int op; // operator charged for the rows, -1 for the running one
+    int spillable; // see rowbufSpill()
+    FILE* spill;
+    UINT64 limit; // rows kept at most, see rowbufLimit()
+} RowBuf;
+
+void rowbufInit(RowBuf* rb, Arena* a, const UINT width);
+INT* rowbufAppend(RowBuf* rb);
+
+// n contiguous rows, filled in by the caller
+INT* rowbufAppendN(RowBuf* rb, const UINT n);
+
+// stream the rows appended to rb to sink, nothing is stored if sink is not NULL
+// a batch is handed over once the next one is appended, or by rowbufTable()
+void rowbufStream(RowBuf* rb, RowSink* sink);
+
+// charge the rows of rb to the result and write them to a temporary file once they would exceed memAvailable(),
+// a block of one batch is then reused like for a sink
+void rowbufSpill(RowBuf* rb);
+
+// keep the first limit rows appended to rb, the rows of a batch past them are dropped
+// an operator stops reading pages once rowbufFull() holds
+void rowbufLimit(RowBuf* rb, const UINT64 limit);
+int rowbufFull(const RowBuf* rb);
+
+// result table over the rows of rb, tuples point into its contiguous block
+// a streamed rb gives an empty table, a spilled one a table whose rows are in the spill file
+_Table* rowbufTable(RowBuf* rb);
+
+#endif
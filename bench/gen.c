@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// synthetic schema/data and query generator for the benchmark
+//
+// gen data_path query_path [rows=N] [tables=K] [width=W] [dist=uniform|zipf|sorted]
+//     [theta=T] [sel=S] [nsel=Q] [seed=X]
+//
+// every table has rows tuples of width attributes:
+//   attr 0: join key in [0, nkeys) drawn from dist, nkeys = 1 / sel
+//   attr 1: row number, unique
+//   attr 2..: uniform in [0, 1000)
+// the queries are nsel selections per table, a join of every pair of neighbouring tables
+// on the key, and a multi-way join over all tables when there are three or more
+
+#define MAX_TABLES 8
+#define MAX_WIDTH 8 // a data line holds at most 100 characters
+
+typedef struct Gen{
+    uint64_t rows;
+    int tables;
+    int width;
+    char dist[10];
+    double theta; // zipf skew, in (0, 1)
+    double sel; // join selectivity, fraction of the cross product
+    int nsel;
+    uint64_t seed;
+    uint64_t nkeys;
+
+    // zipf state (Gray et al., "Quickly generating billion-record synthetic databases")
+    double zeta_n;
+    double alpha;
+    double eta;
+} Gen;
+
+
+static uint64_t rng;
+
+static uint64_t nextRand(){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+// uniform in [0, 1)
+static double nextDouble(){
+    return (nextRand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+static double zeta(uint64_t n, double theta){
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) sum += pow(1.0 / i, theta);
+    return sum;
+}
+
+
+static void initZipf(Gen* g){
+    g->zeta_n = zeta(g->nkeys, g->theta);
+    double zeta_2 = zeta(2, g->theta);
+    g->alpha = 1.0 / (1.0 - g->theta);
+    g->eta = (1 - pow(2.0 / g->nkeys, 1 - g->theta)) / (1 - zeta_2 / g->zeta_n);
+}
+
+
+// rank 0 is the most frequent key, ranks are scattered over the key domain
+static uint64_t nextZipf(Gen* g){
+    double u = nextDouble();
+    double uz = u * g->zeta_n;
+    uint64_t rank;
+    if (uz < 1.0) rank = 0;
+    else if (uz < 1.0 + pow(0.5, g->theta)) rank = 1;
+    else rank = (uint64_t)(g->nkeys * pow(g->eta * u - g->eta + 1, g->alpha));
+    if (rank >= g->nkeys) rank = g->nkeys - 1;
+    return (rank * 2654435761ULL) % g->nkeys;
+}
+
+
+static uint64_t nextKey(Gen* g, uint64_t i){
+    if (strcmp(g->dist, "sorted") == 0) return i * g->nkeys / g->rows;
+    if (strcmp(g->dist, "zipf") == 0) return nextZipf(g);
+    return nextRand() % g->nkeys;
+}
+
+
+static int parseArg(Gen* g, const char* arg){
+    if (sscanf(arg, "rows=%lu", (unsigned long*)&g->rows) == 1) return 0;
+    if (sscanf(arg, "tables=%d", &g->tables) == 1) return 0;
+    if (sscanf(arg, "width=%d", &g->width) == 1) return 0;
+    if (sscanf(arg, "dist=%9s", g->dist) == 1) return 0;
+    if (sscanf(arg, "theta=%lf", &g->theta) == 1) return 0;
+    if (sscanf(arg, "sel=%lf", &g->sel) == 1) return 0;
+    if (sscanf(arg, "nsel=%d", &g->nsel) == 1) return 0;
+    if (sscanf(arg, "seed=%lu", (unsigned long*)&g->seed) == 1) return 0;
+    return -1;
+}
+
+
+int main(int argc, char** argv){
+
+    if (argc < 3) {
+        printf("Usage: gen data_path query_path [rows=N] [tables=K] [width=W] [dist=uniform|zipf|sorted] [theta=T] [sel=S] [nsel=Q] [seed=X]\n");
+        return -1;
+    }
+
+    Gen g = {1000, 2, 4, "uniform", 0.5, 0, 4, 42, 0, 0, 0, 0};
+    for (int i = 3; i < argc; i++) {
+        if (parseArg(&g, argv[i]) == -1) {
+            printf("Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (g.rows == 0 || g.tables < 1 || g.tables > MAX_TABLES || g.width < 2 || g.width > MAX_WIDTH ||
+        g.theta <= 0 || g.theta >= 1) {
+        printf("Invalid arguments\n");
+        return -1;
+    }
+    if (strcmp(g.dist, "uniform") != 0 && strcmp(g.dist, "zipf") != 0 && strcmp(g.dist, "sorted") != 0) {
+        printf("Unknown distribution %s\n", g.dist);
+        return -1;
+    }
+
+    // default selectivity: about one match per tuple, as in a key/foreign-key join
+    if (g.sel <= 0) g.sel = 1.0 / g.rows;
+    g.nkeys = (uint64_t)(1.0 / g.sel + 0.5);
+    if (g.nkeys < 1) g.nkeys = 1;
+    if (g.nkeys > INT32_MAX) g.nkeys = INT32_MAX;
+    if (strcmp(g.dist, "zipf") == 0) initZipf(&g);
+
+    FILE* data_fp = fopen(argv[1], "w");
+    FILE* query_fp = fopen(argv[2], "w");
+    if (data_fp == NULL || query_fp == NULL) {
+        perror("Fail to open the output files.\n");
+        return -1;
+    }
+
+    rng = g.seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    // schema and data
+    fprintf(data_fp, "database_meta %d\n", g.tables);
+    for (int t = 0; t < g.tables; t++) {
+        fprintf(data_fp, "\ntable_meta %d t%d %d\n", 100 * (t + 1), t, g.width);
+        for (uint64_t i = 0; i < g.rows; i++) {
+            fprintf(data_fp, "%lu %lu", (unsigned long)nextKey(&g, i), (unsigned long)(i % INT32_MAX));
+            for (int x = 2; x < g.width; x++) fprintf(data_fp, " %lu", (unsigned long)(nextRand() % 1000));
+            fprintf(data_fp, "\n");
+        }
+    }
+
+    // queries, selection values are drawn like the data so skewed keys are hit often
+    fprintf(query_fp, "# rows=%lu tables=%d width=%d dist=%s sel=%g nkeys=%lu\n",
+        (unsigned long)g.rows, g.tables, g.width, g.dist, g.sel, (unsigned long)g.nkeys);
+    for (int t = 0; t < g.tables; t++) {
+        for (int q = 0; q < g.nsel; q++) {
+            if (q % 2 == 0) fprintf(query_fp, "sel 0 %lu = t%d\n", (unsigned long)nextKey(&g, nextRand() % g.rows), t);
+            else fprintf(query_fp, "sel 1 %lu = t%d\n", (unsigned long)(nextRand() % g.rows % INT32_MAX), t);
+        }
+    }
+    for (int t = 0; t + 1 < g.tables; t++) {
+        fprintf(query_fp, "join 0 t%d 0 t%d\n", t, t + 1);
+    }
+    if (g.tables >= 3) {
+        fprintf(query_fp, "mjoin");
+        for (int t = 0; t + 1 < g.tables; t++) fprintf(query_fp, " 0 t%d 0 t%d", t, t + 1);
+        fprintf(query_fp, "\n");
+    }
+
+    fclose(data_fp);
+    fclose(query_fp);
+
+    return 0;
+
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+CacheEntry* buckets[CACHE_BUCKETS];
+CacheEntry* lru_head = NULL;
+CacheEntry* lru_tail = NULL;
+CacheStats cstats;
+
+
+// FNV-1a
+static UINT hashKey(const char* key) {
+    UINT h = 2166136261u;
+    for (const char* c = key; *c; c++) {
+        h ^= (unsigned char)*c;
+        h *= 16777619u;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+
+static void lruUnlink(CacheEntry* e) {
+    if (e->prev) e->prev->next = e->next;
+    else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+
+static void lruPushFront(CacheEntry* e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (lru_tail == NULL) lru_tail = e;
+}
+
+
+static void removeEntry(CacheEntry* e) {
+    CacheEntry** p = &buckets[hashKey(e->key)];
+    while (*p != e) p = &(*p)->hnext;
+    *p = e->hnext;
+    lruUnlink(e);
+    cstats.bytes -= e->bytes;
+    free(e);
+}
+
+
+// evict least recently used results until at most limit bytes are held
+static void evict(const size_t limit) {
+    while (cstats.bytes > limit && lru_tail != NULL) {
+        trace("cache evict: %s\n", lru_tail->key);
+        removeEntry(lru_tail);
+        cstats.evictions++;
+    }
+}
+
+
+void cacheTrim() {
+    evict(get_conf()->cache_mem);
+}
+
+
+static CacheEntry* find(const char* key) {
+    for (CacheEntry* e = buckets[hashKey(key)]; e != NULL; e = e->hnext) {
+        if (strcmp(e->key, key) == 0) return e;
+    }
+    return NULL;
+}
+
+
+_Table* cacheGet(const char* key) {
+
+    if (get_conf()->cache_mem == 0) return NULL;
+
+    CacheEntry* e = find(key);
+    if (e == NULL) {
+        cstats.misses++;
+        return NULL;
+    }
+
+    lruUnlink(e);
+    lruPushFront(e);
+    cstats.hits++;
+    trace("\ncache hit: %s\n", key);
+    return e->result;
+
+}
+
+
+void cachePut(const char* key, const _Table* result) {
+
+    size_t limit = get_conf()->cache_mem;
+    // a spilled result is larger than the memory budgets anyway
+    if (limit == 0 || result == NULL || result->spill != NULL || find(key) != NULL) return;
+
+    // entry, table header, tuple pointers and rows in one block
+    size_t rows = sizeof(INT) * result->nattrs * result->ntuples;
+    size_t bytes = sizeof(CacheEntry) + sizeof(_Table) + sizeof(Tuple) * result->ntuples + rows;
+    if (bytes > limit) return;
+
+    evict(limit - bytes);
+
+    CacheEntry* e = malloc(bytes);
+    strncpy(e->key, key, CACHE_KEYLEN - 1);
+    e->key[CACHE_KEYLEN - 1] = '\0';
+    e->bytes = bytes;
+
+    _Table* t = (_Table*)(e + 1);
+    t->nattrs = result->nattrs;
+    t->ntuples = result->ntuples;
+    t->spill = NULL;
+    INT* data = (INT*)(t->tuples + t->ntuples);
+    for (UINT64 i = 0; i < t->ntuples; i++) {
+        t->tuples[i] = data + (size_t)i * t->nattrs;
+        memcpy(t->tuples[i], result->tuples[i], sizeof(INT) * t->nattrs);
+    }
+    e->result = t;
+
+    UINT h = hashKey(e->key);
+    e->hnext = buckets[h];
+    buckets[h] = e;
+    lruPushFront(e);
+
+    cstats.bytes += bytes;
+    cstats.inserts++;
+
+}
+
+
+// true if one of the space separated words of key is table_name
+static int readsTable(const char* key, const char* table_name) {
+    size_t n = strlen(table_name);
+    for (const char* w = key; *w; ) {
+        size_t len = strcspn(w, " ");
+        if (len == n && strncmp(w, table_name, n) == 0) return 1;
+        w += len;
+        while (*w == ' ') w++;
+    }
+    return 0;
+}
+
+
+void cacheInvalidate(const char* table_name) {
+    CacheEntry* e = lru_head;
+    while (e != NULL) {
+        CacheEntry* next = e->next;
+        if (table_name == NULL || readsTable(e->key, table_name)) {
+            removeEntry(e);
+            cstats.invalidations++;
+        }
+        e = next;
+    }
+}
+
+
+CacheStats* getCacheStats() {
+    return &cstats;
+}
+
+
+void freeCache() {
+    while (lru_head != NULL) removeEntry(lru_head);
+}
@@ -0,0 +1,45 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stddef.h>
+#include "db.h"
+
+#define CACHE_KEYLEN 256 // a normalized query fits in a query line
+#define CACHE_BUCKETS 1024
+
+// cached result of one query, the table and its rows share one allocation
+typedef struct CacheEntry{
+    char key[CACHE_KEYLEN];
+    _Table* result;
+    size_t bytes;
+    struct CacheEntry* hnext; // hash chain
+    struct CacheEntry* prev; // LRU list, most recently used first
+    struct CacheEntry* next;
+} CacheEntry;
+
+typedef struct CacheStats{
+    UINT hits;
+    UINT misses;
+    UINT inserts;
+    UINT evictions;
+    UINT invalidations;
+    size_t bytes; // memory held by cached results
+} CacheStats;
+
+// cached result of a normalized query, NULL on a miss or when the cache is off
+// the result stays valid until the next cachePut() or cacheInvalidate()
+_Table* cacheGet(const char* key);
+
+// copy a result into the cache, evicting least recently used results to stay within conf->cache_mem
+// spilled results are not cached
+void cachePut(const char* key, const _Table* result);
+
+// evict down to conf->cache_mem after the budget changed
+void cacheTrim();
+
+// drop the results reading table_name, every result if table_name is NULL
+void cacheInvalidate(const char* table_name);
+
+CacheStats* getCacheStats();
+void freeCache();
+
+#endif
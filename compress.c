@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "compress.h"
+
+
+// bits needed to store values in [0, range]
+static UINT bitWidth(const uint64_t range) {
+    return range == 0 ? 0 : 64 - __builtin_clzll(range);
+}
+
+
+static UINT64 packedBytes(const UINT64 n, const UINT bits) {
+    return (n * bits + 7) / 8;
+}
+
+
+// bytes of a column in scheme s, 0 if the scheme cannot hold the column
+static UINT64 schemeSize(const ColBuild* c, const UINT n, const int s) {
+    switch (s) {
+        case CMP_RAW:
+            return 4 * (UINT64)n;
+        case CMP_FOR:
+            return 5 + packedBytes(n, bitWidth((uint64_t)((int64_t)c->max - c->min)));
+        case CMP_DELTA:
+            if (n < 2) return 9;
+            if (c->dmin < INT32_MIN || c->dmin > INT32_MAX || c->dmax - c->dmin > UINT32_MAX) return 0;
+            return 9 + packedBytes(n - 1, bitWidth((uint64_t)(c->dmax - c->dmin)));
+        case CMP_RLE:
+            if (c->nruns > CMP_MAXTUPLES) return 0;
+            return 2 + 6 * (UINT64)c->nruns;
+        case CMP_DICT:
+            if (c->ndict > CMP_DICT_MAX) return 0;
+            return 3 + 4 * (UINT64)c->ndict + packedBytes(n, bitWidth(c->ndict - 1));
+    }
+    return 0;
+}
+
+
+// cheapest scheme of a column, RAW on ties with nothing better
+static int bestScheme(const ColBuild* c, const UINT n, UINT64* size) {
+    int best = CMP_RAW;
+    *size = schemeSize(c, n, CMP_RAW);
+    for (int s = CMP_FOR; s < NSCHEMES; s++) {
+        UINT64 sz = schemeSize(c, n, s);
+        if (sz != 0 && sz < *size) {
+            best = s;
+            *size = sz;
+        }
+    }
+    return best;
+}
+
+
+static UINT dictSlot(const INT v) {
+    return ((UINT)v * 2654435761u) >> 23; // top 9 bits, CMP_DICT_SLOTS
+}
+
+
+// position of v in the dictionary, -1 if absent, *slot receives where it would go
+static int dictFind(const ColBuild* c, const INT v, UINT* slot) {
+    UINT s = dictSlot(v);
+    while (c->slots[s] != -1) {
+        if (c->dict[c->slots[s]] == v) return c->slots[s];
+        s = (s + 1) & (CMP_DICT_SLOTS - 1);
+    }
+    *slot = s;
+    return -1;
+}
+
+
+// fold the n-th value of a page into min/max, the delta range and the run count
+static void summarize(ColBuild* c, const INT v, const UINT n) {
+    if (n == 1) {
+        c->min = v;
+        c->max = v;
+        c->dmin = 0;
+        c->dmax = 0;
+        c->nruns = 1;
+    } else {
+        int64_t d = (int64_t)v - c->last;
+        if (v < c->min) c->min = v;
+        if (v > c->max) c->max = v;
+        if (n == 2 || d < c->dmin) c->dmin = d;
+        if (n == 2 || d > c->dmax) c->dmax = d;
+        if (v != c->last) c->nruns++;
+    }
+    c->last = v;
+}
+
+
+static void resetCols(PageBuilder* pb) {
+    pb->ntuples = 0;
+    for (int x = 0; x < pb->nattrs; x++) {
+        ColBuild* c = &pb->cols[x];
+        c->ndict = 0;
+        c->nruns = 0;
+        memset(c->slots, -1, sizeof(c->slots));
+    }
+}
+
+
+PageBuilder* newPageBuilder(const UINT nattrs, const UINT page_size) {
+    PageBuilder* pb = malloc(sizeof(PageBuilder));
+    pb->nattrs = nattrs;
+    pb->page_size = page_size;
+    pb->cap = 64;
+    pb->rows = malloc(sizeof(INT) * nattrs * pb->cap);
+    pb->cols = malloc(sizeof(ColBuild) * nattrs);
+    resetCols(pb);
+    return pb;
+}
+
+
+void freePageBuilder(PageBuilder* pb) {
+    if (pb == NULL) return;
+    free(pb->rows);
+    free(pb->cols);
+    free(pb);
+}
+
+
+int pbAdd(PageBuilder* pb, const INT* tuple) {
+
+    UINT n = pb->ntuples + 1;
+    if (n > CMP_MAXTUPLES) return -1;
+
+    // size of the page with the tuple, column summaries are updated only if it fits
+    UINT64 total = CMP_HEADER;
+    ColBuild next[1];
+    for (int x = 0; x < pb->nattrs; x++) {
+        const ColBuild* c = &pb->cols[x];
+        INT v = tuple[x];
+
+        // a copy without the dictionary, schemeSize() only needs its size
+        memcpy(next, c, offsetof(ColBuild, dict));
+        summarize(next, v, n);
+        UINT slot;
+        if (c->ndict <= CMP_DICT_MAX && dictFind(c, v, &slot) == -1) next->ndict++;
+
+        UINT64 size;
+        bestScheme(next, n, &size);
+        total += 1 + size;
+    }
+
+    if (total > pb->page_size && pb->ntuples > 0) return -1;
+
+    // commit
+    if (pb->ntuples == pb->cap) {
+        pb->cap *= 2;
+        pb->rows = realloc(pb->rows, sizeof(INT) * pb->nattrs * pb->cap);
+    }
+    memcpy(pb->rows + (size_t)pb->ntuples * pb->nattrs, tuple, sizeof(INT) * pb->nattrs);
+
+    for (int x = 0; x < pb->nattrs; x++) {
+        ColBuild* c = &pb->cols[x];
+        INT v = tuple[x];
+        summarize(c, v, n);
+
+        UINT slot;
+        if (c->ndict <= CMP_DICT_MAX && dictFind(c, v, &slot) == -1) {
+            if (c->ndict < CMP_DICT_MAX) {
+                c->dict[c->ndict] = v;
+                c->slots[slot] = c->ndict;
+            }
+            c->ndict++;
+        }
+    }
+
+    pb->ntuples = n;
+    return 0;
+
+}
+
+
+// LSB-first bit packing
+typedef struct BitWriter{
+    char* out;
+    uint64_t acc;
+    UINT nacc;
+} BitWriter;
+
+static void putBits(BitWriter* w, const uint64_t v, const UINT bits) {
+    if (bits == 0) return;
+    w->acc |= v << w->nacc;
+    w->nacc += bits;
+    while (w->nacc >= 8) {
+        *w->out++ = (char)(w->acc & 0xff);
+        w->acc >>= 8;
+        w->nacc -= 8;
+    }
+}
+
+static void flushBits(BitWriter* w) {
+    if (w->nacc > 0) *w->out++ = (char)(w->acc & 0xff);
+    w->acc = 0;
+    w->nacc = 0;
+}
+
+
+typedef struct BitReader{
+    const unsigned char* in;
+    uint64_t acc;
+    UINT nacc;
+} BitReader;
+
+static uint64_t getBits(BitReader* r, const UINT bits) {
+    if (bits == 0) return 0;
+    while (r->nacc < bits) {
+        r->acc |= (uint64_t)*r->in++ << r->nacc;
+        r->nacc += 8;
+    }
+    uint64_t v = r->acc & ((1ULL << bits) - 1);
+    r->acc >>= bits;
+    r->nacc -= bits;
+    return v;
+}
+
+
+static char* put32(char* p, const INT v) {
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+static char* put16(char* p, const UINT v) {
+    uint16_t s = v;
+    memcpy(p, &s, 2);
+    return p + 2;
+}
+
+static const char* get32(const char* p, INT* v) {
+    memcpy(v, p, 4);
+    return p + 4;
+}
+
+static const char* get16(const char* p, UINT* v) {
+    uint16_t s;
+    memcpy(&s, p, 2);
+    *v = s;
+    return p + 2;
+}
+
+
+// encode column x of the page at p, return the end of the column
+static char* encodeColumn(PageBuilder* pb, const int x, char* p) {
+
+    ColBuild* c = &pb->cols[x];
+    UINT n = pb->ntuples;
+    UINT w = pb->nattrs;
+    const INT* rows = pb->rows;
+
+    UINT64 size;
+    int s = bestScheme(c, n, &size);
+    *p++ = (char)s;
+
+    BitWriter bw = {NULL, 0, 0};
+
+    switch (s) {
+        case CMP_RAW:
+            for (UINT y = 0; y < n; y++) p = put32(p, rows[y * w + x]);
+            return p;
+
+        case CMP_FOR: {
+            UINT bits = bitWidth((uint64_t)((int64_t)c->max - c->min));
+            p = put32(p, c->min);
+            *p++ = (char)bits;
+            bw.out = p;
+            for (UINT y = 0; y < n; y++) putBits(&bw, (uint64_t)((int64_t)rows[y * w + x] - c->min), bits);
+            flushBits(&bw);
+            return bw.out;
+        }
+
+        case CMP_DELTA: {
+            int64_t base = n < 2 ? 0 : c->dmin;
+            UINT bits = n < 2 ? 0 : bitWidth((uint64_t)(c->dmax - c->dmin));
+            p = put32(p, rows[x]);
+            p = put32(p, (INT)base);
+            *p++ = (char)bits;
+            bw.out = p;
+            for (UINT y = 1; y < n; y++) {
+                int64_t d = (int64_t)rows[y * w + x] - rows[(y - 1) * w + x];
+                putBits(&bw, (uint64_t)(d - base), bits);
+            }
+            flushBits(&bw);
+            return bw.out;
+        }
+
+        case CMP_RLE: {
+            p = put16(p, c->nruns);
+            UINT y = 0;
+            while (y < n) {
+                INT v = rows[y * w + x];
+                UINT len = 0;
+                while (y < n && rows[y * w + x] == v) {
+                    y++;
+                    len++;
+                }
+                p = put32(p, v);
+                p = put16(p, len);
+            }
+            return p;
+        }
+
+        case CMP_DICT: {
+            UINT bits = bitWidth(c->ndict - 1);
+            p = put16(p, c->ndict);
+            for (UINT k = 0; k < c->ndict; k++) p = put32(p, c->dict[k]);
+            *p++ = (char)bits;
+            bw.out = p;
+            for (UINT y = 0; y < n; y++) {
+                UINT slot;
+                putBits(&bw, dictFind(c, rows[y * w + x], &slot), bits);
+            }
+            flushBits(&bw);
+            return bw.out;
+        }
+    }
+
+    return p;
+
+}
+
+
+void pbEncode(PageBuilder* pb, const UINT64 pageid, char* page) {
+
+    memset(page, 0, pb->page_size);
+    memcpy(page, &pageid, sizeof(UINT64));
+    char* p = put16(page + sizeof(UINT64), pb->ntuples);
+
+    for (int x = 0; x < pb->nattrs; x++) p = encodeColumn(pb, x, p);
+
+    resetCols(pb);
+
+}
+
+
+void pbWrite(PageBuilder* pb, const UINT64 pageid, FILE* fp) {
+    char* page = malloc(pb->page_size);
+    pbEncode(pb, pageid, page);
+    fwrite(page, pb->page_size, 1, fp);
+    free(page);
+}
+
+
+UINT pageTuples(const char* page) {
+    UINT n;
+    get16(page + sizeof(UINT64), &n);
+    return n;
+}
+
+
+void decodePage(const char* page, const UINT nattrs, INT** tuple) {
+
+    UINT n;
+    const char* p = get16(page + sizeof(UINT64), &n);
+
+    for (int x = 0; x < nattrs; x++) {
+
+        int s = *p++;
+        BitReader br = {NULL, 0, 0};
+
+        switch (s) {
+            case CMP_RAW:
+                for (UINT y = 0; y < n; y++) p = get32(p, &tuple[y][x]);
+                break;
+
+            case CMP_FOR: {
+                INT base;
+                p = get32(p, &base);
+                UINT bits = (unsigned char)*p++;
+                br.in = (const unsigned char*)p;
+                for (UINT y = 0; y < n; y++) tuple[y][x] = (INT)((int64_t)base + (int64_t)getBits(&br, bits));
+                p += packedBytes(n, bits);
+                break;
+            }
+
+            case CMP_DELTA: {
+                INT first;
+                INT base;
+                p = get32(p, &first);
+                p = get32(p, &base);
+                UINT bits = (unsigned char)*p++;
+                br.in = (const unsigned char*)p;
+                int64_t v = first;
+                if (n > 0) tuple[0][x] = first;
+                for (UINT y = 1; y < n; y++) {
+                    v += (int64_t)base + (int64_t)getBits(&br, bits);
+                    tuple[y][x] = (INT)v;
+                }
+                p += n > 1 ? packedBytes(n - 1, bits) : 0;
+                break;
+            }
+
+            case CMP_RLE: {
+                UINT nruns;
+                p = get16(p, &nruns);
+                UINT y = 0;
+                for (UINT r = 0; r < nruns; r++) {
+                    INT v;
+                    UINT len;
+                    p = get32(p, &v);
+                    p = get16(p, &len);
+                    for (UINT k = 0; k < len; k++) tuple[y++][x] = v;
+                }
+                break;
+            }
+
+            case CMP_DICT: {
+                UINT ndict;
+                p = get16(p, &ndict);
+                const char* dict = p;
+                p += 4 * ndict;
+                UINT bits = (unsigned char)*p++;
+                br.in = (const unsigned char*)p;
+                for (UINT y = 0; y < n; y++) {
+                    memcpy(&tuple[y][x], dict + 4 * getBits(&br, bits), 4);
+                }
+                p += packedBytes(n, bits);
+                break;
+            }
+        }
+
+    }
+
+}
@@ -0,0 +1,71 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include <stdio.h>
+#include "db.h"
+
+// compressed page layout:
+//   INT64 pageid | UINT16 ntuples | column 0 | column 1 | ... | 0 ...
+// each column is stored column-wise with its own scheme:
+//   UINT8 scheme | payload
+// schemes, the smallest one is chosen per page and column:
+//   RAW:   INT32 * ntuples
+//   FOR:   INT32 base | UINT8 bits | (value - base) bit-packed
+//   DELTA: INT32 first | INT32 base | UINT8 bits | (delta - base) bit-packed, ntuples - 1 deltas
+//   RLE:   UINT16 nruns | (INT32 value, UINT16 length) * nruns
+//   DICT:  UINT16 ndict | INT32 * ndict | UINT8 bits | dictionary codes bit-packed
+typedef enum Scheme{
+    CMP_RAW,
+    CMP_FOR,
+    CMP_DELTA,
+    CMP_RLE,
+    CMP_DICT,
+    NSCHEMES
+} Scheme;
+
+#define CMP_HEADER 10 // pageid and ntuples
+#define CMP_MAXTUPLES 65535
+#define CMP_DICT_MAX 256 // distinct values of a dictionary
+#define CMP_DICT_SLOTS 512
+
+// per-column summary of the tuples added to a page, enough to size every scheme
+typedef struct ColBuild{
+    INT min;
+    INT max;
+    INT last;
+    int64_t dmin; // smallest and largest difference between neighbouring values
+    int64_t dmax;
+    UINT nruns;
+    UINT ndict; // CMP_DICT_MAX + 1 once the dictionary overflows
+    INT dict[CMP_DICT_MAX];
+    int slots[CMP_DICT_SLOTS]; // hash of dict positions, -1 if empty
+} ColBuild;
+
+// page being filled by the loader
+typedef struct PageBuilder{
+    UINT nattrs;
+    UINT page_size;
+    UINT ntuples;
+    UINT cap;
+    INT* rows;
+    ColBuild* cols;
+} PageBuilder;
+
+PageBuilder* newPageBuilder(const UINT nattrs, const UINT page_size);
+void freePageBuilder(PageBuilder* pb);
+
+// add a tuple if the compressed page still fits, return -1 if the page is full
+int pbAdd(PageBuilder* pb, const INT* tuple);
+
+// encode the page into page_size bytes of page and start an empty page
+void pbEncode(PageBuilder* pb, const UINT64 pageid, char* page);
+
+// encode the page, write page_size bytes and start an empty page
+void pbWrite(PageBuilder* pb, const UINT64 pageid, FILE* fp);
+
+// number of tuples of a compressed page, page starts at the pageid
+UINT pageTuples(const char* page);
+
+// decode every column of a compressed page into tuple[ntuples][nattrs]
+void decodePage(const char* page, const UINT nattrs, INT** tuple);
+
+#endif
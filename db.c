@@ -6,10 +6,39 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "db.h"
+#include "compress.h"
+#include "perf.h"
+#include "sched.h"
 
 Conf* cf = NULL;
 Database* db = NULL;
+Stats st;
+
+// extent directory of the tablespace, in the order the extents were added
+static Extent* extents = NULL;
+static UINT nextents = 0;
+static UINT extents_cap = 0;
+static UINT64 ts_npages = 0; // pages of the tablespace file, new extents start here
+
+static const char* phase_names[NPHASES] = {"plan", "load", "scan", "build", "probe", "materialize", "log"};
+static const char* counter_names[NCOUNTERS] = {"cycles", "instructions", "llc_misses", "branch_misses", "ctx_switches"};
+static const char* mem_op_names[NMEMOPS] = {"sel", "join", "mjoin", "agg", "result", "other"};
+
+// phases are timed on the thread running the queries, the workers of parallel operators are not
+static pthread_t phase_owner;
+
+// running phases, innermost last; only the innermost one is charged, so a page loaded during a scan
+// counts as load and not as scan
+static Phase phase_stack[NPHASES];
+static int phase_depth = 0;
+
+// time and counters when the innermost phase was last charged
+static UINT64 mark_ns;
+static UINT64 mark_counters[NCOUNTERS];
 
 Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limit, const char* buf_policy){
     cf = malloc(sizeof(Conf));
@@ -17,6 +46,28 @@ Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limi
     cf->buf_slots = buf_slots;
     cf->file_limit = file_limit;
     strcpy(cf->buf_policy,buf_policy);
+    cf->read_io = 0;
+    cf->write_io = 0;
+    cf->total_read_io = 0;
+    cf->quiet = 0;
+    cf->cache_mem = 0;
+    cf->shared_scan = 0;
+    cf->agg_mem = 64 << 20;
+    cf->work_mem = 256 << 20;
+    cf->global_mem = 1 << 30;
+    cf->threads = 1;
+    cf->direct_io = 0;
+    cf->tablespace = 0;
+    cf->disk_page = page_size;
+    cf->io_align = 64;
+    cf->hugepages = HP_OFF;
+    cf->profile = 0;
+    // radix partitions of half the L2 cache, for build sides of more than 4 times its size
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) l2 = 1 << 20;
+    cf->radix_part = l2 / 2;
+    cf->radix_min = 4 * l2;
+    phase_owner = pthread_self();
     return cf;
 }
 
@@ -32,8 +83,241 @@ Database* get_db(){
     return db;
 }
 
+Stats* get_stats(){
+    return &st;
+}
+
+const char* phase_name(Phase ph){
+    return phase_names[ph];
+}
+
+const char* counter_name(Counter c){
+    return counter_names[c];
+}
+
+const char* mem_op_name(MemOp op){
+    return mem_op_names[op];
+}
+
+// fill a page written to a table file up to disk_page bytes
+void pad_page(FILE* fp){
+    INT8 f = 0;
+    for (UINT i = cf->page_size; i < cf->disk_page; i++) fwrite(&f,sizeof(INT8),1,fp);
+}
+
+// drop a file from the OS page cache
+static void drop_file_cache(const char* path){
+    int fd = open(path,O_RDONLY);
+    if(fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// drop the table files from the OS page cache, so the next reads are cold
+void drop_os_cache(){
+    char table_path[200];
+    if(cf->tablespace){
+        tablespace_path(table_path);
+        drop_file_cache(table_path);
+        return;
+    }
+    for (UINT i = 0; i < db->ntables; i++){
+        sprintf(table_path,"%s/%u",db->path,db->tables[i].oid);
+        drop_file_cache(table_path);
+    }
+}
+
 void free_db(){
-    if (db != NULL) free(db);
+    if (db == NULL) return;
+    for (UINT i = 0; i < db->ntables; i++) free(db->tables[i].fences);
+    free(db);
+    free(extents);
+    extents = NULL;
+    nextents = extents_cap = 0;
+    ts_npages = 0;
+}
+
+
+// the tablespace holds the pages of every table and index, the extent directory is kept next to it
+void tablespace_path(char* path){
+    sprintf(path,"%s/tablespace",db->path);
+}
+
+// write the extent directory after it changed: the number of extents, then the extents
+static void write_extents(){
+    char dir_path[200];
+    sprintf(dir_path,"%s/extents",db->path);
+    FILE* fp = fopen(dir_path,"wb");
+    if(fp == NULL) return;
+    fwrite(&nextents,sizeof(UINT),1,fp);
+    fwrite(extents,sizeof(Extent),nextents,fp);
+    fclose(fp);
+}
+
+// extent holding page ipid of object oid, NULL if the page has none
+// the first extent added for a page keeps it, later extents of the object only map pages beyond it
+const Extent* find_extent(const UINT oid, const UINT64 ipid){
+    for (UINT i = 0; i < nextents; i++){
+        const Extent* e = &extents[i];
+        if(e->oid == oid && ipid >= e->ipid && ipid < e->ipid + e->npages) return e;
+    }
+    return NULL;
+}
+
+// add an extent of npages pages of object oid from page ipid on at the end of the tablespace,
+// return its offset in bytes
+UINT64 add_extent(const UINT oid, const UINT64 ipid, const UINT64 npages){
+    if(nextents == extents_cap){
+        extents_cap = extents_cap == 0 ? 64 : extents_cap * 2;
+        extents = realloc(extents,sizeof(Extent)*extents_cap);
+    }
+    Extent* e = &extents[nextents++];
+    e->oid = oid;
+    e->ipid = ipid;
+    e->npages = npages;
+    e->page = ts_npages;
+    ts_npages += npages;
+    write_extents();
+    return e->page * cf->disk_page;
+}
+
+// forget the extents of an object that is rewritten, their pages are not reused
+void drop_extents(const UINT oid){
+    UINT n = 0;
+    for (UINT i = 0; i < nextents; i++){
+        if(extents[i].oid != oid) extents[n++] = extents[i];
+    }
+    nextents = n;
+    write_extents();
+}
+
+
+// table file being written by the loader
+typedef struct TableWriter{
+    FILE* fp;
+    UINT64 page_id;
+    UINT ntuples_per_page;
+    UINT nbytes_free;
+    UINT processed_ntuples; // tuples on the page being written
+    UINT64 fences_cap;
+    PageBuilder* pb; // pages of a compressed table are filled by the page builder
+    UINT shared; // fp is the tablespace, the pages of the table are one extent at its end
+} TableWriter;
+
+// ts is the open tablespace, NULL if the table has a file of its own
+static void open_table(TableWriter* w, Table* t, const char* table_path, FILE* ts){
+    w->shared = ts != NULL;
+    w->fp = w->shared ? ts : fopen(table_path,"wb");
+
+    // reset page id
+    w->page_id = 0;
+
+    // calculate number of tuples per page
+    w->ntuples_per_page = (cf->page_size-sizeof(UINT64))/sizeof(INT)/t->nattrs;
+    w->nbytes_free = (cf->page_size-sizeof(UINT64)) % (sizeof(INT)*t->nattrs);
+    w->processed_ntuples = 0;
+    w->fences_cap = 0;
+    w->pb = t->compressed ? newPageBuilder(t->nattrs,cf->page_size) : NULL;
+}
+
+// a clustered table keeps the first key of every page
+static void add_fence(TableWriter* w, Table* t, const INT* tuple){
+    if(t->cluster_key < 0) return;
+    if(w->page_id == w->fences_cap){
+        w->fences_cap = w->fences_cap == 0 ? 64 : w->fences_cap * 2;
+        t->fences = realloc(t->fences,sizeof(INT)*w->fences_cap);
+    }
+    t->fences[w->page_id] = tuple[t->cluster_key];
+}
+
+static void write_tuple(TableWriter* w, Table* t, const INT* tuple){
+    ++t->ntuples;
+
+    if(w->pb != NULL){
+        if(w->pb->ntuples == 0) add_fence(w,t,tuple);
+
+        // the page is written once the next tuple does not fit
+        if(pbAdd(w->pb,tuple) == -1){
+            pbWrite(w->pb,w->page_id++,w->fp);
+            pad_page(w->fp);
+            add_fence(w,t,tuple);
+            pbAdd(w->pb,tuple);
+        }
+        return;
+    }
+
+    // we are processing the first tuple for a page
+    if(w->processed_ntuples == 0){
+        add_fence(w,t,tuple);
+        // write a page id to the file
+        fwrite(&w->page_id,sizeof(UINT64),1,w->fp);
+        ++w->page_id;
+    }
+    ++w->processed_ntuples;
+
+    fwrite(tuple,sizeof(INT),t->nattrs,w->fp);
+
+    // when the derived number of tuples reaches the maximum number of tuples per page
+    // we add 0 to the end if necessary
+    if(w->processed_ntuples == w->ntuples_per_page){
+        INT8 f = 0;
+        for (UINT i = 0; i < w->nbytes_free; i++) fwrite(&f,sizeof(INT8),1,w->fp);
+        pad_page(w->fp);
+        w->processed_ntuples = 0;
+    }
+}
+
+static void close_table(TableWriter* w, Table* t){
+    if(w->pb != NULL){
+        if(w->pb->ntuples != 0){
+            pbWrite(w->pb,w->page_id++,w->fp);
+            pad_page(w->fp);
+        }
+        freePageBuilder(w->pb);
+        w->pb = NULL;
+    }
+
+    if(w->processed_ntuples != 0){
+        // the last page is not full
+        // add 0 to the end
+        INT8 f = 0;
+        UINT left_space = sizeof(INT)*t->nattrs*(w->ntuples_per_page-w->processed_ntuples)+w->nbytes_free;
+        for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,w->fp);
+        pad_page(w->fp);
+        w->processed_ntuples = 0;
+    }
+
+    t->npages = w->page_id;
+    if(!w->shared) fclose(w->fp);
+    else if(t->npages > 0) add_extent(t->oid,0,t->npages);
+}
+
+// rows of a clustered table are ordered on the clustering key, ties on the following attributes
+static UINT sort_key;
+static UINT sort_nattrs;
+
+static int cmp_rows(const void* a, const void* b){
+    const INT* x = a;
+    const INT* y = b;
+    if(x[sort_key] != y[sort_key]) return x[sort_key] < y[sort_key] ? -1 : 1;
+    for (UINT i = 0; i < sort_nattrs; i++){
+        if(x[i] != y[i]) return x[i] < y[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// order rows of a clustered table, also used for the rows appended to it
+void sort_rows(INT* rows, const UINT64 nrows, const Table* t){
+    sort_key = t->cluster_key;
+    sort_nattrs = t->nattrs;
+    qsort(rows,nrows,sizeof(INT)*t->nattrs,cmp_rows);
+}
+
+static void write_clustered(TableWriter* w, Table* t, INT* rows, const UINT64 nrows){
+    if(t->cluster_key < 0) return;
+    sort_rows(rows,nrows,t);
+    for (UINT64 i = 0; i < nrows; i++) write_tuple(w,t,rows+i*t->nattrs);
 }
 
 
@@ -48,13 +332,19 @@ Database* init_db(char* input_data_path, char* data_path){
         mkdir(data_path, 0777);
     }
 
+    // direct I/O reads whole blocks: pages are stored block aligned and frames are aligned to the block size
+    if(cf->direct_io && stat(data_path, &st) == 0){
+        cf->io_align = st.st_blksize < 512 ? 512 : st.st_blksize;
+        cf->disk_page = (cf->page_size + cf->io_align - 1) / cf->io_align * cf->io_align;
+    }
+
     
     db = NULL;
 
     
     // open the input data file
     FILE* input_fp = fopen(input_data_path,"r");
-    printf("Input data path:%s\n",input_data_path);
+    trace("Input data path:%s\n",input_data_path);
     if (input_fp == NULL){
         perror("Fail to open the input data file.\n");
         exit(-1);
@@ -63,19 +353,21 @@ Database* init_db(char* input_data_path, char* data_path){
 
 
     // file pointer to write tuples 
-    FILE* table_fp = NULL;
+    TableWriter w;
+    w.fp = NULL;
+    w.pb = NULL;
 
-    
-    
-    
-    INT table_idx = -1;
-    INT ntuples_per_page = 0;
-    INT nbytes_free = 0;
-
-    INT processed_ntuples = 0;
+    // the tables are written one after the other into the tablespace
+    FILE* ts = NULL;
 
-    UINT64 page_id = 0;
+    INT table_idx = -1;
     Table t;
+    INT* tuple = NULL;
+
+    // rows of a clustered table, paged once the table is complete
+    INT* rows = NULL;
+    UINT64 nrows = 0;
+    UINT64 rows_cap = 0;
     
     char line[100];
     while(fgets(line,100,input_fp)){
@@ -98,6 +390,16 @@ Database* init_db(char* input_data_path, char* data_path){
             db->ntables = ntables;
             strcpy(db->path,data_path);
 
+            if(cf->tablespace){
+                char ts_path[200];
+                tablespace_path(ts_path);
+                ts = fopen(ts_path,"wb");
+                if(ts == NULL){
+                    perror("Fail to create the tablespace.\n");
+                    exit(-1);
+                }
+            }
+
             // printf("data path: %s\n",db->path);
             
             
@@ -112,21 +414,9 @@ Database* init_db(char* input_data_path, char* data_path){
             // close the old one if exists
             if(table_idx > 0){
                 // the current table is not the first
-
-                if(processed_ntuples != 0){
-                    // the last page is not full
-                    // add 0 to the end
-                    INT8 f = 0;
-                    UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-                    
-                    for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-                
-
-                    processed_ntuples = 0;
-                }
-                
-                fclose(table_fp);
-
+                write_clustered(&w,&db->tables[table_idx-1],rows,nrows);
+                nrows = 0;
+                close_table(&w,&db->tables[table_idx-1]);
             }
 
 
@@ -135,8 +425,36 @@ Database* init_db(char* input_data_path, char* data_path){
 
             // initialzie a table instance
             // Table t;
-            sscanf(line,"%s %u %s %u",desc,&t.oid,t.name,&t.nattrs);
+            // optional trailing options: "compress" stores the table in compressed pages,
+            // "cluster attribute_index" sorts the rows on that attribute before paging
+            int opts = 0;
+            sscanf(line,"%s %u %s %u %n",desc,&t.oid,t.name,&t.nattrs,&opts);
             t.ntuples = 0;
+            t.npages = 0;
+            t.compressed = 0;
+            t.cluster_key = -1;
+            t.fences = NULL;
+
+            char* option = opts > 0 ? strtok(line+opts," \r\n") : NULL;
+            while(option != NULL){
+                if(strcmp(option,"compress") == 0){
+                    t.compressed = 1;
+                }else if(strcmp(option,"cluster") == 0){
+                    char* key = strtok(NULL," \r\n");
+                    if(key != NULL && isdigit(key[0]) && atoi(key) < t.nattrs) t.cluster_key = atoi(key);
+                    else trace("Invalid clustering key for %s, stored unclustered.\n",t.name);
+                }else{
+                    trace("Unknown table option %s\n",option);
+                }
+                option = strtok(NULL," \r\n");
+            }
+
+            // a compressed page must hold at least one tuple
+            if(t.compressed && cf->page_size < CMP_HEADER + 5*t.nattrs){
+                trace("Page size too small to compress %s, stored uncompressed.\n",t.name);
+                t.compressed = 0;
+            }
+            tuple = realloc(tuple,sizeof(INT)*t.nattrs);
             
             
             // add the table pointer to the DB instance
@@ -148,84 +466,57 @@ Database* init_db(char* input_data_path, char* data_path){
             char table_path[200];
             sprintf(table_path,"%s/%u",db->path,t.oid);
             // open file pointer for the table
-            table_fp = fopen(table_path,"wb");
-            
-
-            // reset page id
-            page_id = 0;
-            
-            
-            // calculate number of tuples per page
-            ntuples_per_page = (cf->page_size-sizeof(UINT64))/sizeof(INT)/t.nattrs;
-            nbytes_free = (cf->page_size-sizeof(UINT64)) % (sizeof(INT)*t.nattrs);
-            // printf("ntuples = %u, free bytes = %u\n",ntuples_per_page,nbytes_free);
-
-            processed_ntuples = 0;
+            open_table(&w,&t,table_path,ts);
             
             continue;
         }
         // skip empty lines
         if(!isdigit(line[0])) continue;
 
-        // we are processing the first tuple for a page
-        if(processed_ntuples == 0){
-            // write a page id to the file
-            fwrite(&page_id,sizeof(UINT64),1,table_fp);
-            ++page_id;
-        }
-        ++processed_ntuples;
-        ++db->tables[table_idx].ntuples;
-        // printf("processed tuples = %u, tuples per page = %u\n",processed_ntuples,ntuples_per_page);
-
-
-        // write tuple to file
-        // assume each table has only one file
-        
+        // read each attribute, missing ones are 0
+        UINT x = 0;
         char* token = strtok(line," ");
-        
-        INT attr;
-        while(token != NULL){
-            
-            // read each attribute and write it to the hard drive
-            sscanf(token,"%d",&attr);
-            
-            fwrite(&attr,sizeof(INT),1,table_fp);
-            
+        while(token != NULL && x < t.nattrs){
+            sscanf(token,"%d",&tuple[x++]);
             token = strtok(NULL," ");
         }
+        while(x < t.nattrs) tuple[x++] = 0;
 
-        
-        
-        // when the derived number of tuples reaches the maximum number of tuples per page
-        // we add 0 to the end if necessary
-        if(processed_ntuples == ntuples_per_page){
-            INT8 f = 0;
-            for (UINT i = 0; i < nbytes_free; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-            processed_ntuples = 0;
-
+        if(t.cluster_key >= 0){
+            if(nrows == rows_cap){
+                rows_cap = rows_cap == 0 ? 1024 : rows_cap * 2;
+                rows = realloc(rows,sizeof(INT)*t.nattrs*rows_cap);
+            }
+            memcpy(rows+nrows*t.nattrs,tuple,sizeof(INT)*t.nattrs);
+            nrows++;
+            continue;
         }
-        
+
+        // write tuple to file
+        // assume each table has only one file
+        write_tuple(&w,&db->tables[table_idx],tuple);
 
     }
 
-    if(processed_ntuples != 0){
-        // the last page is not full
-        // add 0 to the end
-        INT8 f = 0;
-        UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-        for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-        processed_ntuples = 0;
+    if(table_idx >= 0){
+        write_clustered(&w,&db->tables[table_idx],rows,nrows);
+        close_table(&w,&db->tables[table_idx]);
     }
-    
-    fclose(table_fp);
+    if(ts != NULL) fclose(ts);
+    free(rows);
+    free(tuple);
     fclose(input_fp);
 
     return db;
 }
 
 void reset_IO(){
+    cf->total_read_io += cf->read_io;
     cf->read_io = 0;
     cf->write_io = 0;
+    memset(&st, 0, sizeof(Stats));
+    // a query that failed inside a phase did not end it
+    phase_depth = 0;
 }
 
 void log_read_page(UINT64 pid){
@@ -234,19 +525,109 @@ void log_read_page(UINT64 pid){
     // printf("\nRead page %lu\n\n",pid);
     cf->read_io ++;
 }
+void log_write_page(UINT64 pid){
+    // the following print info is for testing
+    // comment it out to avoid too much output in terminal when developing
+    // printf("\nWrite page %lu\n\n",pid);
+    cf->write_io ++;
+}
+
 void log_release_page(UINT64 pid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("\nRelease page %lu\n\n",pid);
+    st.evictions ++;
 }
 
 void log_open_file(UINT oid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("\nOpen file %u\n\n",oid);
+    st.file_opens ++;
 }
 void log_close_file(UINT oid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("\nClose file %u\n\n",oid);
+    st.file_closes ++;
+}
+
+void log_buffer_hit(UINT64 pid){
+    st.buf_hits ++;
+}
+
+void log_buffer_miss(UINT64 pid){
+    st.buf_misses ++;
+}
+
+void log_skip_page(UINT64 pid){
+    st.pages_skipped ++;
+}
+
+void log_examine_tuples(UINT64 n){
+    st.tuples_examined += n;
+}
+
+void log_emit_tuples(UINT64 n){
+    st.tuples_emitted += n;
+}
+
+// the workers of a parallel join spill their rows too
+void log_spill_tuples(UINT64 n){
+    __sync_fetch_and_add(&st.tuples_spilled, n);
+}
+
+void log_probe_tuples(UINT64 n){
+    st.tuples_probed += n;
+}
+
+static UINT64 now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// charge the time and counters since the last mark to phase ph,
+// with those of the workers of the parallel operators run in the meantime
+static void charge(Phase ph){
+    UINT64 now = now_ns();
+    st.phase_ns[ph] += now - mark_ns;
+    mark_ns = now;
+
+    if(!cf->profile) return;
+    UINT64 counters[NCOUNTERS];
+    UINT64 workers[NCOUNTERS];
+    perfRead(counters);
+    schedTakeCounters(workers);
+    for (int c = 0; c < NCOUNTERS; c++){
+        st.phase_counters[ph][c] += counters[c] - mark_counters[c] + workers[c];
+        mark_counters[c] = counters[c];
+    }
+}
+
+// phases nest, a phase begun inside another one suspends it until it ends
+void begin_phase(Phase ph){
+    if(!pthread_equal(pthread_self(),phase_owner) || phase_depth == NPHASES) return;
+    if(phase_depth > 0){
+        charge(phase_stack[phase_depth-1]);
+    }else{
+        mark_ns = now_ns();
+        if(cf->profile){
+            // the workers of the operators run outside any phase are not charged
+            UINT64 workers[NCOUNTERS];
+            perfRead(mark_counters);
+            schedTakeCounters(workers);
+        }
+    }
+    phase_stack[phase_depth++] = ph;
+}
+
+void end_phase(Phase ph){
+    if(!pthread_equal(pthread_self(),phase_owner)) return;
+    // phases end innermost first, one ended out of order ends those begun inside it
+    int i = phase_depth - 1;
+    while(i >= 0 && phase_stack[i] != ph) i--;
+    if(i < 0) return;
+    charge(phase_stack[phase_depth-1]);
+    phase_depth = i;
 }
\ No newline at end of file
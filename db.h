@@ -15,7 +15,8 @@
 // returned data type by relational operators
 typedef struct _Table{
     UINT nattrs;
-    UINT ntuples;
+    UINT64 ntuples;
+    FILE* spill; // temporary file holding the rows instead of tuples, NULL for a table in memory
     Tuple tuples[];
 } _Table;
 
@@ -24,7 +25,11 @@ typedef struct Table{
     UINT oid;
     char name[10];
     UINT nattrs;
-    UINT ntuples;
+    UINT64 ntuples;
+    UINT64 npages;
+    UINT compressed; // pages are compressed column-wise, see compress.h
+    INT cluster_key; // attribute the rows are sorted on, -1 if the table is not clustered
+    INT* fences; // first key of every page of a clustered table
 } Table;
 
 // internal database meta information
@@ -34,6 +39,21 @@ typedef struct Database {
     Table tables[];
 } Database;
 
+// run of consecutive pages of one table or index in the tablespace file
+typedef struct Extent{
+    UINT oid;
+    UINT64 ipid; // page of the object the extent starts with
+    UINT64 npages;
+    UINT64 page; // page of the tablespace the extent starts at
+} Extent;
+
+// huge pages backing the page buffer arena
+typedef enum HugePages{
+    HP_OFF,
+    HP_TRANSPARENT, // madvise(MADV_HUGEPAGE)
+    HP_EXPLICIT // MAP_HUGETLB, transparent if none are reserved
+} HugePages;
+
 // system configuration
 typedef struct Conf{
     UINT read_io;
@@ -42,8 +62,78 @@ typedef struct Conf{
     UINT buf_slots;
     UINT file_limit;
     char buf_policy[4];
+    UINT64 total_read_io; // read_io of all queries before the running one
+    UINT quiet; // suppress tracing to stdout
+    UINT64 cache_mem; // memory budget of the result cache in bytes, 0 disables it
+    UINT shared_scan; // answer runs of selections with one scan per table
+    UINT64 agg_mem; // memory budget of an aggregation hash table in bytes, groups beyond it spill to disk
+    UINT64 work_mem; // memory budget of a query in bytes, operators past it spill to temporary files
+    UINT64 global_mem; // memory budget of the running queries and the result cache together in bytes
+    UINT threads; // workers of the parallel operators, 1 runs them serially
+    UINT direct_io; // read table files with O_DIRECT
+    UINT tablespace; // store every table and index in one file of extents instead of a file each
+    UINT disk_page; // bytes between pages on disk, page_size rounded up to io_align with direct I/O
+    UINT io_align; // alignment of I/O frames
+    HugePages hugepages;
+    UINT profile; // read the counters of perf.h around every phase
+    UINT64 radix_min; // build side in bytes past which a hash join in memory is radix partitioned
+    UINT64 radix_part; // build side in bytes of a radix partition, its hash table included
 } Conf;
 
+// tracing to stdout, suppressed in quiet mode
+#define trace(...) do { if (!get_conf()->quiet) printf(__VA_ARGS__); } while (0)
+
+// execution phases timed by begin_phase() / end_phase()
+typedef enum Phase{
+    PH_PLAN,
+    PH_LOAD, // reading a page into the page buffer
+    PH_SCAN, // predicate evaluation over loaded pages
+    PH_BUILD,
+    PH_PROBE,
+    PH_MATERIALIZE,
+    PH_LOG, // writing the result to the log
+    NPHASES
+} Phase;
+
+// counters read around the phases when profiling, see perf.h
+typedef enum Counter{
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_BRANCH_MISSES,
+    PC_CTX_SWITCHES,
+    NCOUNTERS
+} Counter;
+
+// operators the memory of a query is charged to, see memOperator()
+typedef enum MemOp{
+    MEM_SEL,
+    MEM_JOIN,
+    MEM_MJOIN,
+    MEM_AGG,
+    MEM_RESULT, // rows of the result table
+    MEM_OTHER,
+    NMEMOPS
+} MemOp;
+
+// per-query execution statistics, reset together with the io counters
+typedef struct Stats{
+    UINT buf_hits;
+    UINT buf_misses;
+    UINT evictions;
+    UINT file_opens;
+    UINT file_closes;
+    UINT pages_skipped;
+    UINT64 tuples_examined;
+    UINT64 tuples_emitted;
+    UINT64 phase_ns[NPHASES];
+    UINT64 phase_counters[NPHASES][NCOUNTERS]; // filled when profiling
+    UINT64 mem_peak; // bytes held by the query at most
+    UINT64 mem_op[NMEMOPS]; // bytes allocated by each operator
+    UINT64 tuples_spilled; // tuples written to temporary files
+    UINT64 tuples_probed; // probe side tuples of hash joins
+} Stats;
+
 
 
 // declaration for functions in db.c
@@ -53,16 +143,37 @@ void free_conf();
 Conf* get_conf();
 
 Database* init_db(char* input_data_path, char* data_path);
+void sort_rows(INT* rows, const UINT64 nrows, const Table* t);
+void pad_page(FILE* fp);
+void drop_os_cache();
+void tablespace_path(char* path);
+const Extent* find_extent(const UINT oid, const UINT64 ipid);
+UINT64 add_extent(const UINT oid, const UINT64 ipid, const UINT64 npages);
+void drop_extents(const UINT oid);
 Database* get_db();
 void free_db();
 
+Stats* get_stats();
+const char* phase_name(Phase ph);
+const char* counter_name(Counter c);
+const char* mem_op_name(MemOp op);
+
 void reset_IO();
 void log_read_page(UINT64 pid);
 void log_release_page(UINT64 pid);
 void log_open_file(UINT oid);
 void log_close_file(UINT oid);
-
-// void log_write_page(UINT64 pid);
+void log_buffer_hit(UINT64 pid);
+void log_buffer_miss(UINT64 pid);
+void log_skip_page(UINT64 pid);
+void log_examine_tuples(UINT64 n);
+void log_emit_tuples(UINT64 n);
+void log_spill_tuples(UINT64 n);
+void log_probe_tuples(UINT64 n);
+void log_write_page(UINT64 pid);
+
+void begin_phase(Phase ph);
+void end_phase(Phase ph);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+#include "arena.h"
+
+exIndex* indexes = NULL;
+int nindexes = 0;
+
+
+// entries are ordered on key, then on ipid and slot as unsigned numbers
+static int cmpEntry(const void* a, const void* b) {
+    const INT* x = a;
+    const INT* y = b;
+    if (x[0] != y[0]) return (x[0] > y[0]) - (x[0] < y[0]);
+    for (int i = 1; i < INDEX_NATTRS; i++) {
+        if (x[i] != y[i]) return ((UINT)x[i] > (UINT)y[i]) - ((UINT)x[i] < (UINT)y[i]);
+    }
+    return 0;
+}
+
+
+exIndex* getIndex(const char* table_name, const UINT idx) {
+    for (int i = 0; i < nindexes; i++) {
+        if (!indexes[i].stale && strcmp(indexes[i].table_name, table_name) == 0 && indexes[i].attr == idx) {
+            return &indexes[i];
+        }
+    }
+    return NULL;
+}
+
+
+exTable* getIndexMeta(const char* index_name) {
+    for (int i = 0; i < nindexes; i++) {
+        if (strcmp(indexes[i].meta.name, index_name) == 0) {
+            return &indexes[i].meta;
+        }
+    }
+    return NULL;
+}
+
+
+// first oid not used by any table or index
+static UINT nextOid() {
+    Database* db = get_db();
+    UINT oid = 0;
+    for (int i = 0; i < db->ntables; i++) {
+        if (db->tables[i].oid >= oid) oid = db->tables[i].oid + 1;
+    }
+    for (int i = 0; i < nindexes; i++) {
+        if (indexes[i].meta.oid >= oid) oid = indexes[i].meta.oid + 1;
+    }
+    return oid;
+}
+
+
+// write the sorted entries of ix as its file, in the table page format, and set its size and root level
+static int writeIndex(exIndex* ix, const INT* entries, const UINT64 nentries) {
+
+    Conf* cf = get_conf();
+    Database* db = get_db();
+    exTable* m = &ix->meta;
+
+    m->ntuples = nentries;
+    m->npages = nentries / m->ntpp;
+    if (nentries % m->ntpp != 0) m->npages++;
+    ix->fence = realloc(ix->fence, sizeof(INT) * (m->npages + 1));
+
+    // in the tablespace the index is rewritten as a new extent, the old one is left unused
+    char i_path[200];
+    FILE* file;
+    if (cf->tablespace) {
+        drop_extents(m->oid);
+        tablespace_path(i_path);
+        file = fopen(i_path, "r+b");
+        if (file == NULL) return -1;
+        if (m->npages > 0) fseeko(file, add_extent(m->oid, 0, m->npages), SEEK_SET);
+    } else {
+        sprintf(i_path, "%s/%u", db->path, m->oid);
+        file = fopen(i_path, "wb");
+        if (file == NULL) return -1;
+    }
+
+    char* page = arenaAlloc(queryArena(), cf->disk_page);
+    for (UINT64 p = 0; p < m->npages; p++) {
+        UINT64 left = nentries - p * m->ntpp;
+        UINT n = left > m->ntpp ? m->ntpp : (UINT)left;
+        memset(page, 0, cf->disk_page);
+        memcpy(page, &p, sizeof(UINT64));
+        memcpy(page + sizeof(UINT64), entries + p * m->ntpp * INDEX_NATTRS, sizeof(INT) * INDEX_NATTRS * n);
+        fwrite(page, cf->disk_page, 1, file);
+        ix->fence[p] = entries[p * m->ntpp * INDEX_NATTRS];
+        log_write_page(p);
+    }
+    fclose(file);
+
+    return 0;
+
+}
+
+
+int createIndex(const UINT idx, const char* table_name) {
+
+    exTable* tmeta = getTableMeta(table_name);
+    if (tmeta == NULL || idx >= tmeta->nattrs) return -1;
+    if (getIndex(table_name, idx) != NULL) return 0;
+
+    trace("\ncreateIndex() is invoked.\n");
+
+    if (tmeta->npages > INDEX_MAXPAGES) {
+        trace("%s has %lu pages, more than an index can address.\n", table_name, (unsigned long)tmeta->npages);
+        return -1;
+    }
+
+    Conf* cf = get_conf();
+
+    // collect (key, ipid, slot) of every tuple, scratch space lives in the query arena
+    INT* entries = arenaAlloc(queryArena(), sizeof(INT) * INDEX_NATTRS * (tmeta->ntuples + 1));
+    UINT64 nentries = 0;
+
+    for (UINT64 ipid = 0; ipid < tmeta->npages; ipid++) {
+
+        int bid = requestPage(table_name, ipid);
+        if (bid == -1) return -1;
+
+        for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
+            INT* e = entries + nentries * INDEX_NATTRS;
+            e[0] = pageBuffer[bid]->tuple[y][idx];
+            e[1] = (INT)ipid;
+            e[2] = y;
+            nentries++;
+        }
+
+        releasePage(bid);
+
+    }
+
+    qsort(entries, nentries, sizeof(INT) * INDEX_NATTRS, cmpEntry);
+
+    // register the index, paged like a table of INDEX_NATTRS attributes
+    indexes = realloc(indexes, sizeof(exIndex) * (nindexes + 1));
+    exIndex* ix = &indexes[nindexes];
+    exTable* m = &ix->meta;
+
+    m->oid = nextOid();
+    sprintf(m->name, "idx%d", nindexes);
+    m->nattrs = INDEX_NATTRS;
+    m->ntpp = (cf->page_size - 8) / (INDEX_NATTRS * 4);
+    m->compressed = 0;
+    m->cluster_key = -1;
+    m->fences = NULL;
+    m->stats = NULL;
+    m->kern = vecKernels(INDEX_NATTRS);
+    strcpy(ix->table_name, tmeta->name);
+    ix->attr = idx;
+    ix->fence = NULL;
+    ix->stale = 0;
+
+    if (writeIndex(ix, entries, nentries) == -1) {
+        free(ix->fence);
+        return -1;
+    }
+
+    nindexes++;
+
+    trace("index %s on %s.%u | oid: %u | ntuples: %lu | ntpp: %u | npages: %lu\n", m->name, ix->table_name, ix->attr, m->oid, (unsigned long)m->ntuples, m->ntpp, (unsigned long)m->npages);
+
+    return 0;
+
+}
+
+
+int indexInsert(const char* table_name, const INT* rows, const UINT nattrs, const UINT64* ipids, const UINT* slots, const UINT n) {
+
+    int failed = 0;
+    int addressed = n == 0 || ipids[n - 1] < INDEX_MAXPAGES;
+
+    for (int i = 0; i < nindexes; i++) {
+
+        exIndex* ix = &indexes[i];
+        if (ix->stale || strcmp(ix->table_name, table_name) != 0) continue;
+        exTable* m = &ix->meta;
+
+        if (!addressed) {
+            trace("index %s on %s.%u cannot address the new pages, it is no longer used\n", m->name, ix->table_name, ix->attr);
+            ix->stale = 1;
+            failed = 1;
+            continue;
+        }
+
+        INT* fresh = arenaAlloc(queryArena(), sizeof(INT) * INDEX_NATTRS * n);
+        for (UINT j = 0; j < n; j++) {
+            INT* e = fresh + j * INDEX_NATTRS;
+            e[0] = rows[(size_t)j * nattrs + ix->attr];
+            e[1] = (INT)ipids[j];
+            e[2] = slots[j];
+        }
+        qsort(fresh, n, sizeof(INT) * INDEX_NATTRS, cmpEntry);
+
+        // merge them with the entries of the index pages, read through the buffer pool
+        INT* entries = arenaAlloc(queryArena(), sizeof(INT) * INDEX_NATTRS * (m->ntuples + n));
+        UINT64 nentries = 0;
+        UINT j = 0;
+
+        UINT64 p;
+        for (p = 0; p < m->npages; p++) {
+
+            int bid = requestPage(m->name, p);
+            if (bid == -1) break;
+
+            for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
+                INT* e = pageBuffer[bid]->tuple[y];
+                for (; j < n && cmpEntry(fresh + j * INDEX_NATTRS, e) < 0; j++) {
+                    memcpy(entries + nentries++ * INDEX_NATTRS, fresh + j * INDEX_NATTRS, sizeof(INT) * INDEX_NATTRS);
+                }
+                memcpy(entries + nentries++ * INDEX_NATTRS, e, sizeof(INT) * INDEX_NATTRS);
+            }
+
+            releasePage(bid);
+
+        }
+
+        for (; j < n; j++) {
+            memcpy(entries + nentries++ * INDEX_NATTRS, fresh + j * INDEX_NATTRS, sizeof(INT) * INDEX_NATTRS);
+        }
+
+        // the pages of the old file are stale
+        if (p == m->npages) {
+            dropFile(m->name);
+            if (writeIndex(ix, entries, nentries) == 0) {
+                trace("index %s on %s.%u | %u entries added | ntuples: %lu | npages: %lu\n", m->name, ix->table_name, ix->attr, n, (unsigned long)m->ntuples, (unsigned long)m->npages);
+                continue;
+            }
+        }
+
+        trace("index %s on %s.%u is not updated, it is no longer used\n", m->name, ix->table_name, ix->attr);
+        ix->stale = 1;
+        failed = 1;
+
+    }
+
+    return failed ? -1 : 0;
+
+}
+
+
+int indexProbe(exIndex* ix, const INT key, IndexVisit visit, void* ctx) {
+
+    exTable* m = &ix->meta;
+    if (m->npages == 0) return 0;
+
+    // root level: last page starting below key, equal keys may continue from it
+    UINT64 start = 0;
+    UINT64 lo = 0;
+    UINT64 hi = m->npages;
+    while (lo < hi) {
+        UINT64 mid = lo + (hi - lo) / 2;
+        if (ix->fence[mid] < key) {
+            start = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    int nmatches = 0;
+    int done = 0;
+    int data_bid = -1;
+    UINT64 data_ipid = 0;
+
+    // leaf level: scan index pages until the first key past the probe key
+    for (UINT64 p = start; p < m->npages && ix->fence[p] <= key && !done; p++) {
+
+        int bid = requestPage(m->name, p);
+        if (bid == -1) break;
+
+        for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
+
+            INT* e = pageBuffer[bid]->tuple[y];
+            if (e[0] < key) continue;
+            if (e[0] > key) {
+                done = 1;
+                break;
+            }
+
+            // entries of one key are sorted on ipid, each data page is requested once per probe
+            if (data_bid == -1 || (UINT)e[1] != data_ipid) {
+                if (data_bid != -1) releasePage(data_bid);
+                data_bid = requestPage(ix->table_name, (UINT)e[1]);
+                data_ipid = (UINT)e[1];
+                if (data_bid == -1) break;
+            }
+
+            log_examine_tuples(1);
+            visit(ctx, data_bid, e[2]);
+            nmatches++;
+
+        }
+
+        releasePage(bid);
+
+    }
+
+    if (data_bid != -1) releasePage(data_bid);
+
+    return nmatches;
+
+}
+
+
+void freeIndexes() {
+    for (int i = 0; i < nindexes; i++) {
+        free(indexes[i].fence);
+    }
+    free(indexes);
+    indexes = NULL;
+    nindexes = 0;
+}
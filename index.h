@@ -0,0 +1,45 @@
+#ifndef INDEX_H
+#define INDEX_H
+#include "db.h"
+#include "ro.h"
+
+#define INDEX_NATTRS 3 // index entries are (key, ipid, slot) tuples
+#define INDEX_MAXPAGES UINT32_MAX // the ipid of an entry is 32 bits, tables past it are not indexed
+
+// secondary index on one attribute of a table
+// entries are sorted on key and paged like a table, so index pages go through the buffer pool
+typedef struct exIndex{
+    exTable meta; // the index file
+    char table_name[10];
+    UINT attr;
+    INT* fence; // first key of every index page, kept in memory as the root level
+    int stale; // missed the rows of an insert it could not be updated for, no longer used
+} exIndex;
+
+// called for every matching tuple, the data page is pinned during the call
+typedef void (*IndexVisit)(void* ctx, const int bid, const int slot);
+
+// build an index with a full scan of the table, return -1 if the table does not exist
+// or has more than INDEX_MAXPAGES pages
+int createIndex(const UINT idx, const char* table_name);
+
+// add the entries of n rows appended to a table to every index on it, rows[j] being at slot slots[j]
+// of page ipids[j]; the entries are merged with those of the index pages and the index file is rewritten
+// an index that cannot be updated, a page cannot be read, its file cannot be written or a row lands
+// past INDEX_MAXPAGES pages, is left stale
+// and is no longer used, the others are still updated
+// return -1 if an index was left stale
+int indexInsert(const char* table_name, const INT* rows, const UINT nattrs, const UINT64* ipids, const UINT* slots, const UINT n);
+
+// index on table_name.idx, NULL if none or stale
+exIndex* getIndex(const char* table_name, const UINT idx);
+
+// meta of an index file, looked up by its page buffer name
+exTable* getIndexMeta(const char* index_name);
+
+// visit every tuple with attr = key, return the number of matches
+int indexProbe(exIndex* ix, const INT key, IndexVisit visit, void* ctx);
+
+void freeIndexes();
+
+#endif
@@ -7,13 +7,84 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "db.h"
 #include "ro.h"
+#include "mjoin.h"
+#include "index.h"
+#include "arena.h"
+#include "cache.h"
+#include "server.h"
+#include "agg.h"
+#include "topn.h"
+#include "sched.h"
+#include "perf.h"
 
 
+#define MAX_BATCH 256 // selections answered by one round of shared scans
+
+// one selection of a shared scan batch
+typedef struct SelQuery{
+    UINT idx;
+    INT val;
+    char table_name[50];
+} SelQuery;
+
+// "limit n" or "top n by attr [desc]" ending a sel, join or mjoin
+typedef struct Limit{
+    UINT64 n; // NO_LIMIT without either
+    int top;
+    UINT attr;
+    int desc;
+} Limit;
+
 void run(char* ra_path, char* log_path);
+void runQueries(FILE* query_fp, FILE* log_fp);
+void runBatch(SelQuery* batch, const UINT n, FILE* log_fp);
 void freeT(_Table* t);
+void accountT(_Table* t);
 void logT(_Table* t, FILE* log_fp);
+void logPlan(const char* query, Plan* plan, _Table* t, const int analyze, FILE* log_fp);
+void writeReport(const char* report_path, UINT64 load_ns, UINT64 run_ns);
+int setOption(const char* name, const char* value);
+void selKey(char* key, const UINT idx, const int64_t lo, const int64_t hi, const char* table_name);
+int parseSel(const char* q, UINT* idx, int64_t* lo, int64_t* hi, char* table_name);
+int parseMJoin(const char* q, JoinCond* conds, UINT* nconds);
+int runSource(const char* src);
+const char* clauseStart(const char* q);
+int parseProj(const char* q, Projection* proj);
+const char* limitClause(const char* q);
+int parseLimit(const char* q, Limit* lim);
+void limitKey(char* key, const Limit* lim);
+TopN* startTop(const Limit* lim);
+_Table* finishTop(TopN* tn, _Table* t);
+void projKey(char* key, const Projection* proj);
+void normKey(char* key, const char* q);
+int parseRow(const char* s, const UINT nattrs, INT* row);
+INT* readRows(const char* path, const UINT nattrs, UINT* n);
+void logInsert(const char* table_name, const int n, const UINT requested, const int index_failed, FILE* log_fp);
+void writeProfile(const char* query);
+
+// queries executed and result tuples produced, counted when a result is freed
+UINT64 nqueries = 0;
+UINT64 nresults = 0;
+
+// per-query phase profile, NULL unless profile=path is given
+FILE* profile_fp = NULL;
+
+// only equality selections of whole tuples are batched, and not on the clustering key, which is answered by binary search
+static int batchable(const char* q, const char* operator, const UINT idx, const char* table_name){
+    exTable* tmeta = getTableMeta(table_name);
+    return parseCmpOp(operator) == OP_EQ && strstr(clauseStart(q)," project") == NULL && limitClause(q) == NULL &&
+        (tmeta == NULL || tmeta->cluster_key != (INT)idx);
+}
+
+static UINT64 now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 int main(int argc, char **argv){
     // argv[1] int: page size
@@ -24,6 +95,16 @@ int main(int argc, char **argv){
     // argv[6] string: path for data file
     // argv[7] string: path for test cases
     // argv[8] string: path for output log
+    // optional options after argv[8]:
+    //   quiet: no tracing to stdout
+    //   report=path: append a line of run measurements to path
+    //   io=direct: read table pages with O_DIRECT, bypassing the OS page cache
+    //   storage=tablespace: store every table and index in one file of extents, read through one descriptor
+    //   cold: drop the table files from the OS page cache before running the queries
+    //   hugepages=thp|explicit: back the page buffer with transparent or reserved huge pages
+    //   serve=path: after the test cases, keep the database open and serve queries on a Unix socket, "-" for stdin
+    //   threads=N: workers of the parallel operators, as "set threads N"
+    //   profile=path: append the time and perf counters of every phase of every query to path
 
     if (argc < 8) {
         printf("Insufficient arguments\n");
@@ -37,24 +118,79 @@ int main(int argc, char **argv){
     sscanf(argv[3],"%u",&file_limit);
     Conf* cf = init_conf(page_size,buf_slots,file_limit,argv[4]);
 
-    printf("Page size: %u, buffer slots: %u, limit of opened files: %u, buffer replacement policy: %s\n",cf->page_size, cf->buf_slots, cf->file_limit, cf->buf_policy);
+    char* report_path = NULL;
+    char* serve_path = NULL;
+    int cold = 0;
+    for (int i = 9; i < argc; i++){
+        if(strcmp(argv[i],"quiet") == 0) cf->quiet = 1;
+        else if(strncmp(argv[i],"report=",7) == 0) report_path = argv[i]+7;
+        else if(strcmp(argv[i],"io=direct") == 0) cf->direct_io = 1;
+        else if(strcmp(argv[i],"io=buffered") == 0) cf->direct_io = 0;
+        else if(strcmp(argv[i],"storage=tablespace") == 0) cf->tablespace = 1;
+        else if(strcmp(argv[i],"storage=files") == 0) cf->tablespace = 0;
+        else if(strcmp(argv[i],"cold") == 0) cold = 1;
+        else if(strncmp(argv[i],"serve=",6) == 0) serve_path = argv[i]+6;
+        else if(strcmp(argv[i],"hugepages=off") == 0) cf->hugepages = HP_OFF;
+        else if(strcmp(argv[i],"hugepages=thp") == 0) cf->hugepages = HP_TRANSPARENT;
+        else if(strcmp(argv[i],"hugepages=explicit") == 0) cf->hugepages = HP_EXPLICIT;
+        else if(strncmp(argv[i],"threads=",8) == 0) setOption("threads",argv[i]+8);
+        else if(strncmp(argv[i],"profile=",8) == 0){
+            profile_fp = fopen(argv[i]+8,"a");
+            if(profile_fp == NULL) perror("Fail to open the profile file.\n");
+        }
+        else printf("Unknown option %s\n",argv[i]);
+    }
+
+    // stdout carries the responses to the queries on stdin
+    if(serve_path != NULL && strcmp(serve_path,"-") == 0) cf->quiet = 1;
+
+    trace("Page size: %u, buffer slots: %u, limit of opened files: %u, buffer replacement policy: %s\n",cf->page_size, cf->buf_slots, cf->file_limit, cf->buf_policy);
+
+    // counters the system does not provide are left out, the phases are still timed
+    if(profile_fp != NULL) cf->profile = perfOpen() > 0;
 
     // load data and write database files
+    UINT64 t0 = now_ns();
     init_db(argv[6],argv[5]);
     
     
     // implement your initialization function.
     init();
+    UINT64 t1 = now_ns();
+
+    // not part of the load time
+    if(cold){
+        drop_os_cache();
+        t1 = now_ns();
+    }
 
 
     // run test cases and write the log file
     run(argv[7],argv[8]);
+    UINT64 t2 = now_ns();
+
+    if(report_path != NULL) writeReport(report_path,t1-t0,t2-t1);
+
+    // the buffer pools stay warm for the served queries
+    if(serve_path != NULL) serve(serve_path,runQueries);
+
+    arenaFree(queryArena());
+    CacheStats* cs = getCacheStats();
+    trace("\ncache: hits %u | misses %u | inserts %u | evictions %u | invalidations %u\n",
+        cs->hits,cs->misses,cs->inserts,cs->evictions,cs->invalidations);
+    freeCache();
+    SchedStats* ss = getSchedStats();
+    trace("sched: tasks %lu | stolen %lu\n",(unsigned long)ss->tasks,(unsigned long)ss->stolen);
+    schedShutdown();
 
 
     // implement your release function.
     release();
 
 
+    if(profile_fp != NULL) fclose(profile_fp);
+    perfClose();
+
     // release database instance and system configuration instance
     free_db();
     free_conf();
@@ -67,36 +203,185 @@ int main(int argc, char **argv){
 // load test cases and test sel and join
 void run(char* ra_path, char* log_path){
 
-    
-
     FILE* query_fp = fopen(ra_path,"r");
-    char line[100];
-
 
     // replace the old log file if exists
     FILE* log_fp = fopen(log_path,"w");
 
-    while(fgets(line,100,query_fp)){
+    runQueries(query_fp,log_fp);
+
+    fclose(log_fp);
+    fclose(query_fp);
+}
+
+// run the queries of query_fp and write their results to log_fp
+void runQueries(FILE* query_fp, FILE* log_fp){
+
+    char line[256];
+
+    // a line read ahead by a shared scan batch, processed next
+    char next[256];
+    int have_next = 0;
+
+    // the query run by the last iteration, profiled once it is logged
+    char profiled[256] = "";
+
+    while(1){
+
+        if(profiled[0] != '\0'){
+            writeProfile(profiled);
+            profiled[0] = '\0';
+        }
+
+        if(have_next){
+            strcpy(line,next);
+            have_next = 0;
+        }else if(fgets(line,256,query_fp) == NULL){
+            break;
+        }
 
         // lines to write comments
         if(line[0] == '#') continue;
 
-        // process selection operator
-        if(line[0] == 's'){
+        // start every query with an empty arena
+        arenaReset(queryArena());
+        memOperator(MEM_OTHER);
+        setQueryLimit(NO_LIMIT);
+
+        // "explain" reports the plan instead of the result
+        // "explain analyze" also executes the query and reports measured statistics
+        char* q = line;
+        int explain = 0;
+        int explain_analyze = 0;
+        if(strncmp(q,"explain",7) == 0){
+            explain = 1;
+            q += 7;
+            while(*q == ' ') q++;
+            if(strncmp(q,"analyze",7) == 0){
+                explain_analyze = 1;
+                q += 7;
+                while(*q == ' ') q++;
+            }
+            q[strcspn(q,"\r\n")] = '\0';
+        }
+
+        // change a runtime setting: "set name value"
+        if(strncmp(q,"set ",4) == 0){
+            char ra[20];
+            char name[50];
+            char value[50];
+
+            if(sscanf(q,"%s %49s %49s",ra,name,value) == 3) setOption(name,value);
+
+            continue;
+        }
+
+        if(profile_fp != NULL){
+            strcpy(profiled,line);
+            profiled[strcspn(profiled,"\r\n")] = '\0';
+        }
+
+        // shared scans: read ahead over the run of selections starting here,
+        // it ends at the first other query or after MAX_BATCH selections
+        if(get_conf()->shared_scan && !explain && q[0] == 's'){
+            SelQuery batch[MAX_BATCH];
+            UINT n = 0;
             char ra[20];
-            UINT idx = 0;
-            INT val = 0;
             char operator[10];
+
+            sscanf(q,"%s %u %d %9s %49s",ra,&batch[n].idx,&batch[n].val,operator,batch[n].table_name);
+
+            if(batchable(q,operator,batch[n].idx,batch[n].table_name)){
+                n++;
+
+                while(n < MAX_BATCH && fgets(next,256,query_fp) != NULL){
+                    if(next[0] == '#' || next[strspn(next," \t\r\n")] == '\0') continue;
+                    operator[0] = '\0';
+                    sscanf(next,"%s %u %d %9s %49s",ra,&batch[n].idx,&batch[n].val,operator,batch[n].table_name);
+                    if(next[0] != 's' || strncmp(next,"set ",4) == 0 || !batchable(next,operator,batch[n].idx,batch[n].table_name)){
+                        have_next = 1;
+                        break;
+                    }
+                    n++;
+                }
+
+                runBatch(batch,n,log_fp);
+
+                continue;
+            }
+        }
+
+        // aggregate the rows of a selection, join, multi-way join or table
+        // "agg func attr ... [by attr ...] from source", the source rows stream into the hash table
+        if(strncmp(q,"agg ",4) == 0){
+            AggSpec spec;
+            char* src;
+            if(parseAgg(q,&spec,&src) == -1){
+                trace("Malformed aggregate %s",q);
+                continue;
+            }
+
+            reset_IO();
+
+            char key[CACHE_KEYLEN];
+            normKey(key,q);
+            _Table* result = cacheGet(key);
+            if(result == NULL){
+                size_t avail = memAvailable();
+                Aggregator* ag = newAggregator(&spec,get_conf()->agg_mem < avail ? get_conf()->agg_mem : avail);
+                RowSink sink = {aggConsume,ag};
+                setQuerySink(&sink);
+                int ok = runSource(src);
+                setQuerySink(NULL);
+                result = ok == 0 ? aggFinish(ag) : NULL;
+                freeAggregator(ag);
+                cachePut(key,result);
+            }
+
+            logT(result, log_fp);
+
+            freeT(result);
+
+            continue;
+        }
+
+        // process selection operator
+        if(q[0] == 's'){
+            UINT idx = 0;
+            int64_t lo, hi;
             char table_name[50];
+            Projection proj;
 
-            // ra is "sel"
-            // operator is not used for now, i.e., only consider "=="
-            // we assume operator is = for simplicity
-            sscanf(line,"%s %u %d %s %s",ra,&idx,&val,operator,table_name);
+            Limit lim;
+            if(parseSel(q,&idx,&lo,&hi,table_name) == -1 || parseProj(q,&proj) == -1 || parseLimit(q,&lim) == -1) continue;
+            Projection* pp = proj.n > 0 ? &proj : NULL;
 
             reset_IO();
 
-            _Table* result = sel(idx,val,table_name);
+            if(explain){
+                Plan plan;
+                if(planSelRange(idx,lo,hi,table_name,&plan) == -1) continue;
+                _Table* result = NULL;
+                if(explain_analyze){
+                    TopN* tn = startTop(&lim);
+                    result = finishTop(tn,selProj(idx,lo,hi,table_name,pp));
+                }
+                logPlan(q,&plan,result,explain_analyze,log_fp);
+                freeT(result);
+                continue;
+            }
+
+            // repeated queries are answered from the result cache without reading any page
+            char key[CACHE_KEYLEN];
+            selKey(key,idx,lo,hi,table_name);
+            projKey(key,pp);
+            limitKey(key,&lim);
+            _Table* result = cacheGet(key);
+            if(result == NULL){
+                TopN* tn = startTop(&lim);
+                result = finishTop(tn,selProj(idx,lo,hi,table_name,pp));
+                cachePut(key,result);
+            }
             
 
             // write the result to log file
@@ -109,7 +394,7 @@ void run(char* ra_path, char* log_path){
         }
 
         // process join operator
-        if(line[0] == 'j'){
+        if(q[0] == 'j'){
             char ra[20];
             UINT idx1 = 0;
             UINT idx2 = 0;
@@ -117,14 +402,41 @@ void run(char* ra_path, char* log_path){
             char table1_name[50];
             char table2_name[50];
 
+            Projection proj;
+
             // ra is "join"
 
             // we assume operator is = for simplicity
-            sscanf(line,"%s %u %s %u %s",ra,&idx1,table1_name,&idx2,table2_name);
+            sscanf(q,"%s %u %s %u %s",ra,&idx1,table1_name,&idx2,table2_name);
+            Limit lim;
+            if(parseProj(q,&proj) == -1 || parseLimit(q,&lim) == -1) continue;
+            Projection* pp = proj.n > 0 ? &proj : NULL;
 
             reset_IO();
+
+            if(explain){
+                Plan plan;
+                if(planJoin(idx1,table1_name,idx2,table2_name,&plan) == -1) continue;
+                _Table* result = NULL;
+                if(explain_analyze){
+                    TopN* tn = startTop(&lim);
+                    result = finishTop(tn,joinProj(idx1,table1_name,idx2,table2_name,pp));
+                }
+                logPlan(q,&plan,result,explain_analyze,log_fp);
+                freeT(result);
+                continue;
+            }
             // execute join
-            _Table* result = join(idx1,table1_name,idx2,table2_name);
+            char key[CACHE_KEYLEN];
+            snprintf(key,CACHE_KEYLEN,"join %u %s %u %s",idx1,table1_name,idx2,table2_name);
+            projKey(key,pp);
+            limitKey(key,&lim);
+            _Table* result = cacheGet(key);
+            if(result == NULL){
+                TopN* tn = startTop(&lim);
+                result = finishTop(tn,joinProj(idx1,table1_name,idx2,table2_name,pp));
+                cachePut(key,result);
+            }
 
             logT(result, log_fp);
 
@@ -133,11 +445,126 @@ void run(char* ra_path, char* log_path){
             continue;
         }
 
+        // process multi-way join operator
+        // a chain of conditions "idx1 table1 idx2 table2", each on 4 tokens
+        if(strncmp(q,"mjoin",5) == 0){
+            JoinCond conds[MJ_MAXCONDS];
+            UINT nconds = 0;
+
+            Limit lim;
+            if(parseMJoin(q,conds,&nconds) == -1 || parseLimit(q,&lim) == -1) continue;
+
+            reset_IO();
+
+            if(explain){
+                Plan plan;
+                if(planMJoin(nconds,conds,&plan) == -1) continue;
+                _Table* result = NULL;
+                if(explain_analyze){
+                    TopN* tn = startTop(&lim);
+                    result = finishTop(tn,mjoin(nconds,conds));
+                }
+                logPlan(q,&plan,result,explain_analyze,log_fp);
+                freeT(result);
+                continue;
+            }
+
+            char key[CACHE_KEYLEN];
+            int len = snprintf(key,CACHE_KEYLEN,"mjoin");
+            for (UINT i = 0; i < nconds && len < CACHE_KEYLEN; i++){
+                len += snprintf(key+len,CACHE_KEYLEN-len," %u %s %u %s",
+                    conds[i].idx1,conds[i].table1_name,conds[i].idx2,conds[i].table2_name);
+            }
+            limitKey(key,&lim);
+            _Table* result = cacheGet(key);
+            if(result == NULL){
+                TopN* tn = startTop(&lim);
+                result = finishTop(tn,mjoin(nconds,conds));
+                cachePut(key,result);
+            }
+
+            logT(result, log_fp);
+
+            freeT(result);
+
+            continue;
+        }
+
+        // append rows to a table, "insert table v1 ... vn" for one row
+        // or "insert table from path" for the rows of a file laid out as the rows of the data file
+        if(strncmp(q,"insert ",7) == 0){
+            char ra[20];
+            char table_name[50];
+            char path[200];
+            int off = 0;
+
+            if(sscanf(q,"%19s %49s %n",ra,table_name,&off) != 2) continue;
+            exTable* tmeta = getTableMeta(table_name);
+            if(tmeta == NULL) continue;
+
+            reset_IO();
+
+            INT* rows;
+            UINT n = 1;
+            if(sscanf(q+off,"from %199s",path) == 1){
+                rows = readRows(path,tmeta->nattrs,&n);
+                if(rows == NULL) continue;
+            }else{
+                rows = malloc(sizeof(INT)*tmeta->nattrs);
+                if(parseRow(q+off,tmeta->nattrs,rows) == -1){
+                    trace("Malformed row %s",q);
+                    free(rows);
+                    logInsert(table_name,-1,n,0,log_fp);
+                    continue;
+                }
+            }
+
+            int index_failed = 0;
+            int appended = insertRows(table_name,rows,n,&index_failed);
+            free(rows);
+
+            // cached results of the table are stale
+            if(appended > 0) cacheInvalidate(table_name);
+
+            logInsert(table_name,appended,n,index_failed,log_fp);
+
+            continue;
+        }
+
+        // build an index on one attribute of a table
+        if(strncmp(q,"index",5) == 0){
+            char ra[20];
+            UINT idx = 0;
+            char table_name[50];
+
+            sscanf(q,"%s %u %s",ra,&idx,table_name);
+
+            reset_IO();
+            createIndex(idx,table_name);
+
+            continue;
+        }
+
+        // gather statistics for one table, or for all tables without a table name
+        if(strncmp(q,"analyze",7) == 0){
+            char ra[20];
+            char table_name[50];
+
+            reset_IO();
+
+            if(sscanf(q,"%s %s",ra,table_name) == 2){
+                analyze(table_name);
+            }else{
+                Database* db = get_db();
+                for (UINT i = 0; i < db->ntables; i++) analyze(db->tables[i].name);
+            }
+
+            continue;
+        }
+
         // other operators...
 
     }
-    fclose(log_fp);
-    fclose(query_fp);
 }
 
 // write a _Table to the log file
@@ -145,34 +572,591 @@ void logT(_Table* t, FILE* log_fp){
     // output to log
     if(t == NULL) return;
 
+    begin_phase(PH_LOG);
+
     // a separator "######"
     fprintf(log_fp,"\n######\n");
     // write the number of attributes for each tuple and the number of tuples
     Conf* cf = get_conf();
-    fprintf(log_fp,"%u %u %u\n\n",t->nattrs,t->ntuples,cf->read_io);
+    fprintf(log_fp,"%u %lu %u\n\n",t->nattrs,(unsigned long)t->ntuples,cf->read_io);
+
 
+    // a spilled result is read back one tuple at a time
+    INT* row = t->spill != NULL ? arenaAlloc(queryArena(),sizeof(INT)*(t->nattrs+1)) : NULL;
+    if(t->spill != NULL) rewind(t->spill);
 
-    for (UINT i = 0; i < t->ntuples; i++){
+    for (UINT64 i = 0; i < t->ntuples; i++){
+        INT* tuple = t->tuples[i];
+        if(row != NULL){
+            if(fread(row,sizeof(INT),t->nattrs,t->spill) != t->nattrs) break;
+            tuple = row;
+        }
         // write each tuple, separate attributes by space
         for (UINT j = 0; j < t->nattrs; j++){
-                fprintf(log_fp,"%d ", t->tuples[i][j]);
+                fprintf(log_fp,"%d ", tuple[j]);
         }
         // add '\n' to the end of each tuple
         fprintf(log_fp,"\n");
     }
-    
+
+    end_phase(PH_LOG);
+}
+
+// write the outcome of an insert to the log file, n is -1 if the rows were rejected
+// and fewer than the rows requested if the buffer pool ran out of slots it could write back
+// pages are written back when they are evicted, so write_io counts the pages the insert pushed out
+// indexes that could not be updated for the rows appended are reported on a line of their own
+void logInsert(const char* table_name, const int n, const UINT requested, const int index_failed, FILE* log_fp){
+    Conf* cf = get_conf();
+    fprintf(log_fp,"\n######\n");
+    if(n < 0) fprintf(log_fp,"INSERT %s rejected read_io=%u write_io=%u\n",table_name,cf->read_io,cf->write_io);
+    else if((UINT)n < requested) fprintf(log_fp,"INSERT %s rows=%d of %u read_io=%u write_io=%u\n",table_name,n,requested,cf->read_io,cf->write_io);
+    else fprintf(log_fp,"INSERT %s rows=%d read_io=%u write_io=%u\n",table_name,n,cf->read_io,cf->write_io);
+    if(index_failed) fprintf(log_fp,"INSERT %s indexes not updated, no longer used\n",table_name);
+}
+
+// write a query plan to the log file
+// with analyze, the measured statistics of the executed query follow the plan
+void logPlan(const char* query, Plan* plan, _Table* t, const int analyze, FILE* log_fp){
+    fprintf(log_fp,"\n######\n");
+    fprintf(log_fp,"EXPLAIN%s %s\n",analyze ? " ANALYZE" : "",query);
+
+    if(plan->method == PLAN_MJOIN){
+        fprintf(log_fp,"plan: %s order=%s",methodName(plan->method),plan->order);
+    }else{
+        fprintf(log_fp,"plan: %s outer=%s",methodName(plan->method),plan->outer);
+        if(plan->method != PLAN_SCAN && plan->method != PLAN_CLUSTER) fprintf(log_fp," inner=%s nchunks=%ld",plan->inner,(long)plan->nchunks);
+    }
+    fprintf(log_fp," est_cost=%ld",(long)plan->cost);
+    if(plan->alt_cost >= 0) fprintf(log_fp," alt_cost=%ld",(long)plan->alt_cost);
+    if(plan->est_rows >= 0) fprintf(log_fp," est_rows=%.0f total_cost=%.2f",plan->est_rows,plan->total_cost);
+    fprintf(log_fp,"\n");
+
+    if(!analyze || t == NULL) return;
+
+    Conf* cf = get_conf();
+    Stats* st = get_stats();
+    fprintf(log_fp,"actual: rows=%lu read_io=%u write_io=%u buf_hits=%u buf_misses=%u evictions=%u file_opens=%u file_closes=%u pages_skipped=%u tuples_examined=%lu tuples_emitted=%lu tuples_probed=%lu\n",
+        (unsigned long)t->ntuples,cf->read_io,cf->write_io,st->buf_hits,st->buf_misses,st->evictions,st->file_opens,st->file_closes,st->pages_skipped,
+        (unsigned long)st->tuples_examined,(unsigned long)st->tuples_emitted,(unsigned long)st->tuples_probed);
+
+    UINT64 total = 0;
+    fprintf(log_fp,"time_us:");
+    for (int ph = 0; ph < NPHASES; ph++){
+        fprintf(log_fp," %s=%lu",phase_name(ph),(unsigned long)(st->phase_ns[ph]/1000));
+        total += st->phase_ns[ph];
+    }
+    fprintf(log_fp," total=%lu",(unsigned long)(total/1000));
+    // probe tuples of a hash join per second of the probe phase
+    UINT64 probe_ns = st->phase_ns[PH_PROBE] > 0 ? st->phase_ns[PH_PROBE] : 1;
+    fprintf(log_fp," probe_rows_per_s=%lu\n",(unsigned long)(st->tuples_probed*1000000000.0/probe_ns));
+
+    fprintf(log_fp,"memory: peak=%lu",(unsigned long)st->mem_peak);
+    for (int op = 0; op < NMEMOPS; op++) fprintf(log_fp," %s=%lu",mem_op_name(op),(unsigned long)st->mem_op[op]);
+    fprintf(log_fp," tuples_spilled=%lu\n",(unsigned long)st->tuples_spilled);
+}
+
+// answer a batch of selections with one shared scan per table, results are logged in query order
+// the read_io of a scan is reported by the first selection of its table, the others report 0
+void runBatch(SelQuery* batch, const UINT n, FILE* log_fp){
+    Conf* cf = get_conf();
+    _Table* results[MAX_BATCH];
+    UINT read_io[MAX_BATCH];
+    char keys[MAX_BATCH][CACHE_KEYLEN];
+    int done[MAX_BATCH];
+
+    // the phases of every scan of the batch, reset_IO() clears them
+    Stats phases;
+    memset(&phases,0,sizeof(Stats));
+
+    // cached results first, no cachePut() happens before they are logged
+    for (UINT i = 0; i < n; i++){
+        selKey(keys[i],batch[i].idx,batch[i].val,batch[i].val,batch[i].table_name);
+        reset_IO();
+        results[i] = cacheGet(keys[i]);
+        read_io[i] = 0;
+        done[i] = results[i] != NULL;
+    }
+
+    // one scan for the remaining selections of each table
+    for (UINT i = 0; i < n; i++){
+        if(done[i]) continue;
+
+        UINT m = 0;
+        UINT pos[MAX_BATCH];
+        UINT idx[MAX_BATCH];
+        INT vals[MAX_BATCH];
+        _Table* group[MAX_BATCH];
+        for (UINT j = i; j < n; j++){
+            if(done[j] || strcmp(batch[j].table_name,batch[i].table_name) != 0) continue;
+            pos[m] = j;
+            idx[m] = batch[j].idx;
+            vals[m] = batch[j].val;
+            m++;
+            done[j] = 1;
+        }
+
+        reset_IO();
+        selShared(m,idx,vals,batch[i].table_name,group);
+        for (UINT k = 0; k < m; k++) results[pos[k]] = group[k];
+        read_io[i] = cf->read_io;
+
+        Stats* st = get_stats();
+        for (int ph = 0; ph < NPHASES; ph++){
+            phases.phase_ns[ph] += st->phase_ns[ph];
+            for (int c = 0; c < NCOUNTERS; c++) phases.phase_counters[ph][c] += st->phase_counters[ph][c];
+        }
+    }
+
+    // logT reports the read_io of each selection
+    reset_IO();
+    memcpy(get_stats()->phase_ns,phases.phase_ns,sizeof(phases.phase_ns));
+    memcpy(get_stats()->phase_counters,phases.phase_counters,sizeof(phases.phase_counters));
+    for (UINT i = 0; i < n; i++){
+        cf->read_io = read_io[i];
+        logT(results[i],log_fp);
+        accountT(results[i]);
+    }
+    cf->read_io = 0;
+
+    for (UINT i = 0; i < n; i++){
+        cachePut(keys[i],results[i]);
+        if(results[i] != NULL && results[i]->spill != NULL) fclose(results[i]->spill);
+    }
+
+    // the batch only allocates from the query arena, what it holds at the end is its peak
+    trace("\nmemory: peak %lu bytes\n",(unsigned long)memInUse());
+    arenaReset(queryArena());
+}
+
+// cache key of a selection, normalized to the selected range so "< 5" and "<= 4" share a result
+void selKey(char* key, const UINT idx, const int64_t lo, const int64_t hi, const char* table_name){
+    snprintf(key,CACHE_KEYLEN,"sel %u %ld %ld %s",idx,(long)lo,(long)hi,table_name);
+}
+
+// parse "sel idx val op table" into the selected range [lo, hi]
+// operator is one of = < <= > >=, or "between" followed by the upper bound
+// return -1 for an unknown operator
+int parseSel(const char* q, UINT* idx, int64_t* lo, int64_t* hi, char* table_name){
+    char ra[20];
+    INT val = 0;
+    INT val2 = 0;
+    char operator[10] = "";
+
+    sscanf(q,"%19s %u %d %9s %49s",ra,idx,&val,operator,table_name);
+    int op = parseCmpOp(operator);
+    if(op == OP_BETWEEN) sscanf(q,"%19s %u %d %9s %d %49s",ra,idx,&val,operator,&val2,table_name);
+    if(op == -1){
+        trace("Unknown operator %s\n",operator);
+        return -1;
+    }
+
+    cmpRange(op,val,val2,lo,hi);
+    return 0;
+}
+
+// past the token at q and the spaces before it
+static const char* skipToken(const char* q){
+    q += strspn(q," \t\r\n");
+    return q + strcspn(q," \t\r\n");
+}
+
+// end of the fixed operands of a sel, join, mjoin or table source, where its clauses may start,
+// so that a table named like a clause word is taken as a table
+const char* clauseStart(const char* q){
+    char ra[20] = "";
+    sscanf(q,"%19s",ra);
+    const char* p = skipToken(q);
+
+    if(strcmp(ra,"mjoin") == 0){
+        // a condition starts with an attribute index
+        while(isdigit((unsigned char)p[strspn(p," \t")])){
+            for (int i = 0; i < 4; i++) p = skipToken(p);
+        }
+        return p;
+    }
+
+    int noperands = 0; // a table source is its name
+    if(strcmp(ra,"join") == 0) noperands = 4;
+    if(strcmp(ra,"sel") == 0){
+        char operator[10] = "";
+        sscanf(q,"%*s %*s %*s %9s",operator);
+        noperands = parseCmpOp(operator) == OP_BETWEEN ? 5 : 4;
+    }
+    for (int i = 0; i < noperands; i++) p = skipToken(p);
+    return p;
+}
+
+// parse the chain of conditions of "mjoin", each "idx1 table1 idx2 table2" on 4 tokens
+// return -1 if malformed
+int parseMJoin(const char* q, JoinCond* conds, UINT* nconds){
+    int ntokens = 0;
+    int bad = 0;
+    *nconds = 0;
+
+    // tokenize a copy up to a limit, q is echoed by explain
+    char buf[256];
+    strncpy(buf,q,255);
+    buf[255] = '\0';
+    const char* lim = limitClause(buf);
+    if(lim != NULL) buf[lim-buf] = '\0';
+    char* token = strtok(buf+5," \r\n");
+    while(token != NULL){
+        if(*nconds == MJ_MAXCONDS){
+            bad = 1;
+            break;
+        }
+        JoinCond* c = &conds[*nconds];
+        switch(ntokens % 4){
+            case 0: bad |= sscanf(token,"%u",&c->idx1) != 1; break;
+            case 1: strncpy(c->table1_name,token,49); c->table1_name[49] = '\0'; break;
+            case 2: bad |= sscanf(token,"%u",&c->idx2) != 1; break;
+            case 3: strncpy(c->table2_name,token,49); c->table2_name[49] = '\0'; (*nconds)++; break;
+        }
+        ntokens++;
+        token = strtok(NULL," \r\n");
+    }
+    return bad || ntokens % 4 != 0 ? -1 : 0;
+}
+
+// execute the source query of an aggregate: a selection, join, multi-way join or a whole table
+// its rows go to the query sink, return -1 if it fails
+int runSource(const char* src){
+    char ra[20] = "";
+    sscanf(src,"%19s",ra);
+
+    Projection proj;
+    if(parseProj(src,&proj) == -1) return -1;
+    Projection* pp = proj.n > 0 ? &proj : NULL;
+
+    // the source rows are cut by a limit, a top would need a second sink
+    Limit lim;
+    if(parseLimit(src,&lim) == -1) return -1;
+    if(lim.top){
+        trace("top is not supported in the source of an aggregate\n");
+        return -1;
+    }
+    setQueryLimit(lim.n);
+
+    if(strcmp(ra,"sel") == 0){
+        UINT idx = 0;
+        int64_t lo, hi;
+        char table_name[50];
+        if(parseSel(src,&idx,&lo,&hi,table_name) == -1) return -1;
+        return selProj(idx,lo,hi,table_name,pp) == NULL ? -1 : 0;
+    }
+
+    if(strcmp(ra,"join") == 0){
+        UINT idx1 = 0;
+        UINT idx2 = 0;
+        char table1_name[50];
+        char table2_name[50];
+        if(sscanf(src,"%19s %u %49s %u %49s",ra,&idx1,table1_name,&idx2,table2_name) != 5) return -1;
+        return joinProj(idx1,table1_name,idx2,table2_name,pp) == NULL ? -1 : 0;
+    }
+
+    if(strcmp(ra,"mjoin") == 0){
+        JoinCond conds[MJ_MAXCONDS];
+        UINT nconds = 0;
+        if(parseMJoin(src,conds,&nconds) == -1) return -1;
+        return mjoin(nconds,conds) == NULL ? -1 : 0;
+    }
+
+    // every tuple of a table
+    return selProj(0,INT32_MIN,INT32_MAX,ra,pp) == NULL ? -1 : 0;
+}
+
+// parse the projection list ending a sel or join, "project attr ...", proj->n is 0 without one
+// return -1 if malformed
+int parseProj(const char* q, Projection* proj){
+    proj->n = 0;
+
+    const char* p = strstr(clauseStart(q)," project");
+    if(p == NULL || !(p[8] == '\0' || isspace((unsigned char)p[8]))) return 0;
+    p += 8;
+
+    UINT attr;
+    int n;
+    while(sscanf(p," %u%n",&attr,&n) == 1){
+        if(proj->n == MAX_PROJ) return -1;
+        proj->attrs[proj->n++] = attr;
+        p += n;
+    }
+    const char* lim = limitClause(q);
+    if(proj->n == 0 || (p[strspn(p," \t\r\n")] != '\0' && p != lim)){
+        trace("Malformed projection %s",q);
+        return -1;
+    }
+    return 0;
+}
+
+// start of the limit or top clause ending q, NULL without one
+// only the clauses after the operands are searched, they hold no other word
+const char* limitClause(const char* q){
+    static const char* words[] = {" limit", " top"};
+    const char* from = clauseStart(q);
+    for (int i = 0; i < 2; i++){
+        size_t len = strlen(words[i]);
+        for (const char* p = strstr(from,words[i]); p != NULL; p = strstr(p+1,words[i])){
+            if(p[len] == '\0' || isspace((unsigned char)p[len])) return p;
+        }
+    }
+    return NULL;
+}
+
+// parse the limit or top clause ending q, lim->n is NO_LIMIT without one
+// return -1 if malformed
+int parseLimit(const char* q, Limit* lim){
+    lim->n = NO_LIMIT;
+    lim->top = 0;
+    lim->attr = 0;
+    lim->desc = 0;
+
+    const char* p = limitClause(q);
+    if(p == NULL) return 0;
+
+    int n = 0;
+    int ok;
+    unsigned long rows = 0;
+    if(strncmp(p," limit",6) == 0){
+        ok = sscanf(p," limit %lu%n",&rows,&n) == 1;
+    }else{
+        char by[10] = "";
+        int m = 0;
+        lim->top = 1;
+        // the rows of a top are held in memory, their number is 32-bit
+        ok = sscanf(p," top %lu %9s %u%n",&rows,by,&lim->attr,&n) == 3 && strcmp(by,"by") == 0 && rows < UINT32_MAX;
+        if(ok && sscanf(p+n," desc%n",&m) == 0 && m > 0){
+            lim->desc = 1;
+            n += m;
+        }
+    }
+    lim->n = rows;
+    if(!ok || lim->n == NO_LIMIT || p[n+strspn(p+n," \t\r\n")] != '\0'){
+        trace("Malformed limit %s",q);
+        return -1;
+    }
+    return 0;
+}
+
+// append the limit or top clause to a cache key
+void limitKey(char* key, const Limit* lim){
+    if(lim->n == NO_LIMIT) return;
+    size_t len = strlen(key);
+    if(lim->top) snprintf(key+len,CACHE_KEYLEN-len," top %lu by %u%s",(unsigned long)lim->n,lim->attr,lim->desc ? " desc" : "");
+    else snprintf(key+len,CACHE_KEYLEN-len," limit %lu",(unsigned long)lim->n);
+}
+
+// a limit cuts the rows of the query, a top streams them into a bounded heap, NULL is returned without one
+TopN* startTop(const Limit* lim){
+    if(!lim->top){
+        setQueryLimit(lim->n);
+        return NULL;
+    }
+    TopN* tn = newTopN((UINT)lim->n,lim->attr,lim->desc);
+    RowSink* sink = arenaAlloc(queryArena(),sizeof(RowSink));
+    sink->consume = topConsume;
+    sink->ctx = tn;
+    setQuerySink(sink);
+    return tn;
+}
+
+// result of the query t: the rows of the top, t itself without one
+_Table* finishTop(TopN* tn, _Table* t){
+    setQuerySink(NULL);
+    setQueryLimit(NO_LIMIT);
+    if(tn == NULL || t == NULL) return t;
+    return topFinish(tn,t->nattrs);
+}
+
+// append the projection list to a cache key
+void projKey(char* key, const Projection* proj){
+    if(proj == NULL) return;
+    size_t len = strlen(key);
+    len += snprintf(key+len,CACHE_KEYLEN-len," project");
+    for (UINT i = 0; i < proj->n && len < CACHE_KEYLEN; i++){
+        len += snprintf(key+len,CACHE_KEYLEN-len," %u",proj->attrs[i]);
+    }
+}
+
+// cache key of a query line, runs of whitespace are collapsed to one space
+void normKey(char* key, const char* q){
+    UINT n = 0;
+    for (const char* c = q; *c != '\0' && n < CACHE_KEYLEN - 1; c++){
+        if(isspace((unsigned char)*c)){
+            if(n > 0 && key[n-1] != ' ') key[n++] = ' ';
+        }else{
+            key[n++] = *c;
+        }
+    }
+    if(n > 0 && key[n-1] == ' ') n--;
+    key[n] = '\0';
+}
+
+// values of a row separated by spaces, one integer per attribute
+// return -1 if a value is missing, is not an integer or follows the last attribute
+int parseRow(const char* s, const UINT nattrs, INT* row){
+    char* end;
+    for (UINT x = 0; x < nattrs; x++){
+        long v = strtol(s,&end,10);
+        if(end == s || v < INT32_MIN || v > INT32_MAX) return -1;
+        row[x] = (INT)v;
+        s = end;
+    }
+    while(isspace((unsigned char)*s)) s++;
+    return *s == '\0' ? 0 : -1;
+}
+
+// rows of a file, a row per line, comments and blank lines skipped
+// return NULL if the file cannot be opened, else rows the caller frees
+INT* readRows(const char* path, const UINT nattrs, UINT* n){
+    FILE* fp = fopen(path,"r");
+    if(fp == NULL){
+        trace("Fail to open %s.\n",path);
+        return NULL;
+    }
+
+    UINT cap = 1024;
+    INT* rows = malloc(sizeof(INT)*nattrs*cap);
+    char line[1024];
+    *n = 0;
+
+    while(fgets(line,sizeof(line),fp)){
+        if(line[0] == '#' || line[strspn(line," \t\r\n")] == '\0') continue;
+        if(*n == cap){
+            cap *= 2;
+            rows = realloc(rows,sizeof(INT)*nattrs*cap);
+        }
+        if(parseRow(line,nattrs,rows+(size_t)*n*nattrs) == -1){
+            trace("Malformed row skipped: %s",line);
+            continue;
+        }
+        (*n)++;
+    }
+
+    fclose(fp);
+    return rows;
+}
+
+// count an executed query and its result tuples
+void accountT(_Table* t){
+    if(t == NULL) return;
+    nqueries++;
+    nresults += t->ntuples;
 }
 
 // free the space of _Table
+// result tables and all other per-query memory live in the query arena, released at once
 void freeT(_Table* t){
-    if(t == NULL) return;
+    accountT(t);
+    if(t != NULL && t->spill != NULL) fclose(t->spill);
+    trace("\nmemory: peak %lu bytes\n",(unsigned long)get_stats()->mem_peak);
+    arenaReset(queryArena());
+}
+
+// runtime settings of "set name value", return -1 for an unknown setting
+int setOption(const char* name, const char* value){
+    Conf* cf = get_conf();
+
+    // result cache budget in bytes, 0 turns the cache off and drops its results
+    if(strcmp(name,"cache_mem") == 0){
+        cf->cache_mem = strtoull(value,NULL,10);
+        cacheTrim();
+        return 0;
+    }
+
+    // hash table budget of an aggregate in bytes
+    if(strcmp(name,"agg_mem") == 0){
+        cf->agg_mem = strtoull(value,NULL,10);
+        return 0;
+    }
+
+    // memory budgets in bytes, of one query and of the queries and the result cache together
+    if(strcmp(name,"work_mem") == 0){
+        cf->work_mem = strtoull(value,NULL,10);
+        return 0;
+    }
+    if(strcmp(name,"global_mem") == 0){
+        cf->global_mem = strtoull(value,NULL,10);
+        return 0;
+    }
+
+    // radix partitioned hash joins, build sides past radix_min bytes in partitions of radix_part bytes
+    if(strcmp(name,"radix_min") == 0){
+        cf->radix_min = strtoull(value,NULL,10);
+        return 0;
+    }
+    if(strcmp(name,"radix_part") == 0){
+        cf->radix_part = strtoull(value,NULL,10);
+        return 0;
+    }
+
+    // workers of the parallel operators
+    if(strcmp(name,"threads") == 0){
+        int n = atoi(value);
+        cf->threads = n < 1 ? 1 : n > SCHED_MAXWORKERS ? SCHED_MAXWORKERS : n;
+        return 0;
+    }
 
-    // release memory for each tuple
-    for (UINT i = 0; i < t->ntuples; i++){
-        free(t->tuples[i]);
+    // 1 answers runs of selections with shared scans
+    if(strcmp(name,"shared_scan") == 0){
+        cf->shared_scan = atoi(value) != 0;
+        return 0;
     }
-    // release the whole table
-    free(t);
+
+    trace("Unknown setting %s\n",name);
+    return -1;
+}
+
+// append the profile of a query to the profile file: the query, read_io and write_io, then per phase
+// the time in microseconds and every counter, left empty if it is not available
+// a shared scan batch is profiled as a whole, under its first selection, and reports read_io 0
+void writeProfile(const char* query){
+    Conf* cf = get_conf();
+    Stats* st = get_stats();
+
+    // the header starts a new file
+    if(ftell(profile_fp) == 0){
+        fprintf(profile_fp,"query,read_io,write_io");
+        for (int ph = 0; ph < NPHASES; ph++){
+            fprintf(profile_fp,",%s_us",phase_name(ph));
+            for (int c = 0; c < NCOUNTERS; c++) fprintf(profile_fp,",%s_%s",phase_name(ph),counter_name(c));
+        }
+        fprintf(profile_fp,"\n");
+    }
+
+    fprintf(profile_fp,"\"%s\",%u,%u",query,cf->read_io,cf->write_io);
+    for (int ph = 0; ph < NPHASES; ph++){
+        fprintf(profile_fp,",%lu",(unsigned long)(st->phase_ns[ph]/1000));
+        for (int c = 0; c < NCOUNTERS; c++){
+            if(cf->profile && perfAvailable(c)) fprintf(profile_fp,",%lu",(unsigned long)st->phase_counters[ph][c]);
+            else fprintf(profile_fp,",");
+        }
+    }
+    fprintf(profile_fp,"\n");
+    fflush(profile_fp);
+}
+
+// append one line of measurements, fields are listed in README (Benchmark)
+// load_us,run_us,queries,rows,read_io,peak_rss_kb,queries_per_s,rows_per_s,cache_hits,cache_misses
+void writeReport(const char* report_path, UINT64 load_ns, UINT64 run_ns){
+    FILE* fp = fopen(report_path,"a");
+    if(fp == NULL){
+        perror("Fail to open the report file.\n");
+        return;
+    }
+
+    Conf* cf = get_conf();
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+
+    double run_s = run_ns > 0 ? run_ns / 1e9 : 1e-9;
+    CacheStats* cs = getCacheStats();
+    fprintf(fp,"%lu,%lu,%lu,%lu,%lu,%ld,%.2f,%.2f,%u,%u\n",
+        (unsigned long)(load_ns/1000),(unsigned long)(run_ns/1000),
+        (unsigned long)nqueries,(unsigned long)nresults,(unsigned long)(cf->total_read_io+cf->read_io),
+        ru.ru_maxrss,nqueries/run_s,nresults/run_s,cs->hits,cs->misses);
+    fclose(fp);
 }
 
 
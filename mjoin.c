@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mjoin.h"
+#include "arena.h"
+
+// multi-way join query with tables resolved to positions in order of first appearance
+typedef struct MJQuery {
+    int ntables;
+    exTable* tables[MJ_MAXTABLES];
+    int nconds;
+    int tab1[MJ_MAXCONDS];
+    UINT idx1[MJ_MAXCONDS];
+    int tab2[MJ_MAXCONDS];
+    UINT idx2[MJ_MAXCONDS];
+    double sel[MJ_MAXCONDS]; // estimated selectivity of each condition
+} MJQuery;
+
+// best plan found for one subset of tables
+typedef struct MJEntry {
+    int valid;
+    double cost;
+    double card;
+    UINT probe; // subset streamed into the join, 0 for base tables
+    UINT build; // subset materialized in the hash table
+} MJEntry;
+
+// pipelined operator of the executed join tree
+typedef struct MJNode {
+    int tab; // query table position of a scan, -1 for a join
+    UINT width; // attributes in an output row
+    int ntabs;
+    int tabs[MJ_MAXTABLES]; // tables in output row order
+    UINT offs[MJ_MAXTABLES]; // first attribute of each table in the output row
+
+    // scan state
+    exTable* tmeta;
+    UINT64 ipid;
+    int bid;
+    int y;
+
+    // join state
+    struct MJNode* probe;
+    struct MJNode* build;
+    int nkeys; // the first key pair is hashed, the others are checked per match
+    UINT pkeys[MJ_MAXCONDS];
+    UINT bkeys[MJ_MAXCONDS];
+    RowBuf build_rows; // width of the build child
+    UINT mask;
+    int* buckets;
+    int* next;
+    INT* cur; // current probe row
+    int chain; // next build row to test against cur
+    INT* row; // output row
+} MJNode;
+
+
+static int popcount(UINT x) {
+    return __builtin_popcount(x);
+}
+
+
+static UINT mjHash(const INT key) {
+    return (UINT)key * 2654435761u;
+}
+
+
+// resolve table names of the conditions and estimate the selectivity of each condition
+static int resolve(const UINT nconds, const JoinCond* conds, MJQuery* q) {
+
+    if (nconds == 0 || nconds > MJ_MAXCONDS) return -1;
+
+    q->ntables = 0;
+    q->nconds = nconds;
+
+    for (int c = 0; c < nconds; c++) {
+
+        const char* names[2] = {conds[c].table1_name, conds[c].table2_name};
+        int pos[2];
+
+        for (int k = 0; k < 2; k++) {
+            pos[k] = -1;
+            for (int t = 0; t < q->ntables; t++) {
+                if (strcmp(q->tables[t]->name, names[k]) == 0) pos[k] = t;
+            }
+            if (pos[k] == -1) {
+                exTable* tmeta = getTableMeta(names[k]);
+                if (tmeta == NULL || q->ntables == MJ_MAXTABLES) return -1;
+                pos[k] = q->ntables;
+                q->tables[q->ntables++] = tmeta;
+            }
+        }
+
+        if (pos[0] == pos[1]) return -1;
+        q->tab1[c] = pos[0];
+        q->idx1[c] = conds[c].idx1;
+        q->tab2[c] = pos[1];
+        q->idx2[c] = conds[c].idx2;
+
+        // statistics if both sides are analyzed, otherwise assume a key / foreign key join
+        exTable* t1 = q->tables[pos[0]];
+        exTable* t2 = q->tables[pos[1]];
+        if (t1->stats != NULL && t2->stats != NULL) {
+            q->sel[c] = estSelJoin(&t1->stats->cols[q->idx1[c]], &t2->stats->cols[q->idx2[c]]);
+        } else {
+            UINT64 n = t1->ntuples > t2->ntuples ? t1->ntuples : t2->ntuples;
+            q->sel[c] = n == 0 ? 1 : 1.0 / n;
+        }
+
+    }
+
+    return 0;
+
+}
+
+
+// condition c joins the subsets a and b
+static int crosses(const MJQuery* q, const int c, const UINT a, const UINT b) {
+    UINT m1 = 1u << q->tab1[c];
+    UINT m2 = 1u << q->tab2[c];
+    return ((m1 & a) && (m2 & b)) || ((m1 & b) && (m2 & a));
+}
+
+
+// dynamic programming over table subsets, smallest subsets first
+// bushy trees join any two connected subsets, left-deep trees only build on base tables
+static void enumerate(const MJQuery* q, const int leftdeep, MJEntry* best) {
+
+    UINT full = (1u << q->ntables) - 1;
+
+    for (UINT s = 1; s <= full; s++) {
+
+        best[s].valid = 0;
+
+        if (popcount(s) == 1) {
+            exTable* t = q->tables[__builtin_ctz(s)];
+            best[s].valid = 1;
+            best[s].cost = t->npages + CPU_TUPLE_COST * t->ntuples;
+            best[s].card = t->ntuples;
+            best[s].probe = 0;
+            best[s].build = 0;
+            continue;
+        }
+
+        // every ordered split of s into a probe and a build subset
+        for (UINT p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+
+            UINT b = s ^ p;
+            if (leftdeep && popcount(b) != 1) continue;
+            if (!best[p].valid || !best[b].valid) continue;
+
+            // no cross products
+            double sel = 1;
+            int connected = 0;
+            for (int c = 0; c < q->nconds; c++) {
+                if (crosses(q, c, p, b)) {
+                    sel *= q->sel[c];
+                    connected = 1;
+                }
+            }
+            if (!connected) continue;
+
+            double card = best[p].card * best[b].card * sel;
+            double cost = best[p].cost + best[b].cost + CPU_TUPLE_COST * (BUILD_WEIGHT * best[b].card + best[p].card + card);
+
+            if (!best[s].valid || cost < best[s].cost) {
+                best[s].valid = 1;
+                best[s].cost = cost;
+                best[s].card = card;
+                best[s].probe = p;
+                best[s].build = b;
+            }
+
+        }
+
+    }
+
+}
+
+
+// print the join tree of subset s, probe side on the left
+static void formatTree(const MJQuery* q, const MJEntry* best, const UINT s, char* buf) {
+    if (best[s].probe == 0) {
+        strcat(buf, q->tables[__builtin_ctz(s)]->name);
+        return;
+    }
+    strcat(buf, "(");
+    formatTree(q, best, best[s].probe, buf);
+    strcat(buf, " x ");
+    formatTree(q, best, best[s].build, buf);
+    strcat(buf, ")");
+}
+
+
+static int isLeftDeep(const MJEntry* best, const UINT s) {
+    if (best[s].probe == 0) return 1;
+    return popcount(best[s].build) == 1 && isLeftDeep(best, best[s].probe);
+}
+
+
+static int optimize(const MJQuery* q, MJEntry* best, Plan* plan) {
+
+    UINT full = (1u << q->ntables) - 1;
+    MJEntry ld[1 << MJ_MAXTABLES];
+
+    enumerate(q, 1, ld);
+    enumerate(q, 0, best);
+    if (!best[full].valid) return -1;
+
+    plan->method = PLAN_MJOIN;
+    strcpy(plan->outer, q->tables[0]->name);
+    plan->inner[0] = '\0';
+    plan->outer_idx = 0;
+    plan->inner_idx = 0;
+    plan->swapped = 0;
+    plan->nchunks = 1;
+    plan->cost = 0;
+    for (int t = 0; t < q->ntables; t++) plan->cost += q->tables[t]->npages;
+    plan->alt_cost = -1;
+    plan->est_rows = best[full].card;
+    plan->total_cost = best[full].cost;
+    plan->order[0] = '\0';
+    formatTree(q, best, full, plan->order);
+
+    trace("COST [left-deep: %.2f | bushy: %.2f]\n", ld[full].cost, best[full].cost);
+    trace("%s plan is chosen: %s | est_rows: %.0f\n", isLeftDeep(best, full) ? "left-deep" : "bushy", plan->order, plan->est_rows);
+
+    return 0;
+
+}
+
+
+int planMJoin(const UINT nconds, const JoinCond* conds, Plan* plan) {
+
+    MJQuery q;
+    MJEntry best[1 << MJ_MAXTABLES];
+
+    if (resolve(nconds, conds, &q) == -1) return -1;
+    return optimize(&q, best, plan);
+
+}
+
+
+// attribute position of table tab in the output row of node n, -1 if absent
+static int column(const MJNode* n, const int tab, const UINT idx) {
+    for (int k = 0; k < n->ntabs; k++) {
+        if (n->tabs[k] == tab) return n->offs[k] + idx;
+    }
+    return -1;
+}
+
+
+// build the executed tree of subset s from the dynamic programming table
+// nodes and their hash tables live in the query arena
+static MJNode* makeNode(const MJQuery* q, const MJEntry* best, const UINT s) {
+
+    MJNode* n = arenaAlloc(queryArena(), sizeof(MJNode));
+    memset(n, 0, sizeof(MJNode));
+
+    if (best[s].probe == 0) {
+        n->tab = __builtin_ctz(s);
+        n->tmeta = q->tables[n->tab];
+        n->width = q->tables[n->tab]->nattrs;
+        n->ntabs = 1;
+        n->tabs[0] = n->tab;
+        n->offs[0] = 0;
+        n->ipid = 0;
+        n->bid = -1;
+        return n;
+    }
+
+    n->tab = -1;
+    n->probe = makeNode(q, best, best[s].probe);
+    n->build = makeNode(q, best, best[s].build);
+
+    // output row is the probe row followed by the build row
+    n->width = n->probe->width + n->build->width;
+    n->ntabs = 0;
+    for (int k = 0; k < n->probe->ntabs; k++) {
+        n->tabs[n->ntabs] = n->probe->tabs[k];
+        n->offs[n->ntabs++] = n->probe->offs[k];
+    }
+    for (int k = 0; k < n->build->ntabs; k++) {
+        n->tabs[n->ntabs] = n->build->tabs[k];
+        n->offs[n->ntabs++] = n->probe->width + n->build->offs[k];
+    }
+    n->row = arenaAlloc(queryArena(), sizeof(INT) * n->width);
+
+    // every condition between the two sides
+    n->nkeys = 0;
+    for (int c = 0; c < q->nconds; c++) {
+        if (!crosses(q, c, best[s].probe, best[s].build)) continue;
+        int p = column(n->probe, q->tab1[c], q->idx1[c]);
+        if (p != -1) {
+            n->pkeys[n->nkeys] = p;
+            n->bkeys[n->nkeys] = column(n->build, q->tab2[c], q->idx2[c]);
+        } else {
+            n->pkeys[n->nkeys] = column(n->probe, q->tab2[c], q->idx2[c]);
+            n->bkeys[n->nkeys] = column(n->build, q->tab1[c], q->idx1[c]);
+        }
+        n->nkeys++;
+    }
+
+    return n;
+
+}
+
+
+// unpin the pages still held by scans, memory goes with the query arena
+static void closeNode(MJNode* n) {
+    if (n == NULL) return;
+    if (n->tab != -1 && n->bid != -1) releasePage(n->bid);
+    n->bid = -1;
+    closeNode(n->probe);
+    closeNode(n->build);
+}
+
+
+static INT* nextRow(MJNode* n);
+
+
+// open the tree: hash tables are built bottom-up before any probe row flows
+static void openNode(MJNode* n) {
+
+    if (n->tab != -1) return;
+
+    openNode(n->build);
+
+    // drain the build side into the hash table
+    UINT bw = n->build->width;
+    RowBuf* rb = &n->build_rows;
+    rowbufInit(rb, queryArena(), bw);
+
+    INT* r;
+    while ((r = nextRow(n->build)) != NULL) {
+        memcpy(rowbufAppend(rb), r, sizeof(INT) * bw);
+    }
+
+    // the build subtree is no longer needed
+    closeNode(n->build);
+    n->build = NULL;
+
+    UINT nbuckets = 1;
+    while (nbuckets < 2 * rb->nrows) nbuckets <<= 1;
+    n->mask = nbuckets - 1;
+    n->buckets = arenaAlloc(queryArena(), sizeof(int) * nbuckets);
+    n->next = arenaAlloc(queryArena(), sizeof(int) * (rb->nrows + 1));
+    for (UINT i = 0; i < nbuckets; i++) n->buckets[i] = -1;
+
+    // push in reverse so that each chain keeps build order
+    for (int i = (int)rb->nrows - 1; i >= 0; i--) {
+        UINT h = mjHash(rb->rows[(size_t)i * bw + n->bkeys[0]]) & n->mask;
+        n->next[i] = n->buckets[h];
+        n->buckets[h] = i;
+    }
+
+    trace("hash table built: %lu rows, %u buckets\n", (unsigned long)rb->nrows, nbuckets);
+
+    openNode(n->probe);
+    n->cur = NULL;
+    n->chain = -1;
+
+}
+
+
+// next row of a scan, read page by page through the buffer pool
+static INT* nextScan(MJNode* n) {
+
+    exTable* tmeta = n->tmeta;
+
+    while (1) {
+
+        if (n->bid == -1) {
+            if (n->ipid >= tmeta->npages) return NULL;
+            n->bid = requestPage(tmeta->name, n->ipid);
+            if (n->bid == -1) return NULL;
+            log_examine_tuples(pageBuffer[n->bid]->ntuples);
+            n->y = 0;
+        }
+
+        if (n->y < pageBuffer[n->bid]->ntuples) return pageBuffer[n->bid]->tuple[n->y++];
+
+        // finished reading page, release page
+        releasePage(n->bid);
+        n->bid = -1;
+        n->ipid++;
+
+    }
+
+}
+
+
+// pull the next output row of node n, NULL when exhausted
+// the row stays valid until the next call on the same node
+static INT* nextRow(MJNode* n) {
+
+    if (n->tab != -1) return nextScan(n);
+
+    UINT pw = n->probe->width;
+    UINT bw = n->width - pw;
+
+    while (1) {
+
+        // remaining matches of the current probe row
+        while (n->cur != NULL && n->chain != -1) {
+
+            INT* b = n->build_rows.rows + (size_t)n->chain * bw;
+            n->chain = n->next[n->chain];
+
+            int match = 1;
+            for (int k = 0; k < n->nkeys; k++) {
+                if (n->cur[n->pkeys[k]] != b[n->bkeys[k]]) {
+                    match = 0;
+                    break;
+                }
+            }
+
+            if (match) {
+                memcpy(n->row, n->cur, sizeof(INT) * pw);
+                memcpy(n->row + pw, b, sizeof(INT) * bw);
+                return n->row;
+            }
+
+        }
+
+        n->cur = nextRow(n->probe);
+        if (n->cur == NULL) return NULL;
+        n->chain = n->buckets[mjHash(n->cur[n->pkeys[0]]) & n->mask];
+
+    }
+
+}
+
+
+_Table* mjoin(const UINT nconds, const JoinCond* conds) {
+
+    trace("\nmjoin() is invoked.\n");
+
+    MJQuery q;
+    MJEntry best[1 << MJ_MAXTABLES];
+    Plan plan;
+
+    if (resolve(nconds, conds, &q) == -1) return NULL;
+
+    memOperator(MEM_MJOIN);
+    begin_phase(PH_PLAN);
+    int ok = optimize(&q, best, &plan);
+    end_phase(PH_PLAN);
+    if (ok == -1) return NULL;
+
+    trace("\nMULTI-WAY HASH JOIN\n%s\n", plan.order);
+
+    MJNode* root = makeNode(&q, best, (1u << q.ntables) - 1);
+
+    begin_phase(PH_BUILD);
+    openNode(root);
+    end_phase(PH_BUILD);
+
+    // result tuples hold the tables in order of first appearance
+    UINT nattrs = 0;
+    int perm[MJ_MAXTABLES];
+    for (int t = 0; t < q.ntables; t++) {
+        perm[t] = column(root, t, 0);
+        nattrs += q.tables[t]->nattrs;
+    }
+
+    begin_phase(PH_PROBE);
+
+    RowBuf res;
+    rowbufInit(&res, queryArena(), nattrs);
+    rowbufStream(&res, querySink());
+    rowbufSpill(&res);
+    rowbufLimit(&res, queryLimit());
+
+    // the probe pipeline stops reading pages once the rows of a limit are found
+    INT* r;
+    while (!rowbufFull(&res) && (r = nextRow(root)) != NULL) {
+        INT* out = rowbufAppend(&res);
+        for (int t = 0; t < q.ntables; t++) {
+            memcpy(out, r + perm[t], sizeof(INT) * q.tables[t]->nattrs);
+            out += q.tables[t]->nattrs;
+        }
+    }
+
+    end_phase(PH_PROBE);
+
+    closeNode(root);
+
+    trace("\nres_ntuples: %lu\n", (unsigned long)res.nrows);
+
+    begin_phase(PH_MATERIALIZE);
+
+    // compose result table
+    _Table* result = rowbufTable(&res);
+
+    log_emit_tuples(result->ntuples);
+    end_phase(PH_MATERIALIZE);
+
+    return result;
+
+}
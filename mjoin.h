@@ -0,0 +1,24 @@
+#ifndef MJOIN_H
+#define MJOIN_H
+#include "db.h"
+#include "ro.h"
+
+#define MJ_MAXTABLES 8 // tables in one multi-way join
+#define MJ_MAXCONDS 16 // join conditions in one multi-way join
+
+// one equi-join condition of a multi-way join, table1.idx1 = table2.idx2
+typedef struct JoinCond{
+    UINT idx1;
+    char table1_name[50];
+    UINT idx2;
+    char table2_name[50];
+} JoinCond;
+
+// join order optimizer, return -1 if a table does not exist or the join graph is not connected
+int planMJoin(const UINT nconds, const JoinCond* conds, Plan* plan);
+
+// multi-way equi-join over a chain of conditions
+// result tuples hold the attributes of each table in order of first appearance in the conditions
+_Table* mjoin(const UINT nconds, const JoinCond* conds);
+
+#endif
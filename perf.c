@@ -0,0 +1,113 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+
+static const UINT types[NCOUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE
+};
+static const UINT64 configs[NCOUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_SW_CONTEXT_SWITCHES
+};
+
+// counters of the query thread, the workers of the scheduler open their own
+static PerfGroup main_group = {{0}, {0}, -1, 0};
+
+
+// the kernel side of the query (page reads, context switches) is counted when the system allows it,
+// else user space only, which leaves context switches at 0
+static int openCounter(const Counter c, const int group) {
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[c];
+    attr.config = configs[c];
+    attr.disabled = group == -1; // the group starts with its leader
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+    return fd;
+
+}
+
+
+int perfGroupOpen(PerfGroup* g) {
+
+    if (g->leader >= 0) return g->nopen;
+
+    g->nopen = 0;
+    for (int c = 0; c < NCOUNTERS; c++) {
+        g->fds[c] = openCounter(c, g->leader);
+        g->pos[c] = g->fds[c] < 0 ? -1 : g->nopen++;
+        if (g->fds[c] >= 0 && g->leader == -1) g->leader = g->fds[c];
+    }
+
+    if (g->leader >= 0) {
+        ioctl(g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    return g->nopen;
+
+}
+
+
+void perfGroupClose(PerfGroup* g) {
+    if (g->leader < 0) return;
+    for (int c = 0; c < NCOUNTERS; c++) {
+        if (g->fds[c] >= 0) close(g->fds[c]);
+        g->fds[c] = -1;
+        g->pos[c] = -1;
+    }
+    g->leader = -1;
+    g->nopen = 0;
+}
+
+
+void perfGroupRead(const PerfGroup* g, UINT64* values) {
+
+    // one read returns the number of counters of the group, then their values in the order they were opened
+    UINT64 buf[NCOUNTERS + 1];
+    memset(values, 0, sizeof(UINT64) * NCOUNTERS);
+    if (g->leader < 0 || read(g->leader, buf, sizeof(buf)) < (ssize_t)sizeof(UINT64)) return;
+
+    for (int c = 0; c < NCOUNTERS; c++) {
+        if (g->pos[c] >= 0 && (UINT64)g->pos[c] < buf[0]) values[c] = buf[g->pos[c] + 1];
+    }
+
+}
+
+
+int perfOpen() {
+    int open = main_group.leader >= 0;
+    int n = perfGroupOpen(&main_group);
+    for (int c = 0; c < NCOUNTERS && !open; c++) {
+        if (main_group.pos[c] < 0) trace("Counter %s is not available.\n", counter_name(c));
+    }
+    return n;
+}
+
+
+void perfClose() {
+    perfGroupClose(&main_group);
+}
+
+
+int perfAvailable(const Counter c) {
+    return main_group.leader >= 0 && main_group.pos[c] >= 0;
+}
+
+
+void perfRead(UINT64* values) {
+    perfGroupRead(&main_group, values);
+}
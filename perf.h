@@ -0,0 +1,36 @@
+#ifndef PERF_H
+#define PERF_H
+#include "db.h"
+
+// hardware and software counters of the query thread, read around every execution phase
+// counters the kernel or the machine does not provide are not available, and read as 0
+// the events of the calling thread are counted; the workers of the scheduler count theirs in groups of
+// their own, added to the phase running the parallel operator
+
+// counters of one thread, opened as one group
+typedef struct PerfGroup{
+    int fds[NCOUNTERS];
+    int pos[NCOUNTERS]; // position of a counter in a read of the group, -1 if it is not available
+    int leader; // -1 while closed
+    int nopen;
+} PerfGroup;
+
+// open the counters of the calling thread in g and start them, return the number available
+int perfGroupOpen(PerfGroup* g);
+void perfGroupClose(PerfGroup* g);
+
+// current value of every counter of g, NCOUNTERS values
+void perfGroupRead(const PerfGroup* g, UINT64* values);
+
+// the group of the query thread
+// open the counters as one group and start them, return the number available
+int perfOpen();
+void perfClose();
+
+// whether counter c could be opened
+int perfAvailable(const Counter c);
+
+// current value of every counter, NCOUNTERS values
+void perfRead(UINT64* values);
+
+#endif
@@ -1,47 +1,26 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include "ro.h"
 #include "db.h"
+#include "index.h"
+#include "arena.h"
+#include "compress.h"
+#include "vec.h"
+#include "sched.h"
 
 #define min(x,y) (((x)<(y))?(x):(y))
 #define max(x,y) (((x)>(y))?(x):(y))
 
-typedef struct FileDesc { // file = table
-    // maintain meta info of table
-    UINT isempty;
-    UINT oid;
-    UINT nattrs;
-    UINT ntuples;
-    UINT npages;
-    char name[10];
-    char path[120];
-    FILE* file; // file pointer
-} FileDesc;
-
-typedef struct PageDesc { // page = collection of tuples
-    // maintain meta info of page
-    UINT isempty;
-    UINT pageid;
-    UINT ipid; // internal page id, count from 0, increment 1 (ie nth page)
-    UINT oid; // table oid
-    char name[10];
-    UINT nattrs; 
-    UINT ntuples; // number of tuples in page (different from file's ntuples)
-    UINT pin;
-    UINT use;
-    INT** tuple; // array of int32 data
-} PageDesc;
-
-// extended table meta
-typedef struct exTable{
-    UINT oid;
-    char name[10];
-    UINT nattrs;
-    UINT ntuples;
-    UINT npages;
-    UINT ntpp;
-} exTable;
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define JOIN_MAXPARTS 64 // partitions of a hash join spilling to disk
+#define HEAVY_SAMPLE 8 // one build row in HEAVY_SAMPLE is counted to find the heavy hitters of a hash join
+#define EXTENT_MINPAGES 8 // pages of the smallest extent added to the tablespace for pages appended to an object
 
 FileDesc** fileBuffer; // array of file descriptors, size depends on conf value
 PageDesc** pageBuffer; // array of pages, size depends on conf value
@@ -53,6 +32,155 @@ int NVP = 0; // next victim page to evict in pbuffer
 Conf* conf;
 Database* dbase;
 
+// descriptor of the tablespace, -1 if every table has a file of its own
+int tsfd = -1;
+
+// I/O frame every page is read into, aligned for direct I/O
+char* frame = NULL;
+
+// I/O frame dirty pages are written back from, apart from frame as a page is written back
+// while the one that takes its slot is in frame
+char* wframe = NULL;
+
+// page buffer arena: the page descriptors and the tuple storage of every slot in one mapping
+char* buf_arena = NULL;
+size_t buf_arena_bytes = 0;
+size_t slot_bytes = 0;
+
+
+static size_t roundUp(const size_t n, const size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+
+// map the page buffer arena, backed by huge pages if conf->hugepages asks for them
+static void initBufferArena() {
+
+    // an uncompressed page needs ntip * (sizeof(INT*) + 4 * nattrs) bytes with ntip <= (page_size - 8) / (4 * nattrs),
+    // at most 3 * page_size; decoded compressed pages may need more and fall back to the heap
+    slot_bytes = roundUp(3 * (size_t)conf->page_size, 64);
+    size_t desc_bytes = roundUp(sizeof(PageDesc) * conf->buf_slots, 64);
+    buf_arena_bytes = desc_bytes + slot_bytes * conf->buf_slots;
+    if (conf->hugepages != HP_OFF) buf_arena_bytes = roundUp(buf_arena_bytes, HUGE_PAGE_SIZE);
+
+    buf_arena = MAP_FAILED;
+    if (conf->hugepages == HP_EXPLICIT) {
+        buf_arena = mmap(NULL, buf_arena_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buf_arena == MAP_FAILED) trace("No explicit huge pages available, transparent huge pages are used.\n");
+    }
+    if (buf_arena == MAP_FAILED) {
+        buf_arena = mmap(NULL, buf_arena_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_arena == MAP_FAILED) {
+            perror("Fail to allocate the page buffer.\n");
+            exit(-1);
+        }
+        if (conf->hugepages != HP_OFF) madvise(buf_arena, buf_arena_bytes, MADV_HUGEPAGE);
+    }
+
+    PageDesc* descs = (PageDesc*)buf_arena;
+    for (int i = 0; i < conf->buf_slots; i++) {
+        pageBuffer[i] = &descs[i];
+        pageBuffer[i]->isempty = 1;
+        pageBuffer[i]->heap = 0;
+        pageBuffer[i]->dirty = 0;
+        pageBuffer[i]->slot = buf_arena + desc_bytes + slot_bytes * i;
+    }
+
+}
+
+// byte offset of page ipid of object oid in its file, or in the tablespace, -1 if no extent holds it
+static off_t pageOffset(const UINT oid, const UINT64 ipid) {
+    if (!conf->tablespace) return (off_t)ipid * conf->disk_page;
+    const Extent* e = find_extent(oid, ipid);
+    return e == NULL ? -1 : (off_t)(e->page + ipid - e->ipid) * conf->disk_page;
+}
+
+
+// file buffer slot of a table file, -1 if it is not open
+static int findFile(const char* table_name) {
+    for (int fid = 0; fid < conf->file_limit; fid++) {
+        if (!fileBuffer[fid]->isempty && strcmp(fileBuffer[fid]->name, table_name) == 0) return fid;
+    }
+    return -1;
+}
+
+
+// write the dirty page of slot bid back to its table file, encoded as the loader writes it
+// through the file desc if the file is open, else through a descriptor opened for the write,
+// so the file buffer is left as it is while a read is taking a slot
+// return -1 if the page could not be written, it stays dirty and is not counted
+static int writePage(const int bid) {
+
+    PageDesc* pg = pageBuffer[bid];
+    exTable* tmeta = getTableMeta(pg->name);
+
+    memset(wframe, 0, conf->disk_page);
+    if (tmeta->compressed) {
+        PageBuilder* pb = newPageBuilder(pg->nattrs, conf->page_size);
+        for (int y = 0; y < pg->ntuples; y++) pbAdd(pb, pg->tuple[y]);
+        pbEncode(pb, pg->pageid, wframe);
+        freePageBuilder(pb);
+    } else {
+        memcpy(wframe, &pg->pageid, sizeof(UINT64));
+        if (pg->ntuples > 0) memcpy(wframe + sizeof(UINT64), pg->tuple[0], sizeof(INT) * pg->nattrs * pg->ntuples);
+    }
+
+    off_t offset = pageOffset(pg->oid, pg->ipid);
+    int fid = findFile(pg->name);
+    ssize_t written;
+
+    if (conf->tablespace) {
+        // a page appended to the object takes a new extent at the end of the tablespace,
+        // as large as the object so that a growing table needs few of them
+        if (offset < 0) {
+            UINT64 npages = max(EXTENT_MINPAGES, tmeta->npages);
+            offset = (off_t)add_extent(pg->oid, pg->ipid, npages);
+        }
+        written = pwrite(tsfd, wframe, conf->disk_page, offset);
+    } else if (fid >= 0 && fileBuffer[fid]->fd < 0) {
+        FILE* file = fileBuffer[fid]->file;
+        fseeko(file, offset, SEEK_SET);
+        written = fwrite(wframe, conf->disk_page, 1, file) == 1 ? (ssize_t)conf->disk_page : -1;
+        fflush(file); // later reads may come through another descriptor
+    } else {
+        int fd = fid >= 0 ? fileBuffer[fid]->fd : -1;
+        if (fid < 0) {
+            char t_path[120];
+            sprintf(t_path, "%s/%u", dbase->path, pg->oid);
+            if (conf->direct_io) fd = open(t_path, O_WRONLY | O_DIRECT);
+            if (fd < 0) fd = open(t_path, O_WRONLY);
+        }
+        written = fd < 0 ? -1 : pwrite(fd, wframe, conf->disk_page, offset);
+        if (fid < 0 && fd >= 0) close(fd);
+    }
+
+    if (written != (ssize_t)conf->disk_page) {
+        trace("Fail to write page %lu of %s.\n", (unsigned long)pg->ipid, pg->name);
+        return -1;
+    }
+
+    log_write_page(pg->pageid);
+    pg->dirty = 0;
+    return 0;
+
+}
+
+
+// write back every dirty page
+// return the number of pages that could not be written
+static int flushPages() {
+    int n = 0;
+    int failed = 0;
+    for (int i = 0; i < conf->buf_slots; i++) {
+        if (pageBuffer[i]->isempty || !pageBuffer[i]->dirty) continue;
+        if (writePage(i) == -1) failed++;
+        else n++;
+    }
+    if (n > 0) trace("\n%i dirty pages written back.\n", n);
+    return failed;
+}
+
+
 // initialisation
 void init() {
 
@@ -70,18 +198,33 @@ void init() {
         fileBuffer[i]->isempty = 1;
     }
 
-    for (int i = 0; i < conf->buf_slots; i++) {
-        pageBuffer[i] = malloc(sizeof(PageDesc));
-        pageBuffer[i]->isempty = 1;
+    initBufferArena();
+
+    if (posix_memalign((void**)&frame, conf->io_align, conf->disk_page) != 0) frame = NULL;
+    if (posix_memalign((void**)&wframe, conf->io_align, conf->disk_page) != 0) wframe = NULL;
+
+    // every table is read and written through one descriptor, the file buffer is not used
+    if (conf->tablespace) {
+        char ts_path[200];
+        tablespace_path(ts_path);
+        if (conf->direct_io) {
+            tsfd = open(ts_path, O_RDWR | O_DIRECT);
+            if (tsfd < 0) trace("O_DIRECT not supported for %s, buffered I/O is used.\n", ts_path);
+        }
+        if (tsfd < 0) tsfd = open(ts_path, O_RDWR);
+        if (tsfd < 0) {
+            perror("Fail to open the tablespace.\n");
+            exit(-1);
+        }
     }
     
-    printf("\ninit() is invoked.\n");
+    trace("\ninit() is invoked.\n");
 
-    printf("\n====================\n");
+    trace("\n====================\n");
     printPageBuffer();
-    printf("====================\n");
+    trace("====================\n");
     printFileBuffer();
-    printf("====================\n");
+    trace("====================\n");
 
 }
 
@@ -89,6 +232,12 @@ void init() {
 // end tasks
 void release() {
 
+    // the table files get the rows appended since their pages were read
+    int failed = flushPages();
+    if (failed > 0) fprintf(stderr, "Fail to write back %i dirty pages, their rows are lost.\n", failed);
+    if (tsfd >= 0) close(tsfd);
+    tsfd = -1;
+
     // free space to avoid memory leak
 
     for (int i = 0; i < conf->file_limit; i++) {
@@ -96,31 +245,72 @@ void release() {
     }
 
     for (int i = 0; i < conf->buf_slots; i++) {
-        freePageTuple(i); // if empty then will have segmentation fault
-        free(pageBuffer[i]);
+        freePageTuple(i);
     }
 
+    munmap(buf_arena, buf_arena_bytes);
     free(fileBuffer);
     free(pageBuffer);
+    free(frame);
+    free(wframe);
+
+    for (int i = 0; i < dbase->ntables; i++) {
+        freeTableStats(extmeta[i].stats);
+    }
     free(extmeta);
+    freeIndexes();
+
+    trace("\nrelease() is invoked.\n");
+
+}
+
+
+const char* methodName(const Method m) {
+    static const char* methods[] = {"SCAN", "BNL", "HASH", "MJOIN", "INL", "CLUSTER", "RADIX"};
+    return methods[m];
+}
+
+
+int parseCmpOp(const char* s) {
+    static const char* ops[] = {"=", "<", "<=", ">", ">=", "between"};
+    if (strcmp(s, "==") == 0) return OP_EQ;
+    for (int i = 0; i <= OP_BETWEEN; i++) {
+        if (strcmp(s, ops[i]) == 0) return i;
+    }
+    return -1;
+}
 
-    printf("\nrelease() is invoked.\n");
 
+void cmpRange(const CmpOp op, const INT val, const INT val2, int64_t* lo, int64_t* hi) {
+    *lo = INT32_MIN;
+    *hi = INT32_MAX;
+    switch (op) {
+        case OP_EQ: *lo = val; *hi = val; break;
+        case OP_LT: *hi = (int64_t)val - 1; break;
+        case OP_LE: *hi = val; break;
+        case OP_GT: *lo = (int64_t)val + 1; break;
+        case OP_GE: *lo = val; break;
+        case OP_BETWEEN: *lo = val; *hi = val2; break;
+    }
 }
 
 
-int hash(const int input) {
-    return input % 2;
+// tuples of a page: the pointer array followed by the rows, in the storage of slot bid
+// pages that do not fit the slot are allocated on the heap
+static INT** allocPageTuples(const int bid, const int ntip, const int nattrs) {
+    size_t bytes = sizeof(INT*) * ntip + sizeof(INT) * ntip * nattrs;
+    pageBuffer[bid]->heap = bytes > slot_bytes;
+    INT** tuple = pageBuffer[bid]->heap ? malloc(bytes) : (INT**)pageBuffer[bid]->slot;
+    vecKernels(nattrs)->pointers((INT*)(tuple + ntip), nattrs, ntip, tuple);
+    return tuple;
 }
 
 
 // clean tuples in page buffer
 void freePageTuple(const int bid) {
-    if (pageBuffer[bid]->isempty) return;
-    for (int y = 0; y < pageBuffer[bid]->ntuples; y++) { // for each tuple
-        free(pageBuffer[bid]->tuple[y]);
-    }
+    if (pageBuffer[bid]->isempty || !pageBuffer[bid]->heap) return;
     free(pageBuffer[bid]->tuple);
+    pageBuffer[bid]->heap = 0;
 }
 
 
@@ -131,14 +321,14 @@ exTable* getTableMeta(const char* table_name) {
             return &extmeta[i];
         }
     }
-    return NULL;
+    return getIndexMeta(table_name);
 }
 
 
 // compute extended table meta, global action
 void computeTableMeta() {
 
-    printf("\nTABLE META\n");
+    trace("\nTABLE META\n");
 
     for (int i = 0; i < dbase->ntables; i++) {
         extmeta[i].oid = dbase->tables[i].oid;
@@ -148,18 +338,69 @@ void computeTableMeta() {
 
         // compute the number of pages involved in the selection
         int ntpp = (conf->page_size - 8) / (dbase->tables[i].nattrs * 4); // number of tuples per page
-        int npages = dbase->tables[i].ntuples / ntpp;
+        UINT64 npages = dbase->tables[i].ntuples / ntpp;
         if (dbase->tables[i].ntuples % ntpp != 0) {
             npages++;
         }
 
+        // compressed pages hold a varying number of tuples, the loader counted the pages
+        if (dbase->tables[i].compressed) {
+            npages = dbase->tables[i].npages;
+            ntpp = npages == 0 ? 1 : (dbase->tables[i].ntuples + npages - 1) / npages;
+        }
+
         extmeta[i].ntpp = ntpp;
         extmeta[i].npages = npages;
+        extmeta[i].compressed = dbase->tables[i].compressed;
+        extmeta[i].cluster_key = dbase->tables[i].cluster_key;
+        extmeta[i].fences = dbase->tables[i].fences;
+        extmeta[i].stats = NULL;
+        extmeta[i].kern = vecKernels(extmeta[i].nattrs);
+
+        trace("name: %s | oid: %u | nattrs: %u | ntuples: %lu | ntpp: %i | npages: %lu%s\n", extmeta[i].name, extmeta[i].oid, extmeta[i].nattrs, (unsigned long)extmeta[i].ntuples, extmeta[i].ntpp, (unsigned long)extmeta[i].npages, extmeta[i].compressed ? " | compressed" : "");
+        if (extmeta[i].cluster_key >= 0) trace("clustered on %i\n", extmeta[i].cluster_key);
+
+    }
+
+}
+
 
-        printf("name: %s | oid: %u | nattrs: %u | ntuples: %u | ntpp: %i | npages: %i\n", extmeta[i].name, extmeta[i].oid, extmeta[i].nattrs, extmeta[i].ntuples, extmeta[i].ntpp, extmeta[i].npages);
+// gather column statistics of a table, scanning it through the buffer pool
+int analyze(const char* table_name) {
+
+    exTable* tmeta = getTableMeta(table_name);
+    if (tmeta == NULL) return -1;
+
+    trace("\nanalyze() is invoked.\n");
+
+    TableStats* ts = newTableStats(tmeta->nattrs);
+
+    // for each page in table
+    for (UINT64 ipid = 0; ipid < tmeta->npages; ipid++) {
+
+        int bid = requestPage(table_name, ipid);
+        if (bid == -1) {
+            freeTableStats(ts);
+            return -1;
+        }
+
+        for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
+            statsAddTuple(ts, pageBuffer[bid]->tuple[y]);
+        }
+
+        releasePage(bid);
 
     }
 
+    statsFinish(ts);
+    printTableStats(tmeta->name, ts);
+
+    // replace statistics of an earlier analyze
+    freeTableStats(tmeta->stats);
+    tmeta->stats = ts;
+
+    return 0;
+
 }
 
 
@@ -173,22 +414,30 @@ int availPageBufferSlot() {
 
     // second-traversal: find page to evict if full
     // clock-sweep replacement policy
+    // a dirty page that cannot be written back keeps its slot,
+    // no slot is given if a whole sweep finds only such pages and pinned ones
     int evict = 0;
     int pNVP;
 
     while (!evict) {
 
+        int from = NVP;
+        int aged = 0;
+        int failed = 0;
+
         for (int i = NVP; i < conf->buf_slots; i++) {
             
             // if both pin_count and usage_count are 0, execute eviction
             if (pageBuffer[i]->pin == 0 && pageBuffer[i]->use == 0) {
                 
+                if (pageBuffer[i]->dirty && writePage(i) == -1) {
+                    failed = 1;
+                    continue;
+                }
+
                 log_release_page(pageBuffer[i]->pageid);
                 
                 freePageTuple(i);
-                free(pageBuffer[i]);
-                pageBuffer[i] = malloc(sizeof(PageDesc));
-                //pageBuffer[i]->isempty = 1;
 
                 NVP = i;
                 pNVP = NVP;
@@ -199,15 +448,23 @@ int availPageBufferSlot() {
 
             }
             
-            if (pageBuffer[i]->use > 0) pageBuffer[i]->use--;
+            if (pageBuffer[i]->use > 0) {
+                pageBuffer[i]->use--;
+                aged = 1;
+            }
         
         }
 
+        if (!evict && from == 0 && failed && !aged) {
+            trace("No page buffer slot can be freed.\n");
+            return -1;
+        }
+
         if (!evict) NVP = 0;
 
     } 
 
-    printf("CLOCK SWEEP [NVP: %i | Next NVP: %i]\n", pNVP, NVP);
+    trace("CLOCK SWEEP [NVP: %i | Next NVP: %i]\n", pNVP, NVP);
     return pNVP;
 
 }
@@ -222,7 +479,8 @@ int availFileBufferSlot() {
     }
 
     // if no empty slot, replacement policy takes place
-    fclose(fileBuffer[NVF]->file);
+    if (fileBuffer[NVF]->fd >= 0) close(fileBuffer[NVF]->fd);
+    else fclose(fileBuffer[NVF]->file);
     log_close_file(fileBuffer[NVF]->oid);
 
     free(fileBuffer[NVF]);
@@ -237,14 +495,54 @@ int availFileBufferSlot() {
 }
 
 
+// read the page at offset of a table file or the tablespace into the I/O frame, return its pageid
+// pages are disk_page bytes apart, direct I/O reads whole aligned blocks
+static UINT64 readFrame(FILE* file, const int fd, const off_t offset) {
+
+    if (offset < 0) {
+        memset(frame, 0, conf->page_size);
+    } else if (fd >= 0) {
+        if (pread(fd, frame, conf->disk_page, offset) < (ssize_t)conf->page_size) memset(frame, 0, conf->page_size);
+    } else {
+        fseeko(file, offset, SEEK_SET);
+        if (fread(frame, conf->page_size, 1, file) != 1) memset(frame, 0, conf->page_size);
+    }
+
+    UINT64 pageid;
+    memcpy(&pageid, frame, sizeof(UINT64));
+    return pageid;
+
+}
+
+
+// decode the tuples of the page in the I/O frame into slot bid
+// a compressed page knows its number of tuples, *ntip receives it
+static INT** readTuples(const int bid, const UINT nattrs, int* ntip, const UINT compressed) {
+
+    if (!compressed) {
+        INT** tuple = allocPageTuples(bid, *ntip, nattrs);
+        if (*ntip > 0) memcpy(tuple[0], frame + sizeof(UINT64), sizeof(INT) * nattrs * *ntip);
+        return tuple;
+    }
+
+    *ntip = pageTuples(frame);
+    INT** tuple = allocPageTuples(bid, *ntip, nattrs);
+    decodePage(frame, nattrs, tuple);
+
+    return tuple;
+
+}
+
+
 // read page to page buffer from file buffer
 // return page buffer id (ie buffer tag) of the nth page of target table
-int readPageFromFileBuffer(const int fid, const int ipid) {
+int readPageFromFileBuffer(const int fid, const UINT64 ipid) {
 
-    printf("\nREAD FROM FBUFFER\n");
+    trace("\nREAD FROM FBUFFER\n");
 
     // open file from existing pointer in file desc
     FILE* file = fileBuffer[fid]->file;
+    int fd = fileBuffer[fid]->fd;
 
     // compute the number of tuples in page
     int ntip = (conf->page_size - 8) / (fileBuffer[fid]->nattrs * 4);
@@ -254,19 +552,12 @@ int readPageFromFileBuffer(const int fid, const int ipid) {
         ntip = fileBuffer[fid]->ntuples - ntip * (fileBuffer[fid]->npages - 1);
     }
 
-    // compute page offset in file
-    int offset = ipid * conf->page_size;
-    //printf("ntip: %i | offset: %i\n", ntip, offset);
-
-    // move file seeker
-    fseek(file, offset, SEEK_SET);
-
-    // read pageid
-    long pageid; // 64 bits or 8 bytes
-    fread(&pageid, sizeof pageid, 1, file);
+    // read the page, its pageid comes first
+    UINT64 pageid = readFrame(file, fd, pageOffset(fileBuffer[fid]->oid, ipid));
 
     // get free page buffer slot from page buffer slot manager
     int bid = availPageBufferSlot();
+    if (bid == -1) return -1;
 
     // complete page desc info
     pageBuffer[bid]->isempty = 0;
@@ -275,28 +566,21 @@ int readPageFromFileBuffer(const int fid, const int ipid) {
     pageBuffer[bid]->oid = fileBuffer[fid]->oid;
     strcpy(pageBuffer[bid]->name, fileBuffer[fid]->name);
     pageBuffer[bid]->nattrs = fileBuffer[fid]->nattrs;
-    pageBuffer[bid]->ntuples = ntip;
     pageBuffer[bid]->pin = 1;
     pageBuffer[bid]->use = 1;
+    pageBuffer[bid]->dirty = 0;
 
     // convert binary data into integers and store in array
-    pageBuffer[bid]->tuple = malloc(sizeof(INT*) * ntip);
+    pageBuffer[bid]->tuple = readTuples(bid, fileBuffer[fid]->nattrs, &ntip, fileBuffer[fid]->compressed);
+    pageBuffer[bid]->ntuples = ntip;
 
     for (int y = 0; y < ntip; y++) { // for each tuple
 
-        pageBuffer[bid]->tuple[y] = malloc(sizeof(INT) * fileBuffer[fid]->nattrs);
-        
         for (int x = 0; x < fileBuffer[fid]->nattrs; x++) { // for each attr
-
-            int data; // 32 bits or 4 bytes
-            fread(&data, sizeof data, 1, file);
-            
-            pageBuffer[bid]->tuple[y][x] = data;
-            printf("%i ", data);
-
+            trace("%i ", pageBuffer[bid]->tuple[y][x]);
         }
 
-        printf("\n");
+        trace("\n");
 
     }
 
@@ -310,21 +594,40 @@ int readPageFromFileBuffer(const int fid, const int ipid) {
 
 // read page to page buffer from disk, costruct file desc to file buffer
 // return page buffer id (ie buffer tag) of the nth page of target table
-int readPageFromDisk(const char* table_name, const int ipid) {
+int readPageFromDisk(const char* table_name, const UINT64 ipid) {
 
     exTable* tmeta = getTableMeta(table_name);
     if (tmeta == NULL) return -1;
 
-    printf("\nREAD FROM DISK\n");
+    trace("\nREAD FROM DISK\n");
 
     // compose file path
     // path is 100 bytes, / is 1 byte, 10 bytes for 32 bit oid, 9 byte for buffer
     char t_path[120];
     sprintf(t_path, "%s/%u", dbase->path, tmeta->oid);
 
-    // open file from disk
-    FILE* file = fopen(t_path, "rb"); // read bytes
-    log_open_file(tmeta->oid); // read from disk
+    FILE* file = NULL;
+    int fd = -1;
+    off_t offset = pageOffset(tmeta->oid, ipid);
+
+    if (conf->tablespace) {
+        // nothing to open, the first page read of an extent asks the OS to read all of it ahead,
+        // so a scan reads the extent in large sequential requests
+        fd = tsfd;
+        const Extent* e = find_extent(tmeta->oid, ipid);
+        if (e != NULL && e->ipid == ipid && !conf->direct_io) {
+            posix_fadvise(fd, offset, (off_t)e->npages * conf->disk_page, POSIX_FADV_WILLNEED);
+        }
+    } else {
+        // open file from disk
+        // direct I/O bypasses the OS page cache, buffered I/O is the fallback if the file system refuses it
+        if (conf->direct_io) {
+            fd = open(t_path, O_RDWR | O_DIRECT);
+            if (fd < 0) trace("O_DIRECT not supported for %s, buffered I/O is used.\n", t_path);
+        }
+        if (fd < 0) file = fopen(t_path, "r+b"); // read and write back bytes
+        log_open_file(tmeta->oid); // read from disk
+    }
 
     // compute the number of tuples in page
     int ntip = tmeta->ntpp;
@@ -334,19 +637,17 @@ int readPageFromDisk(const char* table_name, const int ipid) {
         ntip = tmeta->ntuples - ntip * (tmeta->npages - 1);
     }
 
-    // compute page offset in file
-    int offset = ipid * conf->page_size;
-    //printf("ntip: %i | offset: %i\n", ntip, offset);
-
-    // move file seeker
-    fseek(file, offset, SEEK_SET);
-
-    // read pageid
-    long pageid; // 64 bits or 8 bytes
-    fread(&pageid, sizeof pageid, 1, file);
+    // read the page, its pageid comes first
+    UINT64 pageid = readFrame(file, fd, offset);
 
     // get free page buffer slot from page buffer slot manager
     int bid = availPageBufferSlot();
+    if (bid == -1) {
+        if (conf->tablespace) return -1;
+        if (file != NULL) fclose(file);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
 
     // complete page desc info
     pageBuffer[bid]->isempty = 0;
@@ -355,34 +656,30 @@ int readPageFromDisk(const char* table_name, const int ipid) {
     pageBuffer[bid]->oid = tmeta->oid;
     strcpy(pageBuffer[bid]->name, tmeta->name);
     pageBuffer[bid]->nattrs = tmeta->nattrs;
-    pageBuffer[bid]->ntuples = ntip;
     pageBuffer[bid]->pin = 1;
     pageBuffer[bid]->use = 1;
+    pageBuffer[bid]->dirty = 0;
 
     // convert binary data into integers and store in array
-    pageBuffer[bid]->tuple = malloc(sizeof(INT*) * ntip);
+    pageBuffer[bid]->tuple = readTuples(bid, tmeta->nattrs, &ntip, tmeta->compressed);
+    pageBuffer[bid]->ntuples = ntip;
 
     for (int y = 0; y < ntip; y++) { // for each tuple
 
-        pageBuffer[bid]->tuple[y] = malloc(sizeof(INT) * tmeta->nattrs);
-        
         for (int x = 0; x < tmeta->nattrs; x++) { // for each attr
-
-            int data; // 32 bits or 4 bytes
-            fread(&data, sizeof data, 1, file);
-
-            pageBuffer[bid]->tuple[y][x] = data;
-            printf("%i ", data);
-
+            trace("%i ", pageBuffer[bid]->tuple[y][x]);
         }
 
-        printf("\n");
+        trace("\n");
 
     }
 
     // read page from disk
     log_read_page(pageid);
 
+    // the tablespace stays open, there is no file desc to keep
+    if (conf->tablespace) return bid;
+
     // get free file buffer slot from file buffer slot manager
     int fid = availFileBufferSlot();
 
@@ -392,9 +689,11 @@ int readPageFromDisk(const char* table_name, const int ipid) {
     fileBuffer[fid]->nattrs = tmeta->nattrs;
     fileBuffer[fid]->ntuples = tmeta->ntuples;
     fileBuffer[fid]->npages = tmeta->npages;
+    fileBuffer[fid]->compressed = tmeta->compressed;
     strcpy(fileBuffer[fid]->name, tmeta->name);
     strcpy(fileBuffer[fid]->path, t_path);
     fileBuffer[fid]->file = file; // keep file pointer
+    fileBuffer[fid]->fd = fd;
 
     return bid;
 
@@ -404,24 +703,33 @@ int readPageFromDisk(const char* table_name, const int ipid) {
 // entrance of file buffer manager
 // traverse through the file buffer pool to look for target file
 // return page buffer id (ie buffer tag) of the nth page of target table
-int requestFile(const char* table_name, const int ipid) {
+int requestFile(const char* table_name, const UINT64 ipid) {
+
+    begin_phase(PH_LOAD);
+
+    int bid = -1;
+    int found = 0;
 
     // for each file desc in file buffer pool
-    for (int fid = 0; fid < conf->file_limit; fid++) {
+    for (int fid = 0; fid < conf->file_limit && !found; fid++) {
         
         if (fileBuffer[fid]->isempty) continue;
         
         // if found
         if (strcmp(fileBuffer[fid]->name, table_name) == 0) {
             // read file from buffer
-            return readPageFromFileBuffer(fid, ipid);
+            bid = readPageFromFileBuffer(fid, ipid);
+            found = 1;
         }
 
     }
 
     // if not found
     // read file from disk 
-    return readPageFromDisk(table_name, ipid);
+    if (!found) bid = readPageFromDisk(table_name, ipid);
+
+    end_phase(PH_LOAD);
+    return bid;
 
 }
 
@@ -429,7 +737,7 @@ int requestFile(const char* table_name, const int ipid) {
 // entrance of page buffer manager
 // traverse through the page buffer pool to look for target page
 // return page buffer id (ie buffer tag) of the nth page of target table
-int requestPage(const char* table_name, const int ipid) {
+int requestPage(const char* table_name, const UINT64 ipid) {
 
     // for each page desc in page buffer pool
     for (int i = 0; i < conf->buf_slots; i++) {
@@ -439,7 +747,8 @@ int requestPage(const char* table_name, const int ipid) {
         // if found
         if (strcmp(pageBuffer[i]->name, table_name) == 0 && pageBuffer[i]->ipid == ipid) {
             
-            printf("\nREAD FROM PBUFFER\n");
+            trace("\nREAD FROM PBUFFER\n");
+            log_buffer_hit(pageBuffer[i]->pageid);
             
             pageBuffer[i]->pin = 1;
             pageBuffer[i]->use++;
@@ -447,9 +756,9 @@ int requestPage(const char* table_name, const int ipid) {
             // print tuple values
             for (int y = 0; y < pageBuffer[i]->ntuples; y++) {
                 for (int x = 0; x < pageBuffer[i]->nattrs; x++) {
-                    printf("%i ", pageBuffer[i]->tuple[y][x]);
+                    trace("%i ", pageBuffer[i]->tuple[y][x]);
                 }
-                printf("\n");
+                trace("\n");
             }
 
             return i;
@@ -460,6 +769,7 @@ int requestPage(const char* table_name, const int ipid) {
 
     // if no match found, get page from file buffer manager
     // by default set pin = 1 and use = 1;
+    log_buffer_miss(ipid);
     return requestFile(table_name, ipid);
 
 }
@@ -470,366 +780,2027 @@ void releasePage(const int bid) {
 }
 
 
-_Table* sel(const UINT idx, const INT cond_val, const char* table_name) {
+void dropFile(const char* table_name) {
 
-    // invoke log_read_page() every time a page is read from the hard drive.
-    // invoke log_release_page() every time a page is released from the memory.
+    for (int i = 0; i < conf->buf_slots; i++) {
+        if (pageBuffer[i]->isempty || pageBuffer[i]->pin || strcmp(pageBuffer[i]->name, table_name) != 0) continue;
+        freePageTuple(i);
+        pageBuffer[i]->isempty = 1;
+        pageBuffer[i]->dirty = 0;
+    }
 
-    // invoke log_open_file() every time a page is read from the hard drive.
-    // invoke log_close_file() every time a page is released from the memory.
-    
-    printf("\nsel() is invoked.\n");
-    printf("\nSEL\nidx: %u | cond_val: %i | table_name: %s\n", idx, cond_val, table_name); 
+    int fid = findFile(table_name);
+    if (fid == -1) return;
+    if (fileBuffer[fid]->fd >= 0) close(fileBuffer[fid]->fd);
+    else fclose(fileBuffer[fid]->file);
+    log_close_file(fileBuffer[fid]->oid);
+    fileBuffer[fid]->isempty = 1;
 
-    exTable* tmeta = getTableMeta(table_name);
-    if (tmeta == NULL) return NULL;
-    
-    int res_ntuples = 0;
-    INT temp[tmeta->ntuples][tmeta->nattrs]; // temp array holding results
-    // results will not be more than ntuples
-    
-    // for each page in table
-    for (int ipid = 0; ipid < tmeta->npages; ipid++) {
-        
-        // get buffer id
-        int bid = requestPage(table_name, ipid);
-        if (bid == -1) return NULL;
+}
 
-        // do equality comparison
-        printf("results:\n");
 
-        for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
-            // equality search on single attr
-            if (cond_val == pageBuffer[bid]->tuple[y][idx]) { 
-                for (int x = 0; x < pageBuffer[bid]->nattrs; x++) {
-                    printf("%i ", pageBuffer[bid]->tuple[y][x]);
-                    temp[res_ntuples][x] = pageBuffer[bid]->tuple[y][x];
-                }
-                printf("\n");
-                res_ntuples++;
-            }
-        }
+// empty page ipid of a table in a free slot, pinned and dirty, nothing is read for it
+// -1 if no slot can be freed
+static int newPage(const exTable* tmeta, const UINT64 ipid) {
 
-        // finished reading page, release page
-        releasePage(bid);
+    int bid = availPageBufferSlot();
+    if (bid == -1) return -1;
 
-    }
+    pageBuffer[bid]->isempty = 0;
+    pageBuffer[bid]->pageid = ipid; // the loader numbers the pages of a table from 0
+    pageBuffer[bid]->ipid = ipid;
+    pageBuffer[bid]->oid = tmeta->oid;
+    strcpy(pageBuffer[bid]->name, tmeta->name);
+    pageBuffer[bid]->nattrs = tmeta->nattrs;
+    pageBuffer[bid]->ntuples = 0;
+    pageBuffer[bid]->pin = 1;
+    pageBuffer[bid]->use = 1;
+    pageBuffer[bid]->dirty = 1;
+    pageBuffer[bid]->heap = 0;
+    pageBuffer[bid]->tuple = NULL;
 
-    printf("\nres_ntuples: %i\n", res_ntuples);
+    return bid;
 
-    // compose result table
-    _Table* result = malloc(sizeof(_Table) + res_ntuples * sizeof(Tuple));
-    result->nattrs = tmeta->nattrs;
-    result->ntuples = res_ntuples;
+}
 
-    for (int i = 0; i < result->ntuples; i++) {
-        Tuple t = malloc(sizeof(INT) * result->nattrs);
-        result->tuples[i] = t;
-        for (int j = 0; j < result->nattrs; j++) {
-            t[j] = temp[i][j];
-        }
+
+// move the rows of the page in slot bid to storage for cap tuples, in the same slot
+static void growPage(const int bid, const UINT cap) {
+
+    PageDesc* pg = pageBuffer[bid];
+    size_t bytes = sizeof(INT) * pg->nattrs * pg->ntuples;
+    INT* rows = NULL;
+    if (pg->ntuples > 0) {
+        rows = arenaAlloc(queryArena(), bytes);
+        memcpy(rows, pg->tuple[0], bytes);
     }
 
-    printf("\n====================\n");
-    printPageBuffer();
-    printf("====================\n");
-    printFileBuffer();
-    printf("====================\n");
-    
-    return result;
+    freePageTuple(bid);
+    pg->tuple = allocPageTuples(bid, cap, pg->nattrs);
+    if (rows != NULL) memcpy(pg->tuple[0], rows, bytes);
 
 }
 
 
-_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name) {
+// how many of the n rows fit the compressed page of slot bid after its own rows
+static UINT compressedRoom(const PageDesc* pg, const INT* rows, const UINT n) {
 
-    // invoke log_read_page() every time a page is read from the hard drive.
-    // invoke log_release_page() every time a page is released from the memory.
+    PageBuilder* pb = newPageBuilder(pg->nattrs, conf->page_size);
+    for (int y = 0; y < pg->ntuples; y++) pbAdd(pb, pg->tuple[y]);
 
-    // invoke log_open_file() every time a page is read from the hard drive.
-    // invoke log_close_file() every time a page is released from the memory.
+    UINT k = 0;
+    while (k < n && pbAdd(pb, rows + (size_t)k * pg->nattrs) != -1) k++;
 
-    printf("\njoin() is invoked.\n");
-    printf("\nJOIN\nidx1: %u | table1_name: %s | idx2: %u | table2_name: %s\n", idx1, table1_name, idx2, table2_name); 
+    freePageBuilder(pb);
+    return k;
 
-    // get table meta
-    exTable* tmeta1 = getTableMeta(table1_name);
-    exTable* tmeta2 = getTableMeta(table2_name);
-    if (tmeta1 == NULL || tmeta2 == NULL) return NULL;
-    
-    int res_ntuples = 0;
-    // temp array holding results
-    INT temp[tmeta1->ntuples * tmeta2->ntuples][tmeta1->nattrs + tmeta2->nattrs];
+}
 
-    // naive nested loop join
-    if (tmeta1->npages + tmeta2->npages > conf->buf_slots) {
 
-        printf("\nBLOCK NESTED LOOP JOIN\n");
-        
-        // compute performance cost
-        // table 1 as outer table
-        int a = tmeta1->npages / (conf->buf_slots - 1);
-        if (tmeta1->npages % (conf->buf_slots - 1) != 0) a++;
-        int plan1 = tmeta1->npages + tmeta2->npages * a;
-
-        // table 2 as outer table
-        int b = tmeta2->npages / (conf->buf_slots - 1);
-        if (tmeta2->npages % (conf->buf_slots - 1) != 0) b++;
-        int plan2 = tmeta2->npages + tmeta1->npages * b;
-
-        printf("COST [plan1: %i | plan2: %i]\n", plan1, plan2);
-
-        int nchunks;
-        int outer_npages;
-        int inner_npages;
-        char outer_tname[10];
-        char inner_tname[10];
-        int outer_idx;
-        int inner_idx;
-        
-        // performance evaluator
-        if (plan1 <= plan2) { // if both plan has same cost, always use table1 as outer
-            nchunks = a;
-            outer_npages = tmeta1->npages;
-            inner_npages = tmeta2->npages;
-            strcpy(outer_tname, tmeta1->name);
-            strcpy(inner_tname, tmeta2->name);
-            outer_idx = idx1;
-            inner_idx = idx2;
-            printf("plan1 is chosen: table1 as outer, table2 as inner\n");
-        } else {
-            nchunks = b;
-            outer_npages = tmeta2->npages;
-            inner_npages = tmeta1->npages;
-            strcpy(outer_tname, tmeta2->name);
-            strcpy(inner_tname, tmeta1->name);
-            outer_idx = idx2;
-            inner_idx = idx1;
-            printf("plan2 is chosen: table2 as outer, table1 as inner\n");
-        }
+int insertRows(const char* table_name, INT* rows, const UINT n, int* index_failed) {
 
-        // number of outer page to read in chunk
-        int outer_nPiC = min(outer_npages, conf->buf_slots - 1);
+    // rows go to tables only, indexes follow them
+    Table* t = NULL;
+    for (int i = 0; i < dbase->ntables; i++) {
+        if (strcmp(dbase->tables[i].name, table_name) == 0) t = &dbase->tables[i];
+    }
+    if (t == NULL) return -1;
 
-        // for each outer chunk
-        for (int i = 0; i < nchunks; i++) { 
+    exTable* tmeta = getTableMeta(table_name);
+    const UINT nattrs = tmeta->nattrs;
+    const INT key = tmeta->cluster_key;
 
-            // temporarily stores bid of processed outer chunk pages
-            int outerL[outer_nPiC];
+    trace("\ninsertRows() is invoked.\n");
 
-            // read a chunk of outer page
-            printf("\n... reading %i/%i outer chunk (outer_nPiC: %i) ...\n", i+1, nchunks, outer_nPiC);
-            for (int j = 0; j < outer_nPiC; j++) { 
-                outerL[j] = requestPage(outer_tname, j + i * (conf->buf_slots - 1));
-                if (outerL[j] == -1) return NULL;
-            }
-            printf("\n... finished reading %i/%i outer chunk ...\n", i+1, nchunks);
+    *index_failed = 0;
 
-            printf("\n... reading inner pages, computing result tuples ...\n");
+    if (n == 0) return 0;
+    if (key >= 0) sort_rows(rows, n, t);
 
-            // for each inner page
-            for (int k = 0; k < inner_npages; k++) { 
-                
-                int inner_bid = requestPage(inner_tname, k);
-                if (inner_bid == -1) return NULL;
-
-                printf("results:\n");
-
-                // for each outer page in chunk
-                for (int m = 0; m < outer_nPiC; m++) { 
-                    
-                    //int outer_bid = requestPage(outer_tname, m + i * (conf->buf_slots - 1));
-                    //if (outer_bid == -1) return NULL;
-                    //outerL[m] = outer_bid;
-                    int outer_bid = outerL[m];
-
-                    // for each tuple in outer page
-                    for (int oy = 0; oy < pageBuffer[outer_bid]->ntuples; oy++) {
-                        
-                        // for each tuple in inner page
-                        for (int iy = 0; iy < pageBuffer[inner_bid]->ntuples; iy++) { 
-                            
-                            // do comparison, join test
-                            if (pageBuffer[outer_bid]->tuple[oy][outer_idx] == pageBuffer[inner_bid]->tuple[iy][inner_idx]) {
-                                
-                                int s;
-                                int v;
-
-                                if (plan1 <= plan2) { 
-                                    s = 0;
-                                    v = pageBuffer[outer_bid]->nattrs;
-                                } else {
-                                    s = pageBuffer[inner_bid]->nattrs;
-                                    v = 0;
-                                }
-
-                                // store result tuple to temp
-                                // reverse print order depending on plan
-                                for (int ox = 0; ox < pageBuffer[outer_bid]->nattrs; ox++) {
-                                    printf("%i ", pageBuffer[outer_bid]->tuple[oy][ox]);
-                                    temp[res_ntuples][ox+s] = pageBuffer[outer_bid]->tuple[oy][ox];
-                                }
-
-                                for (int ix = 0; ix < pageBuffer[inner_bid]->nattrs; ix++) {
-                                    printf("%i ", pageBuffer[inner_bid]->tuple[iy][ix]);
-                                    temp[res_ntuples][ix+v] = pageBuffer[inner_bid]->tuple[iy][ix];
-                                }
-                                
-                                printf("\n");
-                                res_ntuples++;
-
-                            }
-                        }
-                    }
-                }
+    // the page and slot every row lands in, for the indexes
+    UINT64* ipids = arenaAlloc(queryArena(), sizeof(UINT64) * n);
+    UINT* slots = arenaAlloc(queryArena(), sizeof(UINT) * n);
 
-                // release inner page
-                releasePage(inner_bid);
+    UINT64 ipid = 0;
+    int bid = -1;
+    if (tmeta->npages > 0) {
+        ipid = tmeta->npages - 1;
+        bid = requestPage(table_name, ipid);
+        if (bid == -1) return -1;
+        PageDesc* pg = pageBuffer[bid];
+        if (key >= 0 && pg->ntuples > 0 && rows[key] < pg->tuple[pg->ntuples - 1][key]) {
+            trace("Rows of %s start below its last key %i.\n", table_name, pg->tuple[pg->ntuples - 1][key]);
+            releasePage(bid);
+            return -1;
+        }
+    }
 
-            }
+    // fill the last page, then add pages, one pinned at a time
+    UINT done = 0;
+    while (done < n) {
 
-            //release all outer pages in chunk
-            for (int p = 0; p < outer_nPiC; p++) {
-                releasePage(outerL[p]);
-            }
+        const INT* next = rows + (size_t)done * nattrs;
 
-            printf("\n... finished computing result tuples ...\n");
+        if (bid == -1) {
+            // no slot for a new page, the rows placed so far stay appended
+            bid = newPage(tmeta, tmeta->npages);
+            if (bid == -1) {
+                trace("No slot for page %lu of %s, %u of %u rows appended.\n", (unsigned long)tmeta->npages, table_name, done, n);
+                break;
+            }
+            ipid = tmeta->npages++;
+            if (key >= 0) {
+                t->fences = realloc(t->fences, sizeof(INT) * tmeta->npages);
+                t->fences[ipid] = next[key];
+                tmeta->fences = t->fences;
+            }
+        }
 
-            // recompute number of pages to read in next chunk
-            outer_nPiC = min(outer_npages - outer_nPiC * (i+1), conf->buf_slots - 1);
+        PageDesc* pg = pageBuffer[bid];
+        UINT k = tmeta->compressed ? compressedRoom(pg, next, n - done) : min(tmeta->ntpp - pg->ntuples, n - done);
 
+        if (k > 0) {
+            // an uncompressed page gets room for a full page at once, later rows go in place
+            growPage(bid, tmeta->compressed ? pg->ntuples + k : tmeta->ntpp);
+            memcpy(pg->tuple[pg->ntuples], next, sizeof(INT) * nattrs * k);
+            for (UINT j = 0; j < k; j++) {
+                ipids[done + j] = ipid;
+                slots[done + j] = pg->ntuples + j;
+            }
+            pg->ntuples += k;
+            pg->dirty = 1;
+            done += k;
         }
 
-        
-    // simple hash join
-    } else {
+        releasePage(bid);
+        bid = -1;
 
-        printf("\nSIMPLE HASH JOIN\n");
-        printf("table1 as outer, table2 as inner\n");
+    }
 
-        // always treat table1 as outer table, table2 as inner table
+    // the meta follows the rows, the readers of the file desc compute the size of its last page from it
+    if (done == 0) return -1;
+    tmeta->ntuples += done;
+    if (tmeta->compressed) tmeta->ntpp = (tmeta->ntuples + tmeta->npages - 1) / tmeta->npages;
+    t->ntuples = tmeta->ntuples;
+    t->npages = tmeta->npages;
+
+    int fid = findFile(table_name);
+    if (fid >= 0) {
+        fileBuffer[fid]->ntuples = tmeta->ntuples;
+        fileBuffer[fid]->npages = tmeta->npages;
+    }
 
-        // compute hash table for outer table
-        // hash table is temporary and will be destroyed once hash join is completed
-        // partition based on even or odd numbers on join attrs
-        int hashtable[2][tmeta1->ntuples][tmeta1->nattrs];
+    trace("%u rows appended to %s | ntuples: %lu | npages: %lu\n", done, table_name, (unsigned long)tmeta->ntuples, (unsigned long)tmeta->npages);
 
-        // number of entries in parition
-        int nEiP[2] = {0, 0};
+    // the rows are in the table whatever becomes of the indexes
+    if (indexInsert(table_name, rows, nattrs, ipids, slots, done) == -1) *index_failed = 1;
 
-        // table1, outer table
-        // scan through each page in outer table, hash all tuples into paritions
-        printf("\n... hashing table1 into 2 partitions ...\n");
+    return done;
 
-        // for each page in table
-        for (int i = 0; i < tmeta1->npages; i++) { 
-            
-            // request page
-            int bid = requestPage(table1_name, i);
-            if (bid == -1) return NULL;
-            
-            // for each tuples in page
-            for (int y = 0; y < pageBuffer[bid]->ntuples; y++) { 
-                
-                // check divisibility on join attrs
-                int prt = hash(pageBuffer[bid]->tuple[y][idx1]);
+}
 
-                // for each attr in tuple
-                for (int x = 0; x < pageBuffer[bid]->nattrs; x++) { 
 
-                    // make a copy to hash table
-                    hashtable[prt][nEiP[prt]][x] = pageBuffer[bid]->tuple[y][x];
+_Table* sel(const UINT idx, const INT cond_val, const char* table_name) {
+    return selRange(idx, cond_val, cond_val, table_name);
+}
 
-                }
 
-                nEiP[prt]++;
+// first page of a clustered table that can hold keys >= lo: the last page starting below lo,
+// equal keys may continue from it
+static UINT64 clusterStart(const exTable* tmeta, const int64_t lo) {
+    UINT64 start = 0;
+    UINT64 l = 0;
+    UINT64 h = tmeta->npages;
+    while (l < h) {
+        UINT64 mid = l + (h - l) / 2;
+        if (tmeta->fences[mid] < lo) {
+            start = mid;
+            l = mid + 1;
+        } else {
+            h = mid;
+        }
+    }
+    return start;
+}
 
-            }
 
-            // release page
-            releasePage(bid);
+// pages [first, end) of a clustered table that can hold keys in [lo, hi]
+static UINT64 clusterEnd(const exTable* tmeta, const UINT64 first, const int64_t hi) {
+    UINT64 end = first;
+    while (end < tmeta->npages && tmeta->fences[end] <= hi) end++;
+    return end;
+}
 
-        }
 
-        printf("\n... finished hashing table1 into 2 partitions ...\n");
+_Table* selRange(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name) {
+    return selProj(idx, lo, hi, table_name, NULL);
+}
 
-        // table2, inner table
-        // scan through each page in inner table, compare with the corresponding parition in hash table
-        printf("\n... scanning table2, computing result tuples ...\n");
 
-        // for each page in table
-        for (int i = 0; i < tmeta2->npages; i++) { 
-            
-            // request page
-            int bid = requestPage(table2_name, i); 
+// trace n result rows of width attributes
+static void traceRows(const INT* rows, const UINT n, const UINT width) {
+    if (conf->quiet) return;
+    for (UINT k = 0; k < n; k++) {
+        for (UINT x = 0; x < width; x++) printf("%i ", rows[(size_t)k * width + x]);
+        printf("\n");
+    }
+}
+
+
+// -1 if an attribute of proj is outside a result of nattrs attributes
+static int checkProj(const Projection* proj, const UINT nattrs) {
+    if (proj == NULL) return 0;
+    for (UINT x = 0; x < proj->n; x++) {
+        if (proj->attrs[x] >= nattrs) {
+            trace("Projected attribute %u out of range\n", proj->attrs[x]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+_Table* selProj(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name, const Projection* proj) {
+
+    // invoke log_read_page() every time a page is read from the hard drive.
+    // invoke log_release_page() every time a page is released from the memory.
+
+    // invoke log_open_file() every time a page is read from the hard drive.
+    // invoke log_close_file() every time a page is released from the memory.
+    
+    trace("\nsel() is invoked.\n");
+    trace("\nSEL\nidx: %u | range: [%ld, %ld] | table_name: %s\n", idx, (long)lo, (long)hi, table_name); 
+
+    exTable* tmeta = getTableMeta(table_name);
+    if (tmeta == NULL || checkProj(proj, tmeta->nattrs) == -1) return NULL;
+
+    begin_phase(PH_SCAN);
+    memOperator(MEM_SEL);
+    
+    // result rows, built in place in the query arena, spilled past the memory budget
+    RowBuf res;
+    rowbufInit(&res, queryArena(), proj != NULL ? proj->n : tmeta->nattrs);
+    rowbufStream(&res, querySink());
+    rowbufSpill(&res);
+    rowbufLimit(&res, queryLimit());
+
+    // selection vector of a batch
+    UINT sel[VEC_SIZE];
+
+    // a clustered table is only read from the last page starting below lo to the last page starting at most at hi
+    int clustered = tmeta->cluster_key >= 0 && idx == tmeta->cluster_key;
+    UINT64 first = 0;
+    UINT64 end = tmeta->npages;
+    if (clustered) {
+        first = lo > hi ? tmeta->npages : clusterStart(tmeta, lo);
+        end = clusterEnd(tmeta, first, hi);
+        trace("clustered pages: [%lu, %lu)\n", (unsigned long)first, (unsigned long)end);
+    }
+    for (UINT64 ipid = 0; ipid < tmeta->npages; ipid++) {
+        if (ipid < first || ipid >= end) log_skip_page(ipid);
+    }
+    
+    // for each page in range, until the rows of a limit are found
+    for (UINT64 ipid = first; ipid < end && !rowbufFull(&res); ipid++) {
+        
+        // get buffer id
+        int bid = requestPage(table_name, ipid);
+        if (bid == -1) return NULL;
+
+        // do range comparison
+        trace("results:\n");
+        log_examine_tuples(pageBuffer[bid]->ntuples);
+
+        // an attribute out of range matches no tuple, the table is still scanned
+        int ntuples = idx < tmeta->nattrs ? pageBuffer[bid]->ntuples : 0;
+
+        // the rows of a page are one block, filtered and gathered a batch at a time
+        // by the kernels of the table width, whole rows at once without a projection
+        const VecKernels* kern = tmeta->kern;
+        UINT stride = pageBuffer[bid]->nattrs;
+        for (int b = 0; b < ntuples && !rowbufFull(&res); b += VEC_SIZE) {
+            INT* rows = pageBuffer[bid]->tuple[b];
+            UINT n = kern->filterRange(rows, stride, idx, min(ntuples - b, VEC_SIZE), lo, hi, sel);
+            INT* out = rowbufAppendN(&res, n);
+            if (proj == NULL) kern->gatherRows(rows, stride, sel, n, out, res.width);
+            else for (UINT x = 0; x < res.width; x++) kern->gather(rows, stride, proj->attrs[x], sel, n, out + x, res.width);
+            traceRows(out, n, res.width);
+        }
+
+        // finished reading page, release page
+        releasePage(bid);
+
+    }
+
+    trace("\nres_ntuples: %lu\n", (unsigned long)res.nrows);
+
+    end_phase(PH_SCAN);
+    begin_phase(PH_MATERIALIZE);
+
+    // compose result table
+    _Table* result = rowbufTable(&res);
+
+    log_emit_tuples(result->ntuples);
+    end_phase(PH_MATERIALIZE);
+
+    trace("\n====================\n");
+    printPageBuffer();
+    trace("====================\n");
+    printFileBuffer();
+    trace("====================\n");
+    
+    return result;
+
+}
+
+
+// slot of (attr, val) in the predicate hash table of selShared()
+static UINT predHash(const UINT attr, const INT val, const UINT mask) {
+    return (((UINT)val * 2654435761u) ^ (attr * 40503u)) & mask;
+}
+
+
+int selShared(const UINT n, const UINT* idx, const INT* cond_vals, const char* table_name, _Table** results) {
+
+    trace("\nselShared() is invoked.\n");
+    trace("\nSHARED SEL\ntable_name: %s | nqueries: %u\n", table_name, n);
+
+    for (UINT i = 0; i < n; i++) results[i] = NULL;
+
+    exTable* tmeta = getTableMeta(table_name);
+    if (tmeta == NULL) return -1;
+
+    begin_phase(PH_BUILD);
+    memOperator(MEM_SEL);
+
+    Arena* a = queryArena();
+    RowBuf* res = arenaAlloc(a, sizeof(RowBuf) * n);
+
+    // predicates hashed on (attr, val), equal predicates are chained behind the first
+    UINT nslots = 1;
+    while (nslots < 2 * n) nslots <<= 1;
+    UINT mask = nslots - 1;
+    int* slots = arenaAlloc(a, sizeof(int) * nslots);
+    int* next = arenaAlloc(a, sizeof(int) * n);
+    for (UINT s = 0; s < nslots; s++) slots[s] = -1;
+
+    // attributes with at least one predicate, each is looked up once per tuple
+    UINT* attrs = arenaAlloc(a, sizeof(UINT) * tmeta->nattrs);
+    int* used = arenaAlloc(a, sizeof(int) * tmeta->nattrs);
+    UINT nused = 0;
+    memset(used, 0, sizeof(int) * tmeta->nattrs);
+
+    for (int i = (int)n - 1; i >= 0; i--) {
+        rowbufInit(&res[i], a, tmeta->nattrs);
+        rowbufSpill(&res[i]);
+        // an attribute out of range matches no tuple
+        if (idx[i] >= tmeta->nattrs) continue;
+        if (!used[idx[i]]) {
+            used[idx[i]] = 1;
+            attrs[nused++] = idx[i];
+        }
+        UINT s = predHash(idx[i], cond_vals[i], mask);
+        while (slots[s] != -1 && (idx[slots[s]] != idx[i] || cond_vals[slots[s]] != cond_vals[i])) s = (s + 1) & mask;
+        // push in reverse so that each chain keeps query order
+        next[i] = slots[s];
+        slots[s] = i;
+    }
+
+    end_phase(PH_BUILD);
+    begin_phase(PH_SCAN);
+
+    for (UINT64 ipid = 0; ipid < tmeta->npages; ipid++) {
+
+        int bid = requestPage(table_name, ipid);
+        if (bid == -1) return -1;
+
+        log_examine_tuples(pageBuffer[bid]->ntuples);
+
+        for (int y = 0; y < pageBuffer[bid]->ntuples; y++) {
+            INT* tuple = pageBuffer[bid]->tuple[y];
+            for (UINT k = 0; k < nused; k++) {
+                UINT attr = attrs[k];
+                UINT s = predHash(attr, tuple[attr], mask);
+                while (slots[s] != -1 && (idx[slots[s]] != attr || cond_vals[slots[s]] != tuple[attr])) s = (s + 1) & mask;
+
+                // route the tuple to every query with this predicate
+                for (int i = slots[s]; i != -1; i = next[i]) {
+                    memcpy(rowbufAppend(&res[i]), tuple, sizeof(INT) * tmeta->nattrs);
+                }
+            }
+        }
+
+        releasePage(bid);
+
+    }
+
+    end_phase(PH_SCAN);
+    begin_phase(PH_MATERIALIZE);
+
+    for (UINT i = 0; i < n; i++) {
+        results[i] = rowbufTable(&res[i]);
+        log_emit_tuples(results[i]->ntuples);
+        trace("query %u: idx: %u | cond_val: %i | res_ntuples: %lu\n", i, idx[i], cond_vals[i], (unsigned long)results[i]->ntuples);
+    }
+
+    end_phase(PH_MATERIALIZE);
+
+    return 0;
+
+}
+
+
+int planSel(const UINT idx, const INT cond_val, const char* table_name, Plan* plan) {
+    return planSelRange(idx, cond_val, cond_val, table_name, plan);
+}
+
+
+// selection planner, a full scan or, on the clustering key, the pages holding the range
+int planSelRange(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name, Plan* plan) {
+
+    exTable* tmeta = getTableMeta(table_name);
+    if (tmeta == NULL) return -1;
+
+    plan->method = PLAN_SCAN;
+    strcpy(plan->outer, tmeta->name);
+    plan->inner[0] = '\0';
+    plan->outer_idx = idx;
+    plan->inner_idx = 0;
+    plan->swapped = 0;
+    plan->nchunks = 1;
+    plan->cost = tmeta->npages;
+    plan->alt_cost = -1;
+    plan->est_rows = -1;
+
+    // the fences give the exact number of pages to read, the full scan is the rejected plan
+    if (tmeta->cluster_key >= 0 && idx == tmeta->cluster_key) {
+        UINT64 first = lo > hi ? tmeta->npages : clusterStart(tmeta, lo);
+        plan->method = PLAN_CLUSTER;
+        plan->cost = clusterEnd(tmeta, first, hi) - first;
+        plan->alt_cost = tmeta->npages;
+    }
+    plan->total_cost = plan->cost;
+
+    if (tmeta->stats != NULL && idx < tmeta->nattrs) {
+        double examined = plan->method == PLAN_CLUSTER ? min((double)plan->cost * tmeta->ntpp, tmeta->ntuples) : tmeta->ntuples;
+        plan->est_rows = tmeta->ntuples * (lo == hi ? estSelEq(&tmeta->stats->cols[idx], lo) : estSelRange(&tmeta->stats->cols[idx], lo, hi));
+        plan->total_cost = plan->cost + CPU_TUPLE_COST * (examined + plan->est_rows);
+    }
+
+    return 0;
+
+}
+
+
+// bytes of the build side of a hash join: keys, entries and the hash table over them
+static size_t buildBytes(const UINT64 ntuples, const UINT nbcols) {
+    return ntuples * (sizeof(INT) * (nbcols + 1) + sizeof(UINT) * 6);
+}
+
+
+// the build side of a hash join is copied out of the buffer pool, it is joined in memory while it fits the memory left
+// the projection is not known to the planner, so the rows are taken whole
+static int fitsBuild(exTable* build) {
+    return buildBytes(build->ntuples, build->nattrs) <= memAvailable();
+}
+
+
+// cost one join candidate: a is the outer table (BNL, index nested loop) or the build side (hash)
+static void costJoin(Plan* p, const Method m, exTable* a, const UINT ia, exTable* b, const UINT ib, const int swapped, const double rows) {
+
+    double cpu;
+
+    p->method = m;
+    strcpy(p->outer, a->name);
+    strcpy(p->inner, b->name);
+    p->outer_idx = ia;
+    p->inner_idx = ib;
+    p->swapped = swapped;
+    p->alt_cost = -1;
+    p->est_rows = rows;
+
+    if (m == PLAN_BNL) {
+        p->nchunks = a->npages / (conf->buf_slots - 1);
+        if (a->npages % (conf->buf_slots - 1) != 0) p->nchunks++;
+        p->cost = a->npages + b->npages * p->nchunks;
+        cpu = (double)a->ntuples * b->ntuples;
+    } else if (m == PLAN_INL) {
+        // every outer tuple probes the index on b: leaf pages holding its matches
+        // plus one data page per match, assuming matches lie on distinct pages
+        exIndex* ix = getIndex(b->name, ib);
+        double per = a->ntuples > 0 ? rows / a->ntuples : 0;
+        double probe = 1 + per / ix->meta.ntpp + min(per, b->npages);
+        p->nchunks = 1;
+        p->cost = a->npages + (int64_t)(a->ntuples * probe + 0.999);
+        cpu = a->ntuples * (1 + per);
+    } else {
+        // the build side is hashed once and each probe tuple walks the chain of its key, the output is added below
+        // a build side past the memory left partitions both tables to disk and reads them back
+        p->nchunks = 1;
+        p->cost = a->npages + b->npages;
+        if (!fitsBuild(a)) p->cost += 2 * (a->npages + b->npages);
+        cpu = BUILD_WEIGHT * (double)a->ntuples + b->ntuples;
+    }
+
+    p->total_cost = p->cost + CPU_TUPLE_COST * (cpu + rows);
+
+}
+
+
+// index nested loop join probes an index on the inner table with one outer, one index and one data page pinned
+static int canINL(exTable* outer, exTable* inner, const UINT inner_idx) {
+    return conf->buf_slots >= 3 && outer != inner && getIndex(inner->name, inner_idx) != NULL;
+}
+
+
+// cost-based join planner, used once both tables are analyzed
+// candidates: BNL with either outer table, hash join with either build side,
+// index nested loop join with either outer table when the inner one is indexed
+// hash join needs its build side to fit in the buffer pool beside one probe page
+// one whose build side does not fit the memory left pays for partitioning both tables to disk
+static int planJoinStats(exTable* tmeta1, const UINT idx1, exTable* tmeta2, const UINT idx2, Plan* plan) {
+
+    double rows = (double)tmeta1->ntuples * tmeta2->ntuples * estSelJoin(&tmeta1->stats->cols[idx1], &tmeta2->stats->cols[idx2]);
+
+    Plan cand[6];
+    int ncand = 0;
+    costJoin(&cand[ncand++], PLAN_BNL, tmeta1, idx1, tmeta2, idx2, 0, rows);
+    costJoin(&cand[ncand++], PLAN_BNL, tmeta2, idx2, tmeta1, idx1, 1, rows);
+    if (tmeta1->npages <= conf->buf_slots - 1) costJoin(&cand[ncand++], PLAN_HASH, tmeta1, idx1, tmeta2, idx2, 0, rows);
+    if (tmeta2->npages <= conf->buf_slots - 1) costJoin(&cand[ncand++], PLAN_HASH, tmeta2, idx2, tmeta1, idx1, 1, rows);
+    if (canINL(tmeta1, tmeta2, idx2)) costJoin(&cand[ncand++], PLAN_INL, tmeta1, idx1, tmeta2, idx2, 0, rows);
+    if (canINL(tmeta2, tmeta1, idx1)) costJoin(&cand[ncand++], PLAN_INL, tmeta2, idx2, tmeta1, idx1, 1, rows);
+
+    int best = 0;
+    for (int c = 0; c < ncand; c++) {
+        trace("COST [%s outer: %s | io: %ld | total: %.2f]\n", methodName(cand[c].method), cand[c].outer, (long)cand[c].cost, cand[c].total_cost);
+        if (cand[c].total_cost < cand[best].total_cost) best = c;
+    }
+
+    *plan = cand[best];
+    for (int c = 0; c < ncand; c++) {
+        if (c == best) continue;
+        if (plan->alt_cost == -1 || cand[c].total_cost < cand[plan->alt_cost].total_cost) plan->alt_cost = c;
+    }
+    if (plan->alt_cost != -1) plan->alt_cost = cand[plan->alt_cost].cost;
+
+    trace("%s is chosen: %s as outer, %s as inner | est_rows: %.0f\n", methodName(plan->method), plan->outer, plan->inner, plan->est_rows);
+
+    return 0;
+
+}
+
+
+// join planner without statistics
+// hash join if both tables fit in the buffer, else block nested loop join with the cheaper outer table
+static void planJoinSize(exTable* tmeta1, const UINT idx1, exTable* tmeta2, const UINT idx2, Plan* plan) {
+
+    plan->est_rows = -1;
+
+    // simple hash join, always treat table1 as outer table
+    if (tmeta1->npages + tmeta2->npages <= conf->buf_slots) {
+        plan->method = PLAN_HASH;
+        strcpy(plan->outer, tmeta1->name);
+        strcpy(plan->inner, tmeta2->name);
+        plan->outer_idx = idx1;
+        plan->inner_idx = idx2;
+        plan->swapped = 0;
+        plan->nchunks = 1;
+        plan->cost = tmeta1->npages + tmeta2->npages;
+        plan->alt_cost = -1;
+        plan->total_cost = plan->cost;
+        return;
+    }
+
+    // compute performance cost
+    // table 1 as outer table
+    int64_t a = tmeta1->npages / (conf->buf_slots - 1);
+    if (tmeta1->npages % (conf->buf_slots - 1) != 0) a++;
+    int64_t plan1 = tmeta1->npages + tmeta2->npages * a;
+
+    // table 2 as outer table
+    int64_t b = tmeta2->npages / (conf->buf_slots - 1);
+    if (tmeta2->npages % (conf->buf_slots - 1) != 0) b++;
+    int64_t plan2 = tmeta2->npages + tmeta1->npages * b;
+
+    trace("COST [plan1: %ld | plan2: %ld]\n", (long)plan1, (long)plan2);
+
+    plan->method = PLAN_BNL;
+    plan->total_cost = min(plan1, plan2);
+
+    // performance evaluator
+    if (plan1 <= plan2) { // if both plan has same cost, always use table1 as outer
+        plan->swapped = 0;
+        plan->nchunks = a;
+        strcpy(plan->outer, tmeta1->name);
+        strcpy(plan->inner, tmeta2->name);
+        plan->outer_idx = idx1;
+        plan->inner_idx = idx2;
+        plan->cost = plan1;
+        plan->alt_cost = plan2;
+        trace("plan1 is chosen: table1 as outer, table2 as inner\n");
+    } else {
+        plan->swapped = 1;
+        plan->nchunks = b;
+        strcpy(plan->outer, tmeta2->name);
+        strcpy(plan->inner, tmeta1->name);
+        plan->outer_idx = idx2;
+        plan->inner_idx = idx1;
+        plan->cost = plan2;
+        plan->alt_cost = plan1;
+        trace("plan2 is chosen: table2 as outer, table1 as inner\n");
+    }
+
+}
+
+
+// a hash join whose build side, as whole rows, is larger than radix_min is joined over radix partitions
+static void planRadix(Plan* plan) {
+    if (plan->method != PLAN_HASH) return;
+    exTable* b = getTableMeta(plan->outer);
+    size_t bytes = buildBytes(b->ntuples, b->nattrs);
+    if (bytes <= conf->radix_min) return;
+    plan->method = PLAN_RADIX;
+    trace("RADIX is chosen: build side of %lu bytes\n", (unsigned long)bytes);
+}
+
+
+// join planner
+// with statistics on both tables the cheapest candidate by estimated cost is chosen
+// otherwise the size heuristic, replaced by an index nested loop join when its page reads are lower
+// without statistics every outer tuple is assumed to match at most one inner tuple
+// either way a hash join over a build side past radix_min is turned into a radix join
+int planJoin(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name, Plan* plan) {
+
+    exTable* tmeta1 = getTableMeta(table1_name);
+    exTable* tmeta2 = getTableMeta(table2_name);
+    if (tmeta1 == NULL || tmeta2 == NULL) return -1;
+
+    if (tmeta1->stats != NULL && tmeta2->stats != NULL) {
+        planJoinStats(tmeta1, idx1, tmeta2, idx2, plan);
+        planRadix(plan);
+        return 0;
+    }
+
+    planJoinSize(tmeta1, idx1, tmeta2, idx2, plan);
+
+    double rows = (double)tmeta1->ntuples * tmeta2->ntuples / max(max(tmeta1->ntuples, tmeta2->ntuples), 1);
+
+    for (int swapped = 0; swapped < 2; swapped++) {
+
+        exTable* outer = swapped ? tmeta2 : tmeta1;
+        exTable* inner = swapped ? tmeta1 : tmeta2;
+        UINT outer_idx = swapped ? idx2 : idx1;
+        UINT inner_idx = swapped ? idx1 : idx2;
+        if (!canINL(outer, inner, inner_idx)) continue;
+
+        Plan inl;
+        costJoin(&inl, PLAN_INL, outer, outer_idx, inner, inner_idx, swapped, rows);
+        trace("COST [INL outer: %s | io: %ld]\n", inl.outer, (long)inl.cost);
+
+        if (inl.cost < plan->cost) {
+            inl.alt_cost = plan->cost;
+            inl.est_rows = -1;
+            inl.total_cost = inl.cost;
+            *plan = inl;
+            trace("INL is chosen: %s as outer, %s as inner\n", plan->outer, plan->inner);
+        }
+
+    }
+
+    planRadix(plan);
+    return 0;
+
+}
+
+
+// where each result attribute comes from: attribute pos[x] of the outer tuple if outer[x], else of the inner tuple
+// the outer tuple is the build side entry of a hash join
+// without a projection both tuples are copied whole, the outer one at ooff and the inner one at ioff
+typedef struct JoinOut {
+    UINT width;
+    UINT* outer;
+    UINT* pos;
+    int whole;
+    UINT ooff;
+    UINT ioff;
+    int trace; // trace the result rows as they are emitted
+} JoinOut;
+
+
+// map the result attributes, table1 attributes then table2 attributes or those of proj, to the plan sides
+// table1 is the outer table unless the plan is swapped
+static void initJoinOut(JoinOut* jo, const Projection* proj, const UINT nattrs1, const UINT nattrs2, const int swapped) {
+    jo->width = proj != NULL ? proj->n : nattrs1 + nattrs2;
+    jo->outer = arenaAlloc(queryArena(), sizeof(UINT) * jo->width);
+    jo->pos = arenaAlloc(queryArena(), sizeof(UINT) * jo->width);
+    for (UINT x = 0; x < jo->width; x++) {
+        UINT c = proj != NULL ? proj->attrs[x] : x;
+        int from1 = c < nattrs1;
+        jo->outer[x] = from1 != swapped;
+        jo->pos[x] = from1 ? c : c - nattrs1;
+    }
+    jo->whole = proj == NULL;
+    jo->trace = 1;
+    jo->ooff = swapped ? nattrs1 : 0;
+    jo->ioff = swapped ? 0 : nattrs1;
+}
+
+
+// copy the result attributes of a match, nothing else of the two tuples is touched
+static void emitJoin(RowBuf* res, const JoinOut* jo, const INT* outer, const INT* inner) {
+    INT* out = rowbufAppend(res);
+    for (UINT x = 0; x < jo->width; x++) {
+        out[x] = jo->outer[x] ? outer[jo->pos[x]] : inner[jo->pos[x]];
+        trace("%i ", out[x]);
+    }
+    trace("\n");
+}
+
+
+// copy the result attributes of n matches: the outer row osel[k] and the inner row isel[k] of each
+static void emitBatch(RowBuf* res, const JoinOut* jo, const INT* orows, const UINT ostride, const UINT* osel,
+    const INT* irows, const UINT istride, const UINT* isel, const UINT n) {
+    if (n == 0) return;
+    INT* out = rowbufAppendN(res, n);
+    const VecKernels* okern = vecKernels(ostride);
+    const VecKernels* ikern = vecKernels(istride);
+    if (jo->whole) {
+        okern->gatherRows(orows, ostride, osel, n, out + jo->ooff, jo->width);
+        ikern->gatherRows(irows, istride, isel, n, out + jo->ioff, jo->width);
+    } else {
+        for (UINT x = 0; x < jo->width; x++) {
+            if (jo->outer[x]) okern->gather(orows, ostride, jo->pos[x], osel, n, out + x, jo->width);
+            else ikern->gather(irows, istride, jo->pos[x], isel, n, out + x, jo->width);
+        }
+    }
+    if (jo->trace) traceRows(out, n, jo->width);
+}
+
+
+// result collector of the index nested loop join
+typedef struct INLContext {
+    RowBuf* res;
+    const JoinOut* jo;
+    INT* outer; // current outer tuple
+} INLContext;
+
+
+static void emitINL(void* arg, const int bid, const int slot) {
+    INLContext* ctx = arg;
+    emitJoin(ctx->res, ctx->jo, ctx->outer, pageBuffer[bid]->tuple[slot]);
+}
+
+
+// buffer pool calls of the workers of a parallel operator
+static pthread_mutex_t buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// hash table and buffers of a worker of the block nested loop join
+typedef struct BNLWorker {
+    VecHashTable ht;
+    VecPairs pairs;
+    INT* ikeys;
+    UINT ikeys_cap;
+    INT* irows; // copy of the inner page
+    UINT irows_cap;
+} BNLWorker;
+
+
+// the pinned outer chunk of a block nested loop join, with the hashes of its join keys
+// inner pages of parallel task t are [first[t], first[t + 1]), its matches go to results[t]
+// parallel workers copy an inner page and release it at once, so the chunk still takes all buffer slots but one
+typedef struct BNLChunk {
+    const char* inner_tname;
+    UINT outer_idx;
+    UINT inner_idx;
+    const VecKernels* okern;
+    const VecKernels* ikern;
+    const JoinOut* jo;
+    int npages;
+    int* bids;
+    UINT* ohashes;
+    UINT* ohash_off; // the hashes of outer page j start at ohash_off[j]
+    int copy;
+    UINT64* first;
+    const RowBuf* res;
+    RowBuf* results;
+    int failed;
+} BNLChunk;
+
+
+static void initBNLWorker(BNLWorker* w) {
+    vecHashInit(&w->ht);
+    w->pairs = (VecPairs){0, 0, NULL, NULL};
+    w->ikeys = NULL;
+    w->ikeys_cap = 0;
+    w->irows = NULL;
+    w->irows_cap = 0;
+}
+
+
+// join inner page k with the chunk: hash the inner page on its join key and probe it with the outer tuples
+// of the chunk a batch at a time, matches in nested loop order are appended to out
+// return -1 if the page cannot be read
+static int bnlPage(const BNLChunk* c, BNLWorker* w, RowBuf* out, const UINT64 k) {
+
+    pthread_mutex_lock(&buffer_lock);
+    int inner_bid = requestPage(c->inner_tname, k);
+    int inner_ntuples = 0;
+    UINT inner_stride = 0;
+    INT* irows = NULL;
+    if (inner_bid != -1) {
+        log_examine_tuples(pageBuffer[inner_bid]->ntuples);
+        inner_ntuples = pageBuffer[inner_bid]->ntuples;
+        inner_stride = pageBuffer[inner_bid]->nattrs;
+        irows = inner_ntuples > 0 ? pageBuffer[inner_bid]->tuple[0] : NULL;
+        if (c->copy) {
+            UINT n = inner_ntuples * inner_stride;
+            if (n > w->irows_cap) {
+                w->irows = arenaRealloc(queryArena(), w->irows, sizeof(INT) * w->irows_cap, sizeof(INT) * n);
+                w->irows_cap = n;
+            }
+            if (irows != NULL) irows = memcpy(w->irows, irows, sizeof(INT) * n);
+            releasePage(inner_bid);
+        }
+    }
+    pthread_mutex_unlock(&buffer_lock);
+    if (inner_bid == -1) return -1;
+
+    // hash table over the join keys of the inner page
+    if (inner_ntuples > w->ikeys_cap) {
+        w->ikeys = arenaRealloc(queryArena(), w->ikeys, sizeof(INT) * w->ikeys_cap, sizeof(INT) * inner_ntuples);
+        w->ikeys_cap = inner_ntuples;
+    }
+    if (irows != NULL) c->ikern->column(irows, inner_stride, c->inner_idx, inner_ntuples, w->ikeys);
+    vecHashBuild(&w->ht, w->ikeys, inner_ntuples);
+
+    if (c->jo->trace) trace("results:\n");
+
+    // for each outer page in chunk
+    for (int m = 0; m < c->npages; m++) {
+
+        int outer_bid = c->bids[m];
+
+        // probe with a batch of outer tuples at a time
+        int outer_ntuples = pageBuffer[outer_bid]->ntuples;
+        UINT outer_stride = pageBuffer[outer_bid]->nattrs;
+        for (int b = 0; b < outer_ntuples; b += VEC_SIZE) {
+            INT* orows = pageBuffer[outer_bid]->tuple[b];
+            UINT n = min(outer_ntuples - b, VEC_SIZE);
+            c->okern->probe(&w->ht, orows, outer_stride, c->outer_idx, n, c->ohashes + c->ohash_off[m] + b, &w->pairs);
+            // store result tuples, the outer tuples stay in their pinned pages until here
+            emitBatch(out, c->jo, orows, outer_stride, w->pairs.probe, irows, inner_stride, w->pairs.build, w->pairs.n);
+        }
+    }
+
+    // release inner page
+    if (!c->copy) releasePage(inner_bid);
+
+    return 0;
+
+}
+
+
+// rows of a task of a parallel join, in the arena of its worker: written to a temporary file once they would
+// exceed memAvailable() and cut to the rows res still takes, since a task is merged after those before it
+// the rows stay charged to the join, memOperator() belongs to the caller of schedRun()
+static void initTaskResult(RowBuf* rb, const RowBuf* res) {
+    rowbufInit(rb, queryArena(), res->width);
+    rowbufSpill(rb);
+    rb->op = -1;
+    rowbufLimit(rb, res->limit == NO_LIMIT ? NO_LIMIT : res->limit - res->nrows);
+}
+
+
+// SchedTask of the parallel block nested loop join: a range of inner pages against the chunk
+static void bnlTask(void* ctx, const UINT task, const UINT worker) {
+    BNLChunk* c = ctx;
+    BNLWorker w;
+    initBNLWorker(&w);
+    RowBuf* out = &c->results[task];
+    initTaskResult(out, c->res);
+    for (UINT64 k = c->first[task]; k < c->first[task + 1] && !c->failed && !rowbufFull(out); k++) {
+        if (bnlPage(c, &w, out, k) == -1) c->failed = 1;
+    }
+}
+
+
+// drop the rows of the tasks of a parallel join, and the worker arenas holding them
+static void releaseResults(RowBuf* results, const int ntasks) {
+    for (int t = 0; t < ntasks; t++) {
+        if (results[t].spill != NULL) fclose(results[t].spill);
+        results[t].spill = NULL;
+    }
+    schedResetArenas();
+}
+
+
+// append the rows of the tasks of a parallel join to res, in task order, then release them
+// the rows are copied a batch at a time, spilled ones read back from their file
+static void mergeResults(RowBuf* res, RowBuf* results, const int ntasks) {
+    for (int t = 0; t < ntasks && !rowbufFull(res); t++) {
+        RowBuf* r = &results[t];
+        if (r->nrows == 0) continue;
+        trace("results:\n");
+        FILE* spill = r->spill == NULL ? NULL : rowbufTable(r)->spill;
+        for (UINT64 done = 0; done < r->nrows && !rowbufFull(res); ) {
+            UINT n = (UINT)min(r->nrows - done, VEC_SIZE);
+            INT* out = rowbufAppendN(res, n);
+            if (spill == NULL) memcpy(out, r->rows + (size_t)done * res->width, sizeof(INT) * n * res->width);
+            else if (fread(out, sizeof(INT) * res->width, n, spill) != n) break;
+            traceRows(out, n, res->width);
+            done += n;
+        }
+    }
+    releaseResults(results, ntasks);
+}
+
+
+// count the join keys of a sample of n rows, every HEAVY_SAMPLE-th, in the summary hh
+static void sampleKeys(VecHeavy* hh, const INT* rows, const UINT stride, const UINT attr, const UINT n) {
+    INT keys[VEC_SIZE / HEAVY_SAMPLE];
+    for (UINT b = 0; b < n; b += VEC_SIZE) {
+        UINT m = (min(n - b, VEC_SIZE) + HEAVY_SAMPLE - 1) / HEAVY_SAMPLE;
+        vecColumn(rows + (size_t)b * stride, stride * HEAVY_SAMPLE, attr, m, keys);
+        vecHeavyAdd(hh, keys, m);
+    }
+}
+
+
+// hash table over n build keys, the heavy hitters among the candidates of the sample summary hh kept apart
+// candidates are the keys sampled VEC_HEAVY_MIN / HEAVY_SAMPLE times, which takes every key with enough entries
+// beyond the error of the summary; the others are chained, as they cost little more than their output
+static void skewBuild(VecHashTable* ht, const VecHeavy* hh, const INT* keys, const UINT n) {
+    INT cand[VEC_MAXHEAVY];
+    UINT ncand = vecHeavyKeys(hh, VEC_HEAVY_MIN / HEAVY_SAMPLE, cand);
+    vecHashBuildSkew(ht, keys, n, cand, ncand);
+    if (ht->nheavy > 0) trace("%u heavy hitters, %u of %u entries\n", ht->nheavy, ht->hfirst[ht->nheavy], n);
+}
+
+
+// probe buffers of a hash join
+typedef struct HashProbe {
+    UINT hashes[VEC_SIZE];
+    VecPairs pairs;
+    VecRuns runs;
+    UINT fill[VEC_SIZE]; // a probe row repeated, matched with the run of a heavy hitter
+} HashProbe;
+
+
+static HashProbe* newHashProbe() {
+    HashProbe* hp = arenaAlloc(queryArena(), sizeof(HashProbe));
+    hp->pairs = (VecPairs){0, 0, NULL, NULL};
+    return hp;
+}
+
+
+// probe the hash table ht with n rows and store the result tuples in probe order, the build entries of a row
+// in insertion order; a row of a heavy hitter is matched with its run of entries a batch at a time
+// instead of walking a chain, so the cost of a key is its output however many entries it has
+static void hashProbe(RowBuf* res, const JoinOut* jo, const VecHashTable* ht, const INT* payload, const UINT nbcols,
+    const VecKernels* kern, const INT* rows, const UINT stride, const UINT attr, const UINT n, HashProbe* hp) {
+
+    kern->hashKeys(rows, stride, attr, n, hp->hashes);
+    if (ht->nheavy == 0) {
+        kern->probe(ht, rows, stride, attr, n, hp->hashes, &hp->pairs);
+        // store result tuples, probe attributes are only read for matches
+        emitBatch(res, jo, payload, nbcols, hp->pairs.build, rows, stride, hp->pairs.probe, hp->pairs.n);
+        return;
+    }
+
+    vecProbeSkew(ht, rows, stride, attr, n, hp->hashes, &hp->pairs, &hp->runs);
+    VecPairs* pairs = &hp->pairs;
+    UINT p = 0;
+    for (UINT r = 0; r < hp->runs.n; r++) {
+
+        // pairs of the rows before the heavy one
+        UINT row = hp->runs.probe[r];
+        UINT q = p;
+        while (q < pairs->n && pairs->probe[q] < row) q++;
+        emitBatch(res, jo, payload, nbcols, pairs->build + p, rows, stride, pairs->probe + p, q - p);
+        p = q;
+
+        UINT first = ht->hfirst[hp->runs.heavy[r]];
+        UINT last = ht->hfirst[hp->runs.heavy[r] + 1];
+        UINT nfill = min(last - first, VEC_SIZE);
+        for (UINT k = 0; k < nfill; k++) hp->fill[k] = row;
+        for (UINT e = first; e < last; e += VEC_SIZE) {
+            emitBatch(res, jo, payload, nbcols, ht->hentries + e, rows, stride, hp->fill, min(last - e, VEC_SIZE));
+        }
+
+    }
+    emitBatch(res, jo, payload, nbcols, pairs->build + p, rows, stride, pairs->probe + p, pairs->n - p);
+
+}
+
+
+// the build side of a hash join probed in parallel: every worker probes the same table, heavy hitter runs
+// included, so a heavy key is joined by whichever worker reads its probe rows
+// page t of a round is task t, its matches go to results[t]
+typedef struct HashShare {
+    exTable* pmeta;
+    UINT probe_idx;
+    const VecHashTable* ht;
+    const INT* payload;
+    UINT nbcols;
+    const JoinOut* jo;
+    const INT* rows; // the probe pages of the round, copied out of the buffer pool in page order
+    const size_t* start; // first attribute of each page in rows
+    const int* ntuples; // rows of each page
+    UINT stride;
+    const RowBuf* res;
+    RowBuf* results;
+    UINT64 probed; // probe rows probed by the tasks
+} HashShare;
+
+
+// SchedTask of the parallel hash join: one probe page of the round, already copied out of the buffer pool,
+// so the workers never touch the pool and the pages are read in the order of the serial join
+static void hashTask(void* ctx, const UINT task, const UINT worker) {
+
+    HashShare* s = ctx;
+    HashProbe* hp = newHashProbe();
+    RowBuf* out = &s->results[task];
+    initTaskResult(out, s->res);
+
+    const INT* rows = s->rows + s->start[task];
+    int ntuples = s->ntuples[task];
+    for (int b = 0; b < ntuples && !rowbufFull(out); b += VEC_SIZE) {
+        hashProbe(out, s->jo, s->ht, s->payload, s->nbcols, s->pmeta->kern,
+            rows + (size_t)b * s->stride, s->stride, s->probe_idx, min(ntuples - b, VEC_SIZE), hp);
+        __sync_fetch_and_add(&s->probed, min(ntuples - b, VEC_SIZE));
+    }
+
+}
+
+
+// heavy keys of a hash join spilling to disk, whose build entries are kept in memory in the skew partition
+// instead of being partitioned: the analyzed most common values and the keys the summary of the build side
+// finds heavy as it is read; the earlier entries of a key found heavy later are on disk, so are those past
+// the memory of the skew partition, and the probe rows of such a key go to both
+#define SKEW_MAXKEYS (VEC_MAXHEAVY + STATS_NMCV)
+#define SKEW_SLOTS 1024
+
+typedef struct SkewSet {
+    UINT n;
+    INT keys[SKEW_MAXKEYS];
+    int ondisk[SKEW_MAXKEYS];
+    int slots[SKEW_SLOTS]; // key of each slot by its hash, -1 if empty
+} SkewSet;
+
+
+static int skewFind(const SkewSet* s, const INT key, const UINT hash) {
+    for (UINT i = hash & (SKEW_SLOTS - 1); s->slots[i] != -1; i = (i + 1) & (SKEW_SLOTS - 1)) {
+        if (s->keys[s->slots[i]] == key) return s->slots[i];
+    }
+    return -1;
+}
+
+
+static void skewAdd(SkewSet* s, const INT key, const int ondisk) {
+    UINT hash;
+    vecHashKeys(&key, 1, 0, 1, &hash);
+    if (s->n == SKEW_MAXKEYS || skewFind(s, key, hash) != -1) return;
+    UINT i = hash & (SKEW_SLOTS - 1);
+    while (s->slots[i] != -1) i = (i + 1) & (SKEW_SLOTS - 1);
+    s->slots[i] = s->n;
+    s->keys[s->n] = key;
+    s->ondisk[s->n] = ondisk;
+    s->n++;
+}
+
+
+// hash join whose build side does not fit the memory left: both sides are partitioned on the hash of the join key
+// into temporary files, then every build partition is hashed in an arena of its own, released after it,
+// and probed with its probe partition; matches come out partition by partition
+// the entries of heavy keys form a skew partition kept in memory, up to half of the memory left, which probe rows
+// of those keys are joined with as they are read; a skewed partition larger than the budget is still joined in memory
+// return -1 if a page cannot be read, 1 if the temporary files cannot be created
+static int graceJoin(exTable* bmeta, const UINT build_idx, const UINT* bcols, const UINT nbcols,
+    exTable* pmeta, const UINT probe_idx, const JoinOut* jo, RowBuf* res) {
+
+    size_t bytes = buildBytes(bmeta->ntuples, nbcols);
+    size_t avail = memAvailable();
+    int bits = 1;
+    while ((1 << bits) < JOIN_MAXPARTS && (bytes >> bits) > avail) bits++;
+    int nparts = 1 << bits;
+
+    FILE* bparts[JOIN_MAXPARTS];
+    FILE* pparts[JOIN_MAXPARTS];
+    UINT bcount[JOIN_MAXPARTS];
+    UINT pcount[JOIN_MAXPARTS];
+    int ok = 1;
+    for (int p = 0; p < nparts; p++) {
+        bparts[p] = tempFile();
+        pparts[p] = tempFile();
+        bcount[p] = 0;
+        pcount[p] = 0;
+        ok &= bparts[p] != NULL && pparts[p] != NULL;
+    }
+    if (!ok) {
+        for (int p = 0; p < nparts; p++) {
+            if (bparts[p] != NULL) fclose(bparts[p]);
+            if (pparts[p] != NULL) fclose(pparts[p]);
+        }
+        return 1;
+    }
+
+    trace("\n... build side of %lu bytes, %lu available: %i partitions ...\n", (unsigned long)bytes, (unsigned long)avail, nparts);
+
+    // an entry is the join key followed by the build attributes of the result
+    UINT ewidth = nbcols + 1;
+    UINT pstride = pmeta->nattrs;
+    INT* entry = arenaAlloc(queryArena(), sizeof(INT) * ewidth);
+    UINT hashes[VEC_SIZE];
+    int failed = 0;
+
+    // heavy keys known before the build side is read
+    SkewSet* skew = arenaAlloc(queryArena(), sizeof(SkewSet));
+    skew->n = 0;
+    memset(skew->slots, 0xFF, sizeof(skew->slots));
+    if (bmeta->stats != NULL) {
+        const ColStats* cs = &bmeta->stats->cols[build_idx];
+        for (UINT m = 0; m < cs->nmcv; m++) {
+            if (cs->mcv_freqs[m] * bmeta->ntuples >= VEC_HEAVY_MIN) skewAdd(skew, cs->mcv_vals[m], 0);
+        }
+    }
+    VecHeavy* hh = arenaAlloc(queryArena(), sizeof(VecHeavy));
+    vecHeavyInit(hh);
+    INT* bkeys = arenaAlloc(queryArena(), sizeof(INT) * VEC_SIZE);
+    RowBuf sk;
+    rowbufInit(&sk, queryArena(), ewidth);
+    UINT skew_max = (UINT)min(avail / 2 / (sizeof(INT) * ewidth + sizeof(UINT) * 6), (size_t)0xFFFFFFF);
+
+    trace("\n... partitioning %s ...\n", bmeta->name);
+    begin_phase(PH_BUILD);
+
+    for (UINT64 i = 0; i < bmeta->npages && !failed; i++) {
+
+        int bid = requestPage(bmeta->name, i);
+        if (bid == -1) {
+            failed = 1;
+            break;
+        }
+        log_examine_tuples(pageBuffer[bid]->ntuples);
+
+        int ntuples = pageBuffer[bid]->ntuples;
+        UINT stride = pageBuffer[bid]->nattrs;
+        for (int b = 0; b < ntuples; b += VEC_SIZE) {
+            INT* rows = pageBuffer[bid]->tuple[b];
+            UINT n = min(ntuples - b, VEC_SIZE);
+            bmeta->kern->hashKeys(rows, stride, build_idx, n, hashes);
+            bmeta->kern->column(rows, stride, build_idx, n, bkeys);
+            for (UINT y = 0; y < n; y++) {
+                const INT* row = rows + (size_t)y * stride;
+                int s = skew->n > 0 ? skewFind(skew, bkeys[y], hashes[y]) : -1;
+                INT* e = entry;
+                if (s != -1 && sk.nrows < skew_max) e = rowbufAppend(&sk);
+                e[0] = bkeys[y];
+                for (UINT k = 0; k < nbcols; k++) e[k + 1] = row[bcols[k]];
+                if (e != entry) continue;
+                if (s != -1) skew->ondisk[s] = 1;
+                int p = hashes[y] >> (32 - bits);
+                fwrite(entry, sizeof(INT), ewidth, bparts[p]);
+                bcount[p]++;
+            }
+
+            // keys turning heavy, their entries so far are on disk
+            INT cand[VEC_MAXHEAVY];
+            sampleKeys(hh, rows, stride, build_idx, n);
+            UINT ncand = vecHeavyKeys(hh, VEC_HEAVY_MIN / HEAVY_SAMPLE, cand);
+            for (UINT c = 0; c < ncand; c++) skewAdd(skew, cand[c], 1);
+        }
+
+        releasePage(bid);
+
+    }
+
+    // hash table of the skew partition
+    INT* skeys = arenaAlloc(queryArena(), sizeof(INT) * (sk.nrows + 1));
+    INT* spayload = arenaAlloc(queryArena(), sizeof(INT) * ((size_t)sk.nrows * nbcols + 1));
+    for (UINT e = 0; e < sk.nrows; e++) {
+        skeys[e] = sk.rows[(size_t)e * ewidth];
+        memcpy(spayload + (size_t)e * nbcols, sk.rows + (size_t)e * ewidth + 1, sizeof(INT) * nbcols);
+    }
+    VecHashTable sht;
+    vecHashInit(&sht);
+    vecHashBuildSkew(&sht, skeys, sk.nrows, skew->keys, skew->n);
+    if (skew->n > 0) trace("%u heavy keys, %lu entries in memory\n", skew->n, (unsigned long)sk.nrows);
+    INT dkeys[SKEW_MAXKEYS];
+    UINT ndkeys = 0;
+    for (UINT k = 0; k < skew->n; k++) {
+        if (skew->ondisk[k]) dkeys[ndkeys++] = skew->keys[k];
+    }
+
+    end_phase(PH_BUILD);
+
+    // probe side, whole rows
+    trace("\n... partitioning %s ...\n", pmeta->name);
+    begin_phase(PH_PROBE);
+
+    HashProbe* hp = newHashProbe();
+    UINT* sel = arenaAlloc(queryArena(), sizeof(UINT) * VEC_SIZE);
+    INT* hrows = arenaAlloc(queryArena(), sizeof(INT) * pstride * VEC_SIZE);
+
+    for (UINT64 i = 0; i < pmeta->npages && !failed; i++) {
+
+        int bid = requestPage(pmeta->name, i);
+        if (bid == -1) {
+            failed = 1;
+            break;
+        }
+        log_examine_tuples(pageBuffer[bid]->ntuples);
+
+        int ntuples = pageBuffer[bid]->ntuples;
+        for (int b = 0; b < ntuples; b += VEC_SIZE) {
+            INT* rows = pageBuffer[bid]->tuple[b];
+            UINT n = min(ntuples - b, VEC_SIZE);
+            UINT nsel = 0;
+            pmeta->kern->hashKeys(rows, pstride, probe_idx, n, hashes);
+            for (UINT y = 0; y < n; y++) {
+                int s = skew->n > 0 ? skewFind(skew, rows[(size_t)y * pstride + probe_idx], hashes[y]) : -1;
+                if (s != -1) sel[nsel++] = y;
+                if (s != -1 && !skew->ondisk[s]) continue;
+                int p = hashes[y] >> (32 - bits);
+                fwrite(rows + (size_t)y * pstride, sizeof(INT), pstride, pparts[p]);
+                pcount[p]++;
+            }
+
+            // rows of heavy keys are joined with the skew partition at once
+            if (nsel > 0 && sk.nrows > 0) {
+                pmeta->kern->gatherRows(rows, pstride, sel, nsel, hrows, pstride);
+                if (jo->trace) trace("results:\n");
+                hashProbe(res, jo, &sht, spayload, nbcols, pmeta->kern, hrows, pstride, probe_idx, nsel, hp);
+            }
+        }
+
+        releasePage(bid);
+
+    }
+
+    // join partition by partition, queryArena() is the arena of the partition meanwhile
+    trace("\n... joining partitions, computing result tuples ...\n");
+    Arena part;
+    arenaInit(&part, ARENA_CHUNK);
+    setThreadArena(&part);
+
+    for (int p = 0; p < nparts && !failed; p++) {
+
+        log_spill_tuples(bcount[p] + pcount[p]);
+        if (bcount[p] == 0 || pcount[p] == 0) continue;
+        arenaReset(&part);
+        hp->pairs = (VecPairs){0, 0, NULL, NULL};
+
+        // keys and build attributes of the entries in separate blocks, as in memory
+        INT* keys = arenaAlloc(&part, sizeof(INT) * bcount[p]);
+        INT* payload = arenaAlloc(&part, sizeof(INT) * ((size_t)bcount[p] * nbcols + 1));
+        rewind(bparts[p]);
+        for (UINT e = 0; e < bcount[p] && !failed; e++) {
+            failed = fread(entry, sizeof(INT), ewidth, bparts[p]) != ewidth;
+            keys[e] = entry[0];
+            memcpy(payload + (size_t)e * nbcols, entry + 1, sizeof(INT) * nbcols);
+        }
+
+        // the heavy keys with entries on disk are counted again, those with enough in the partition kept apart
+        VecHashTable ht;
+        vecHashInit(&ht);
+        vecHashBuildSkew(&ht, keys, bcount[p], dkeys, ndkeys);
+        if (ht.nheavy > 0) trace("%u heavy hitters, %u of %u entries\n", ht.nheavy, ht.hfirst[ht.nheavy], bcount[p]);
+
+        if (jo->trace) trace("results:\n");
+
+        INT* rows = arenaAlloc(&part, sizeof(INT) * pstride * VEC_SIZE);
+        rewind(pparts[p]);
+        for (UINT b = 0; b < pcount[p] && !failed; b += VEC_SIZE) {
+            UINT n = min(pcount[p] - b, VEC_SIZE);
+            failed = fread(rows, sizeof(INT) * pstride, n, pparts[p]) != n;
+            hashProbe(res, jo, &ht, payload, nbcols, pmeta->kern, rows, pstride, probe_idx, n, hp);
+        }
+
+    }
+
+    setThreadArena(NULL);
+    arenaFree(&part);
+
+    for (int p = 0; p < nparts; p++) {
+        fclose(bparts[p]);
+        fclose(pparts[p]);
+    }
+
+    trace("\n... finished computing result tuples ...\n");
+    end_phase(PH_PROBE);
+
+    return failed ? -1 : 0;
+
+}
+
+
+// radix partitioning of an in-memory hash join: the build entries and chunks of probe rows are split on the top
+// bits of the hash of the join key, so the hash table of a partition fits the L2 cache while its probe rows go
+// through it; the hash tables themselves bucket on the low bits
+// a pass writes at most 1 << RADIX_BITS partitions, whose write-combining buffers stay in the L1 cache,
+// and a second pass splits each partition again
+#define RADIX_BITS 7
+#define RADIX_MAXBITS (2 * RADIX_BITS)
+#define RADIX_WCB 8 // rows gathered per partition before they are copied out together
+#define RADIX_CHUNK (1 << 20) // probe rows partitioned at a time
+
+// copy n rows of width attributes from rows to out stably, partitioned on bits [shift, shift + bits) of the hash
+// of attribute attr counted from the top; partition p is rows first[p] to first[p + 1] - 1 of out
+// the partition of every row is kept in pids between the histogram and the scatter; every row is written to the
+// buffer of its partition and a full buffer is copied out at once, so the scatter writes runs of rows to a few
+// cache lines at a time instead of touching a page per row
+static void radixScatter(const INT* rows, const UINT width, const UINT attr, const UINT n, const int shift, const int bits,
+    INT* out, UINT* first, INT* wcb, uint8_t* pids) {
+
+    const VecKernels* kern = vecKernels(width);
+    const UINT nparts = 1u << bits;
+    const int down = 32 - shift - bits;
+    const size_t rbytes = sizeof(INT) * width;
+    UINT hashes[VEC_SIZE];
+    UINT fill[1 << RADIX_BITS];
+    UINT next[1 << RADIX_BITS];
+
+    memset(first, 0, sizeof(UINT) * (nparts + 1));
+    for (UINT b = 0; b < n; b += VEC_SIZE) {
+        UINT m = min(n - b, VEC_SIZE);
+        kern->hashKeys(rows + (size_t)b * width, width, attr, m, hashes);
+        for (UINT y = 0; y < m; y++) {
+            pids[b + y] = (hashes[y] >> down) & (nparts - 1);
+            first[pids[b + y] + 1]++;
+        }
+    }
+    for (UINT p = 0; p < nparts; p++) {
+        first[p + 1] += first[p];
+        next[p] = first[p];
+        fill[p] = 0;
+    }
+
+    for (UINT y = 0; y < n; y++) {
+        UINT p = pids[y];
+        INT* buf = wcb + (size_t)p * RADIX_WCB * width;
+        memcpy(buf + (size_t)fill[p] * width, rows + (size_t)y * width, rbytes);
+        if (++fill[p] < RADIX_WCB) continue;
+        memcpy(out + (size_t)next[p] * width, buf, rbytes * RADIX_WCB);
+        next[p] += RADIX_WCB;
+        fill[p] = 0;
+    }
+    for (UINT p = 0; p < nparts; p++) {
+        if (fill[p] > 0) memcpy(out + (size_t)next[p] * width, wcb + (size_t)p * RADIX_WCB * width, rbytes * fill[p]);
+    }
+
+}
+
+
+// partition n rows of width attributes on the top bits of the hash of attribute attr, in one pass or in two
+// of up to RADIX_BITS each, between rows and tmp; return the one holding the partitions, partition p being
+// rows first[p] to first[p + 1] - 1 of it; wcb and pids are the scratch of radixScatter()
+static INT* radixPartition(INT* rows, INT* tmp, const UINT width, const UINT attr, const UINT n, const int bits, UINT* first,
+    INT* wcb, uint8_t* pids) {
+
+    if (bits == 0) {
+        first[0] = 0;
+        first[1] = n;
+        return rows;
+    }
+
+    int bits1 = min(bits, RADIX_BITS);
+    int bits2 = bits - bits1;
+    if (bits2 == 0) {
+        radixScatter(rows, width, attr, n, 0, bits1, tmp, first, wcb, pids);
+        return tmp;
+    }
+
+    // the second pass splits every partition of the first back into rows
+    UINT first1[(1 << RADIX_BITS) + 1];
+    UINT first2[(1 << RADIX_BITS) + 1];
+    UINT nparts2 = 1u << bits2;
+    radixScatter(rows, width, attr, n, 0, bits1, tmp, first1, wcb, pids);
+    for (UINT p = 0; p < (1u << bits1); p++) {
+        UINT base = first1[p];
+        radixScatter(tmp + (size_t)base * width, width, attr, first1[p + 1] - base, bits1, bits2,
+            rows + (size_t)base * width, first2, wcb, pids);
+        for (UINT q = 0; q < nparts2; q++) first[p * nparts2 + q] = base + first2[q];
+    }
+    first[1u << bits] = n;
+    return rows;
+
+}
+
+
+// bytes of a radix join: the entries twice, then split into keys and payload, the hash tables,
+// a chunk of probe rows twice and the partition of every row
+static size_t radixBytes(exTable* bmeta, const UINT nbcols, exTable* pmeta) {
+    UINT64 chunk = min(pmeta->ntuples, RADIX_CHUNK);
+    return buildBytes(bmeta->ntuples, nbcols) + bmeta->ntuples * (sizeof(INT) * (nbcols + 1) * 2 + 1) +
+        chunk * (sizeof(INT) * pmeta->nattrs * 2 + 1);
+}
+
+
+// probe side of a radix join in parallel: a chunk of partitioned probe rows, task t joins partitions
+// [first[t], first[t + 1]) with their hash tables, its matches go to results[t]
+typedef struct RadixShare {
+    const VecHashTable* tables;
+    const INT* payload;
+    const UINT* bfirst;
+    UINT nbcols;
+    const INT* rows;
+    const UINT* pfirst;
+    UINT pstride;
+    UINT probe_idx;
+    const VecKernels* kern;
+    const JoinOut* jo;
+    UINT* first;
+    const RowBuf* res;
+    RowBuf* results;
+} RadixShare;
+
+
+static void radixProbe(RowBuf* res, const RadixShare* s, const UINT p, HashProbe* hp) {
+    UINT n = s->pfirst[p + 1] - s->pfirst[p];
+    if (n == 0 || s->bfirst[p + 1] == s->bfirst[p]) return;
+    const INT* rows = s->rows + (size_t)s->pfirst[p] * s->pstride;
+    const INT* payload = s->payload + (size_t)s->bfirst[p] * s->nbcols;
+    if (s->jo->trace) trace("results:\n");
+    for (UINT b = 0; b < n; b += VEC_SIZE) {
+        hashProbe(res, s->jo, &s->tables[p], payload, s->nbcols, s->kern, rows + (size_t)b * s->pstride, s->pstride,
+            s->probe_idx, min(n - b, VEC_SIZE), hp);
+    }
+}
+
+
+// SchedTask of the parallel radix join: a range of partitions of the chunk
+static void radixTask(void* ctx, const UINT task, const UINT worker) {
+    RadixShare* s = ctx;
+    HashProbe* hp = newHashProbe();
+    RowBuf* out = &s->results[task];
+    initTaskResult(out, s->res);
+    for (UINT p = s->first[task]; p < s->first[task + 1] && !rowbufFull(out); p++) radixProbe(out, s, p, hp);
+}
+
+
+// hash join in memory over radix partitions: the entries of the build side are partitioned, split into keys and
+// payload as in the join without partitions, and a hash table is built per partition; the probe side is read
+// a chunk of RADIX_CHUNK rows at a time, partitioned the same way, and every partition of the chunk probes its
+// own table, which stays in the cache; matches come out chunk by chunk and partition by partition
+// heavy hitters are sampled over the whole build side and kept apart in the table of their partition
+// return -1 if a page cannot be read
+static int radixJoin(exTable* bmeta, const UINT build_idx, const UINT* bcols, const UINT nbcols,
+    exTable* pmeta, const UINT probe_idx, const JoinOut* jo, RowBuf* res) {
+
+    Conf* conf = get_conf();
+    Arena* a = queryArena();
+    const UINT ewidth = nbcols + 1;
+    const UINT pstride = pmeta->nattrs;
+
+    // partitions of at most radix_part bytes
+    int bits = 0;
+    while (bits < RADIX_MAXBITS && buildBytes(bmeta->ntuples >> bits, nbcols) > conf->radix_part) bits++;
+    UINT nparts = 1u << bits;
+    UINT chunk = (UINT)min(pmeta->ntuples, RADIX_CHUNK);
+    INT* wcb = arenaAlloc(a, sizeof(INT) * (1 << min(bits, RADIX_BITS)) * RADIX_WCB * max(ewidth, pstride));
+    uint8_t* pids = arenaAlloc(a, max(bmeta->ntuples, chunk) + 1);
+
+    trace("\n... radix join, %u partitions in %i pass(es) ...\n", nparts, bits > RADIX_BITS ? 2 : 1);
+    trace("\n... hashing %s ...\n", bmeta->name);
+    begin_phase(PH_BUILD);
+
+    // entries of the join key followed by the build attributes of the result
+    INT* entries = arenaAlloc(a, sizeof(INT) * ((size_t)bmeta->ntuples * ewidth + 1));
+    INT* tmp = arenaAlloc(a, sizeof(INT) * ((size_t)bmeta->ntuples * ewidth + 1));
+    VecHeavy* hh = arenaAlloc(a, sizeof(VecHeavy));
+    vecHeavyInit(hh);
+    UINT nentries = 0;
+
+    for (UINT64 i = 0; i < bmeta->npages; i++) {
+
+        int bid = requestPage(bmeta->name, i);
+        if (bid == -1) return -1;
+        log_examine_tuples(pageBuffer[bid]->ntuples);
+
+        int ntuples = pageBuffer[bid]->ntuples;
+        UINT stride = pageBuffer[bid]->nattrs;
+        const INT* rows = ntuples > 0 ? pageBuffer[bid]->tuple[0] : NULL;
+        if (ntuples > 0) sampleKeys(hh, rows, stride, build_idx, ntuples);
+        for (int y = 0; y < ntuples; y++) {
+            INT* e = entries + (size_t)(nentries + y) * ewidth;
+            const INT* row = rows + (size_t)y * stride;
+            e[0] = row[build_idx];
+            for (UINT k = 0; k < nbcols; k++) e[k + 1] = row[bcols[k]];
+        }
+        nentries += ntuples;
+
+        releasePage(bid);
+
+    }
+
+    UINT* bfirst = arenaAlloc(a, sizeof(UINT) * (nparts + 1));
+    INT* parts = radixPartition(entries, tmp, ewidth, 0, nentries, bits, bfirst, wcb, pids);
+    INT* keys = arenaAlloc(a, sizeof(INT) * (nentries + 1));
+    INT* payload = parts == entries ? tmp : entries;
+    for (UINT e = 0; e < nentries; e++) {
+        keys[e] = parts[(size_t)e * ewidth];
+        memcpy(payload + (size_t)e * nbcols, parts + (size_t)e * ewidth + 1, sizeof(INT) * nbcols);
+    }
+
+    // the heavy hitter candidates in order of their partition, each table counts its own
+    INT cand[VEC_MAXHEAVY];
+    UINT chash[VEC_MAXHEAVY];
+    UINT ncand = vecHeavyKeys(hh, VEC_HEAVY_MIN / HEAVY_SAMPLE, cand);
+    UINT cpart[VEC_MAXHEAVY];
+    vecHashKeys(cand, 1, 0, ncand, chash);
+    for (UINT c = 0; c < ncand; c++) cpart[c] = bits > 0 ? chash[c] >> (32 - bits) : 0;
+    for (UINT c = 1; c < ncand; c++) {
+        for (UINT d = c; d > 0 && cpart[d - 1] > cpart[d]; d--) {
+            INT k = cand[d];
+            cand[d] = cand[d - 1];
+            cand[d - 1] = k;
+            UINT q = cpart[d];
+            cpart[d] = cpart[d - 1];
+            cpart[d - 1] = q;
+        }
+    }
+
+    VecHashTable* tables = arenaAlloc(a, sizeof(VecHashTable) * nparts);
+    UINT nheavy = 0;
+    UINT c = 0;
+    for (UINT p = 0; p < nparts; p++) {
+        UINT c0 = c;
+        while (c < ncand && cpart[c] == p) c++;
+        vecHashInit(&tables[p]);
+        if (bfirst[p + 1] == bfirst[p]) continue;
+        vecHashBuildSkew(&tables[p], keys + bfirst[p], bfirst[p + 1] - bfirst[p], cand + c0, c - c0);
+        nheavy += tables[p].nheavy;
+    }
+    if (nheavy > 0) trace("%u heavy hitters\n", nheavy);
+
+    trace("\n... finished hashing %s ...\n", bmeta->name);
+    end_phase(PH_BUILD);
+
+    trace("\n... scanning %s, computing result tuples ...\n", pmeta->name);
+    begin_phase(PH_PROBE);
+
+    // with more than one worker every chunk is split into tasks of consecutive partitions, whose rows are
+    // merged in task order, the order of the serial join
+    INT* prows = arenaAlloc(a, sizeof(INT) * ((size_t)chunk * pstride + 1));
+    INT* ptmp = arenaAlloc(a, sizeof(INT) * ((size_t)chunk * pstride + 1));
+    UINT* pfirst = arenaAlloc(a, sizeof(UINT) * (nparts + 1));
+    int nworkers = min((int)conf->threads, (int)nparts);
+    int ntasks = min((int)nparts, nworkers * SCHED_SPLIT);
+    JoinOut tjo = *jo;
+    tjo.trace = 0;
+
+    RadixShare s;
+    s.tables = tables;
+    s.payload = payload;
+    s.bfirst = bfirst;
+    s.nbcols = nbcols;
+    s.pfirst = pfirst;
+    s.pstride = pstride;
+    s.probe_idx = probe_idx;
+    s.kern = pmeta->kern;
+    s.jo = nworkers > 1 ? &tjo : jo;
+    s.first = arenaAlloc(a, sizeof(UINT) * (ntasks + 1));
+    for (int t = 0; t <= ntasks; t++) s.first[t] = (UINT)((UINT64)nparts * t / ntasks);
+    s.res = res;
+    s.results = arenaAlloc(a, sizeof(RowBuf) * ntasks);
+    if (nworkers > 1) trace("%i workers, %i tasks\n", nworkers, ntasks);
+    HashProbe* hp = newHashProbe();
+
+    UINT64 i = 0;
+    int y = 0; // first row of page i not yet in a chunk
+    while (i < pmeta->npages) {
+
+        // fill a chunk, a page may be split between two
+        UINT n = 0;
+        while (i < pmeta->npages && n < chunk) {
+            int bid = requestPage(pmeta->name, i);
+            if (bid == -1) return -1;
+            int ntuples = pageBuffer[bid]->ntuples;
+            if (y == 0) log_examine_tuples(ntuples);
+            UINT m = min((UINT)(ntuples - y), chunk - n);
+            if (m > 0) memcpy(prows + (size_t)n * pstride, pageBuffer[bid]->tuple[y], sizeof(INT) * m * pstride);
+            n += m;
+            y += m;
+            if (y == ntuples) {
+                i++;
+                y = 0;
+            }
+            releasePage(bid);
+        }
+
+        s.rows = radixPartition(prows, ptmp, pstride, probe_idx, n, bits, pfirst, wcb, pids);
+        if (nworkers > 1) {
+            schedRun(nworkers, ntasks, radixTask, &s);
+            mergeResults(res, s.results, ntasks);
+        } else {
+            for (UINT p = 0; p < nparts; p++) radixProbe(res, &s, p, hp);
+        }
+
+    }
+
+    trace("\n... finished computing result tuples ...\n");
+    end_phase(PH_PROBE);
+
+    return 0;
+
+}
+
+_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name) {
+    return joinProj(idx1, table1_name, idx2, table2_name, NULL);
+}
+
+
+_Table* joinProj(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name, const Projection* proj) {
+
+    // invoke log_read_page() every time a page is read from the hard drive.
+    // invoke log_release_page() every time a page is released from the memory.
+
+    // invoke log_open_file() every time a page is read from the hard drive.
+    // invoke log_close_file() every time a page is released from the memory.
+
+    trace("\njoin() is invoked.\n");
+    trace("\nJOIN\nidx1: %u | table1_name: %s | idx2: %u | table2_name: %s\n", idx1, table1_name, idx2, table2_name); 
+
+    // get table meta
+    exTable* tmeta1 = getTableMeta(table1_name);
+    exTable* tmeta2 = getTableMeta(table2_name);
+    if (tmeta1 == NULL || tmeta2 == NULL || checkProj(proj, tmeta1->nattrs + tmeta2->nattrs) == -1) return NULL;
+
+    begin_phase(PH_PLAN);
+    Plan plan;
+    planJoin(idx1, table1_name, idx2, table2_name, &plan);
+    end_phase(PH_PLAN);
+
+    memOperator(MEM_JOIN);
+    JoinOut jo;
+    initJoinOut(&jo, proj, tmeta1->nattrs, tmeta2->nattrs, plan.swapped);
+    
+    // result rows, built in place in the query arena, spilled past the memory budget
+    RowBuf res;
+    rowbufInit(&res, queryArena(), jo.width);
+    rowbufStream(&res, querySink());
+    rowbufSpill(&res);
+    rowbufLimit(&res, queryLimit());
+
+    // naive nested loop join
+    if (plan.method == PLAN_BNL) {
+
+        trace("\nBLOCK NESTED LOOP JOIN\n");
+
+        UINT64 outer_npages = getTableMeta(plan.outer)->npages;
+        UINT64 inner_npages = getTableMeta(plan.inner)->npages;
+        char* outer_tname = plan.outer;
+
+        // every inner page is hashed on its join key and probed with the outer tuples of the chunk,
+        // whose hashes are computed once per chunk, matches keep the nested loop order
+        BNLChunk c;
+        c.inner_tname = plan.inner;
+        c.outer_idx = plan.outer_idx;
+        c.inner_idx = plan.inner_idx;
+        c.okern = getTableMeta(plan.outer)->kern;
+        c.ikern = getTableMeta(plan.inner)->kern;
+        c.jo = &jo;
+        BNLWorker w;
+        initBNLWorker(&w);
+        UINT* ohashes = NULL;
+        UINT ohashes_cap = 0;
+
+        // with more than one worker the inner pages of a chunk are split into tasks of consecutive pages,
+        // whose rows are merged in task order, the order of the serial join
+        int64_t nchunks = plan.nchunks;
+        int csize = conf->buf_slots - 1;
+        int nworkers = (int)min((UINT64)conf->threads, inner_npages);
+        int ntasks = (int)min(inner_npages, (UINT64)nworkers * SCHED_SPLIT);
+        JoinOut tjo = jo;
+        tjo.trace = 0;
+        c.copy = nworkers > 1;
+        if (nworkers > 1) {
+            trace("%i workers, %i tasks per chunk\n", nworkers, ntasks);
+            c.first = arenaAlloc(queryArena(), sizeof(UINT64) * (ntasks + 1));
+            for (int t = 0; t <= ntasks; t++) c.first[t] = inner_npages * t / ntasks;
+            c.res = &res;
+            c.results = arenaAlloc(queryArena(), sizeof(RowBuf) * ntasks);
+            c.jo = &tjo;
+        }
+
+        // number of outer page to read in chunk
+        int outer_nPiC = (int)min(outer_npages, (UINT64)csize);
+
+        // bids of the pages of the outer chunk being processed and the offsets of their hashes, for the largest chunk
+        int* outerL = arenaAlloc(queryArena(), sizeof(int) * (outer_nPiC + 1));
+        UINT* ohash_off = arenaAlloc(queryArena(), sizeof(UINT) * (outer_nPiC + 1));
+
+        // for each outer chunk, the join stops once the rows of a limit are found
+        for (int64_t i = 0; i < nchunks && !rowbufFull(&res); i++) { 
+
+            // read a chunk of outer page
+            begin_phase(PH_BUILD);
+            trace("\n... reading %ld/%ld outer chunk (outer_nPiC: %i) ...\n", (long)i+1, (long)nchunks, outer_nPiC);
+            ohash_off[0] = 0;
+            for (int j = 0; j < outer_nPiC; j++) { 
+                outerL[j] = requestPage(outer_tname, (UINT64)i * csize + j);
+                if (outerL[j] == -1) return NULL;
+                log_examine_tuples(pageBuffer[outerL[j]]->ntuples);
+                ohash_off[j + 1] = ohash_off[j] + pageBuffer[outerL[j]]->ntuples;
+            }
+            if (ohash_off[outer_nPiC] > ohashes_cap) {
+                ohashes = arenaRealloc(queryArena(), ohashes, sizeof(UINT) * ohashes_cap, sizeof(UINT) * ohash_off[outer_nPiC]);
+                ohashes_cap = ohash_off[outer_nPiC];
+            }
+            for (int j = 0; j < outer_nPiC; j++) {
+                PageDesc* op = pageBuffer[outerL[j]];
+                if (op->ntuples > 0) c.okern->hashKeys(op->tuple[0], op->nattrs, c.outer_idx, op->ntuples, ohashes + ohash_off[j]);
+            }
+            c.npages = outer_nPiC;
+            c.bids = outerL;
+            c.ohashes = ohashes;
+            c.ohash_off = ohash_off;
+            trace("\n... finished reading %ld/%ld outer chunk ...\n", (long)i+1, (long)nchunks);
+            end_phase(PH_BUILD);
+            begin_phase(PH_PROBE);
+
+            trace("\n... reading inner pages, computing result tuples ...\n");
+
+            if (nworkers <= 1) {
+                // for each inner page
+                for (UINT64 k = 0; k < inner_npages && !rowbufFull(&res); k++) {
+                    if (bnlPage(&c, &w, &res, k) == -1) return NULL;
+                }
+            } else {
+                c.failed = 0;
+                schedRun(nworkers, ntasks, bnlTask, &c);
+                if (c.failed) {
+                    releaseResults(c.results, ntasks);
+                    return NULL;
+                }
+                mergeResults(&res, c.results, ntasks);
+            }
+
+            //release all outer pages in chunk
+            for (int p = 0; p < outer_nPiC; p++) {
+                releasePage(outerL[p]);
+            }
+
+            trace("\n... finished computing result tuples ...\n");
+            end_phase(PH_PROBE);
+
+            // recompute number of pages to read in next chunk
+            if (i + 1 < nchunks) outer_nPiC = (int)min(outer_npages - (UINT64)csize * (i + 1), (UINT64)csize);
+
+        }
+
+        
+    // index nested loop join
+    } else if (plan.method == PLAN_INL) {
+
+        trace("\nINDEX NESTED LOOP JOIN\n");
+
+        exTable* ometa = getTableMeta(plan.outer);
+        exIndex* ix = getIndex(plan.inner, plan.inner_idx);
+        trace("%s as outer, index %s on %s as inner\n", ometa->name, ix->meta.name, plan.inner);
+
+        INLContext ctx;
+        ctx.res = &res;
+        ctx.jo = &jo;
+
+        begin_phase(PH_PROBE);
+
+        // for each page in outer table, until the rows of a limit are found
+        for (UINT64 i = 0; i < ometa->npages && !rowbufFull(&res); i++) {
+
+            int bid = requestPage(ometa->name, i);
             if (bid == -1) return NULL;
+            log_examine_tuples(pageBuffer[bid]->ntuples);
+
+            trace("results:\n");
+
+            // probe the index once per outer tuple
+            for (int y = 0; y < pageBuffer[bid]->ntuples && !rowbufFull(&res); y++) {
+                ctx.outer = pageBuffer[bid]->tuple[y];
+                indexProbe(ix, ctx.outer[plan.outer_idx], emitINL, &ctx);
+            }
+
+            // release page
+            releasePage(bid);
+
+        }
+
+        trace("\n... finished computing result tuples ...\n");
+        end_phase(PH_PROBE);
 
-            printf("results:\n");
+    // simple hash join
+    } else {
+
+        trace("\nSIMPLE HASH JOIN\n");
+
+        // the build side is table1 unless the planner swapped it
+        exTable* bmeta = getTableMeta(plan.outer);
+        exTable* pmeta = getTableMeta(plan.inner);
+        int build_idx = plan.outer_idx;
+        int probe_idx = plan.inner_idx;
+        trace("%s as outer, %s as inner\n", plan.swapped ? "table2" : "table1", plan.swapped ? "table1" : "table2");
+
+        // an entry holds the join key and the build attributes of the result, each once
+        // result attributes of the build side are remapped to their place in the entry
+        UINT* bcols = arenaAlloc(queryArena(), sizeof(UINT) * (jo.width + 1));
+        UINT nbcols = 0;
+        for (UINT x = 0; x < jo.width; x++) {
+            if (!jo.outer[x]) continue;
+            UINT k = 0;
+            while (k < nbcols && bcols[k] != jo.pos[x]) k++;
+            if (k == nbcols) bcols[nbcols++] = jo.pos[x];
+            jo.pos[x] = k;
+        }
+
+        // a build side past the memory left is partitioned to disk, the join stays in memory
+        // if the temporary files cannot be created
+        int spilled = buildBytes(bmeta->ntuples, nbcols) > memAvailable() ?
+            graceJoin(bmeta, build_idx, bcols, nbcols, pmeta, probe_idx, &jo, &res) : 1;
+
+        // radix partitions in memory if the planner chose them and they fit the memory left,
+        // not under a limit: every probe row is read before the first partition is probed
+        if (spilled == 1 && plan.method == PLAN_RADIX && res.limit == NO_LIMIT && radixBytes(bmeta, nbcols, pmeta) <= memAvailable()) {
+            spilled = radixJoin(bmeta, build_idx, bcols, nbcols, pmeta, probe_idx, &jo, &res);
+        }
+        if (spilled == -1) return NULL;
+
+        // probe rows read, fewer than the whole probe side if a limit is met first
+        UINT64 probed = pmeta->ntuples;
+
+        if (spilled == 1) {
+
+            // build side, keys and projected attributes of the entries in separate blocks
+            // both are temporary, allocated in the query arena and released with it
+            UINT nentries = 0;
+            INT* keys = arenaAlloc(queryArena(), sizeof(INT) * (bmeta->ntuples + 1));
+            INT* payload = arenaAlloc(queryArena(), sizeof(INT) * (bmeta->ntuples * nbcols + 1));
+
+            // heavy hitters of the build keys, sampled as they are copied
+            VecHeavy* hh = arenaAlloc(queryArena(), sizeof(VecHeavy));
+            vecHeavyInit(hh);
+
+            // scan through each page in outer table, copy every tuple into the entries
+            trace("\n... hashing %s ...\n", bmeta->name);
+            begin_phase(PH_BUILD);
+
+            // for each page in table
+            for (UINT64 i = 0; i < bmeta->npages; i++) { 
             
-            // for each tuples in page
-            for (int y = 0; y < pageBuffer[bid]->ntuples; y++) { 
-                
-                // check divisibility on join attrs, derive hash parition to check
-                int prt = hash(pageBuffer[bid]->tuple[y][idx2]);
-
-                // for each entry in hash, in corresponse to the derived hash parition
-                for (int h = 0; h < nEiP[prt]; h++) { 
-
-                    // do comparison, join test
-                    if (pageBuffer[bid]->tuple[y][idx2] == hashtable[prt][h][idx1]) {
-                        
-                        // store result tuple to temp
-                        // do not need to reverse print order since table1 is always outer
-                        int ox = 0;
-
-                        for (ox = 0; ox < tmeta1->nattrs; ox++) {
-                            printf("%i ", hashtable[prt][h][ox]);
-                            temp[res_ntuples][ox] = hashtable[prt][h][ox];
-                        }
+                // request page
+                int bid = requestPage(bmeta->name, i);
+                if (bid == -1) return NULL;
+                log_examine_tuples(pageBuffer[bid]->ntuples);
+
+                int ntuples = pageBuffer[bid]->ntuples;
+                UINT stride = pageBuffer[bid]->nattrs;
+                INT* rows = ntuples > 0 ? pageBuffer[bid]->tuple[0] : NULL;
+            
+                bmeta->kern->column(rows, stride, build_idx, ntuples, keys + nentries);
+                if (ntuples > 0) sampleKeys(hh, rows, stride, build_idx, ntuples);
+                if (jo.whole) {
+                    if (ntuples > 0) memcpy(payload + (size_t)nentries * nbcols, rows, sizeof(INT) * ntuples * nbcols);
+                } else {
+                    for (int y = 0; y < ntuples; y++) {
+                        INT* entry = payload + (size_t)(nentries + y) * nbcols;
+                        for (UINT k = 0; k < nbcols; k++) entry[k] = rows[(size_t)y * stride + bcols[k]];
+                    }
+                }
+                nentries += ntuples;
+
+                // release page
+                releasePage(bid);
+
+            }
 
-                        for (int ix = 0; ix < tmeta2->nattrs; ix++) {
-                            printf("%i ", pageBuffer[bid]->tuple[y][ix]);
-                            temp[res_ntuples][ox+ix] = pageBuffer[bid]->tuple[y][ix];
+            // chained hash table over the keys, with the entries of heavy hitters in runs
+            VecHashTable ht;
+            vecHashInit(&ht);
+            skewBuild(&ht, hh, keys, nentries);
+
+            trace("\n... finished hashing %s ...\n", bmeta->name);
+            end_phase(PH_BUILD);
+
+            // probe side, inner table
+            // scan through each page in inner table, a batch of tuples at a time:
+            // hash the keys, collect the matching entries, then gather the result attributes
+            trace("\n... scanning %s, computing result tuples ...\n", pmeta->name);
+            begin_phase(PH_PROBE);
+
+            // with more than one worker the probe side is read in rounds of consecutive pages, requested in page
+            // order and copied out of the buffer pool, so read_io and the pages left buffered are those of the
+            // serial join; each page of a round is a task, and the rows are merged in page order
+            // under a limit a round holds one page per worker, and no round starts once its rows are found
+            int nworkers = (int)min((UINT64)conf->threads, pmeta->npages);
+            if (nworkers > 1) {
+
+                int round = res.limit == NO_LIMIT ? nworkers * SCHED_SPLIT : nworkers;
+                trace("%i workers, rounds of %i pages\n", nworkers, round);
+                JoinOut tjo = jo;
+                tjo.trace = 0;
+                HashShare s;
+                s.pmeta = pmeta;
+                s.probe_idx = probe_idx;
+                s.ht = &ht;
+                s.payload = payload;
+                s.nbcols = nbcols;
+                s.jo = &tjo;
+                s.stride = pmeta->nattrs;
+                s.res = &res;
+                s.probed = 0;
+                INT* rows = NULL;
+                size_t rows_cap = 0;
+                size_t* start = arenaAlloc(queryArena(), sizeof(size_t) * round);
+                int* ntuples = arenaAlloc(queryArena(), sizeof(int) * round);
+                s.results = arenaAlloc(queryArena(), sizeof(RowBuf) * round);
+
+                for (UINT64 i = 0; i < pmeta->npages && !rowbufFull(&res); ) {
+                    int n = (int)min((UINT64)round, pmeta->npages - i);
+                    size_t used = 0;
+                    for (int k = 0; k < n; k++) {
+                        int bid = requestPage(pmeta->name, i + k);
+                        if (bid == -1) return NULL;
+                        log_examine_tuples(pageBuffer[bid]->ntuples);
+                        ntuples[k] = pageBuffer[bid]->ntuples;
+                        start[k] = used;
+                        size_t len = (size_t)ntuples[k] * s.stride;
+                        if (used + len > rows_cap) {
+                            size_t cap = max(used + len, 2 * rows_cap);
+                            rows = arenaRealloc(queryArena(), rows, sizeof(INT) * rows_cap, sizeof(INT) * cap);
+                            rows_cap = cap;
                         }
+                        if (len > 0) memcpy(rows + used, pageBuffer[bid]->tuple[0], sizeof(INT) * len);
+                        used += len;
+                        releasePage(bid);
+                    }
+                    s.rows = rows;
+                    s.start = start;
+                    s.ntuples = ntuples;
+                    schedRun(nworkers, n, hashTask, &s);
+                    mergeResults(&res, s.results, n);
+                    i += n;
+                }
+                probed = s.probed;
 
-                        printf("\n");
-                        res_ntuples++;
+            } else {
 
+                HashProbe* hp = newHashProbe();
+                probed = 0;
+
+                // for each page in table, until the rows of a limit are found
+                for (UINT64 i = 0; i < pmeta->npages && !rowbufFull(&res); i++) { 
+                
+                    // request page
+                    int bid = requestPage(pmeta->name, i); 
+                    if (bid == -1) return NULL;
+                    log_examine_tuples(pageBuffer[bid]->ntuples);
+
+                    trace("results:\n");
+
+                    int ntuples = pageBuffer[bid]->ntuples;
+                    UINT stride = pageBuffer[bid]->nattrs;
+                
+                    for (int b = 0; b < ntuples && !rowbufFull(&res); b += VEC_SIZE) {
+                        hashProbe(&res, &jo, &ht, payload, nbcols, pmeta->kern, pageBuffer[bid]->tuple[b], stride, probe_idx,
+                            min(ntuples - b, VEC_SIZE), hp);
+                        probed += min(ntuples - b, VEC_SIZE);
                     }
 
+                    // release page
+                    releasePage(bid);
+
                 }
 
             }
 
-            // release page
-            releasePage(bid);
+            trace("\n... finished computing result tuples ...\n");
+            end_phase(PH_PROBE);
 
         }
 
-        printf("\n... finished computing result tuples ...\n");
+        // probe throughput, over the time of the probe phase
+        log_probe_tuples(probed);
+        trace("probe: %lu rows, %.2f Mrows/s\n", (unsigned long)probed,
+            probed * 1e3 / max(get_stats()->phase_ns[PH_PROBE], 1));
 
     }
 
-    printf("\nres_ntuples: %i\n", res_ntuples);
+    trace("\nres_ntuples: %lu\n", (unsigned long)res.nrows);
+
+    begin_phase(PH_MATERIALIZE);
 
     // compose result table
-    _Table* result = malloc(sizeof(_Table) + res_ntuples * sizeof(Tuple));
-    result->nattrs = tmeta1->nattrs + tmeta2->nattrs;
-    result->ntuples = res_ntuples;
+    _Table* result = rowbufTable(&res);
 
-    for (int i = 0; i < result->ntuples; i++) {
-        Tuple t = malloc(sizeof(INT) * result->nattrs);
-        result->tuples[i] = t;
-        for (int j = 0; j < result->nattrs; j++) {
-            t[j] = temp[i][j];
-        }
-    }
+    log_emit_tuples(result->ntuples);
+    end_phase(PH_MATERIALIZE);
 
-    printf("\n====================\n");
+    trace("\n====================\n");
     printPageBuffer();
-    printf("====================\n");
+    trace("====================\n");
     printFileBuffer();
-    printf("====================\n");
+    trace("====================\n");
 
     return result;
 
@@ -837,44 +2808,44 @@ _Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const ch
 
 
 void printPageBuffer() {
-    printf("PAGE BUFFER\n\n");
+    trace("PAGE BUFFER\n\n");
     for (int q = 0; q < conf->buf_slots; q++) {
-        printf("#%i\n", q);
-        printf("isempty: %u\n", pageBuffer[q]->isempty);
+        trace("#%i\n", q);
+        trace("isempty: %u\n", pageBuffer[q]->isempty);
         if (pageBuffer[q]->isempty) {
             continue;
         }
-        printf("pageid:  %u\n", pageBuffer[q]->pageid);
-        printf("ipid:    %u\n", pageBuffer[q]->ipid);
-        printf("oid:     %u\n", pageBuffer[q]->oid);
-        printf("name:    %s\n", pageBuffer[q]->name);
-        printf("nattrs:  %u\n", pageBuffer[q]->nattrs);
-        printf("ntuples: %u\n", pageBuffer[q]->ntuples);
-        printf("pin:     %u\n", pageBuffer[q]->pin);
-        printf("use:     %u\n", pageBuffer[q]->use);
+        trace("pageid:  %lu\n", (unsigned long)pageBuffer[q]->pageid);
+        trace("ipid:    %lu\n", (unsigned long)pageBuffer[q]->ipid);
+        trace("oid:     %u\n", pageBuffer[q]->oid);
+        trace("name:    %s\n", pageBuffer[q]->name);
+        trace("nattrs:  %u\n", pageBuffer[q]->nattrs);
+        trace("ntuples: %u\n", pageBuffer[q]->ntuples);
+        trace("pin:     %u\n", pageBuffer[q]->pin);
+        trace("use:     %u\n", pageBuffer[q]->use);
         for (int j = 0; j < pageBuffer[q]->ntuples; j++) {
             for (int k = 0; k < pageBuffer[q]->nattrs; k++) {
-                printf("%i ", pageBuffer[q]->tuple[j][k]);
+                trace("%i ", pageBuffer[q]->tuple[j][k]);
             }
         }
-        printf("\n\n");
+        trace("\n\n");
     }
 }
 
 
 void printFileBuffer() {
-    printf("FILE BUFFER\n\n");
+    trace("FILE BUFFER\n\n");
     for (int q = 0; q < conf->file_limit; q++) {
-        printf("#%i\n", q);
-        printf("isempty: %u\n", fileBuffer[q]->isempty);
+        trace("#%i\n", q);
+        trace("isempty: %u\n", fileBuffer[q]->isempty);
         if (fileBuffer[q]->isempty) {
             continue;
         }
-        printf("oid:     %u\n", fileBuffer[q]->oid);
-        printf("name:    %s\n", fileBuffer[q]->name);
-        printf("nattrs:  %u\n", fileBuffer[q]->nattrs);
-        printf("ntuples: %u\n", fileBuffer[q]->ntuples);
-        printf("npages:  %u\n", fileBuffer[q]->npages);
-        printf("path:    %s\n\n", fileBuffer[q]->path);
+        trace("oid:     %u\n", fileBuffer[q]->oid);
+        trace("name:    %s\n", fileBuffer[q]->name);
+        trace("nattrs:  %u\n", fileBuffer[q]->nattrs);
+        trace("ntuples: %lu\n", (unsigned long)fileBuffer[q]->ntuples);
+        trace("npages:  %lu\n", (unsigned long)fileBuffer[q]->npages);
+        trace("path:    %s\n\n", fileBuffer[q]->path);
     }
 }
\ No newline at end of file
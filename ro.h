@@ -1,16 +1,126 @@
 #ifndef RO_H
 #define RO_H
 #include "db.h"
+#include "stats.h"
+#include "vec.h"
+
+#define CPU_TUPLE_COST 0.01 // cost of processing one tuple relative to one page read
+#define BUILD_WEIGHT 2 // building a hash entry costs about twice a probe
+
+typedef struct FileDesc { // file = table
+    // maintain meta info of table
+    UINT isempty;
+    UINT oid;
+    UINT nattrs;
+    UINT64 ntuples;
+    UINT64 npages;
+    UINT compressed;
+    char name[10];
+    char path[120];
+    FILE* file; // file pointer, NULL for direct I/O
+    int fd; // descriptor opened with O_DIRECT, -1 for buffered I/O
+} FileDesc;
+
+typedef struct PageDesc { // page = collection of tuples
+    // maintain meta info of page
+    UINT isempty;
+    UINT64 pageid;
+    UINT64 ipid; // internal page id, count from 0, increment 1 (ie nth page)
+    UINT oid; // table oid
+    char name[10];
+    UINT nattrs; 
+    UINT ntuples; // number of tuples in page (different from file's ntuples)
+    UINT pin;
+    UINT use;
+    INT** tuple; // array of int32 data
+    char* slot; // tuple storage of the slot in the page buffer arena
+    UINT heap; // tuple was allocated on the heap, the page did not fit the slot
+    UINT dirty; // rows were appended since the page was read, written back on eviction or at release()
+} PageDesc;
+
+// extended table meta
+typedef struct exTable{
+    UINT oid;
+    char name[10];
+    UINT nattrs;
+    UINT64 ntuples;
+    UINT64 npages;
+    UINT ntpp; // average over the pages of a compressed table
+    UINT compressed;
+    INT cluster_key; // -1 if the table is not clustered
+    INT* fences; // first key of every page of a clustered table
+    TableStats* stats; // NULL until the table is analyzed
+    const VecKernels* kern; // batch primitives for rows of nattrs attributes
+} exTable;
+
+// buffer pools, shared with the other operator modules
+extern FileDesc** fileBuffer;
+extern PageDesc** pageBuffer;
+
+// physical operators the planner can choose from
+typedef enum Method{
+    PLAN_SCAN,
+    PLAN_BNL,
+    PLAN_HASH,
+    PLAN_MJOIN,
+    PLAN_INL,
+    PLAN_CLUSTER, // binary search over the pages of a clustered table, then a bounded scan
+    PLAN_RADIX // hash join over radix partitions of both sides, each hash table fitting the L2 cache
+} Method;
+
+// comparison operators of a selection, each selects a range [lo, hi] of the attribute
+typedef enum CmpOp{
+    OP_EQ,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_BETWEEN // val <= attr <= val2
+} CmpOp;
+
+#define MAX_PROJ 64 // attributes of a projection list
+
+// attributes kept in a result, as indexes into the unprojected result tuple
+typedef struct Projection{
+    UINT n;
+    UINT attrs[MAX_PROJ];
+} Projection;
+
+// query plan chosen by planSel() / planJoin()
+typedef struct Plan{
+    Method method;
+    char outer[10]; // scanned table for PLAN_SCAN
+    char inner[10];
+    UINT outer_idx;
+    UINT inner_idx;
+    int swapped; // table2 is the outer table
+    int64_t nchunks; // outer chunks for PLAN_BNL
+    int64_t cost; // estimated page reads of the chosen plan
+    int64_t alt_cost; // estimated page reads of the best rejected plan, -1 if none
+    double est_rows; // estimated result cardinality, -1 without statistics
+    double total_cost; // page reads plus weighted tuple processing
+    char order[256]; // join tree of PLAN_MJOIN, probe side on the left
+} Plan;
 
 void init();
 void release();
 
 // utility
-int hash(const int input);
+const char* methodName(const Method m);
+
+// operator of a query, -1 if unknown
+int parseCmpOp(const char* s);
+
+// range [lo, hi] selected by attr op val (val2 for OP_BETWEEN), empty if lo > hi
+void cmpRange(const CmpOp op, const INT val, const INT val2, int64_t* lo, int64_t* hi);
 void freePageTuple(const int bid);
 
+// gather column statistics with a full scan, return -1 if the table does not exist
+int analyze(const char* table_name);
+
 // compute extended table meta
 void computeTableMeta();
+exTable* getTableMeta(const char* table_name);
 
 // print buffer status
 void printFileBuffer();
@@ -22,12 +132,32 @@ int availPageBufferSlot();
 
 // buffer manager
 void releasePage(const int bid);
-int requestPage(const char* table_name, const int ipid);
-int requestFile(const char* table_name, const int ipid);
+int requestPage(const char* table_name, const UINT64 ipid);
+int requestFile(const char* table_name, const UINT64 ipid);
 
 // read from disk operations
-int readPageFromDisk(const char* table_name, const int ipid);
-int readPageFromFileBuffer(const int fid, const int ipid);
+int readPageFromDisk(const char* table_name, const UINT64 ipid);
+int readPageFromFileBuffer(const int fid, const UINT64 ipid);
+
+// drop the unpinned pages and the file desc of a table or index file that is rewritten
+void dropFile(const char* table_name);
+
+// append n rows to a table through the buffer pool: the last page is filled, then new pages are added,
+// all of them dirty until written back; the table meta, the fences of a clustered table and the indexes
+// on the table follow the new rows
+// rows of a clustered table are sorted first and must not start below its last key
+// rows stop being appended when no buffer slot can be freed for a new page, dirty pages that cannot
+// be written back keep their slots
+// an index that cannot be updated is no longer used and index_failed is set
+// return the number of rows appended, -1 if the table does not exist, the rows are out of order
+// or none could be appended
+int insertRows(const char* table_name, INT* rows, const UINT n, int* index_failed);
+
+// planners: fill plan with the operator sel, selRange or join would run and its estimated cost
+// return -1 if a table does not exist
+int planSel(const UINT idx, const INT cond_val, const char* table_name, Plan* plan);
+int planSelRange(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name, Plan* plan);
+int planJoin(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name, Plan* plan);
 
 // equality test for one attribute
 // idx: index of the attribute for comparison, 0 <= idx < nattrs
@@ -35,5 +165,24 @@ int readPageFromFileBuffer(const int fid, const int ipid);
 // table_name: table name
 _Table* sel(const UINT idx, const INT cond_val, const char* table_name);
 
+// range selection lo <= attr <= hi
+// on the clustering key of a clustered table, only the pages holding the range are read
+_Table* selRange(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name);
+
+// range selection keeping only the attributes of proj, every attribute if proj is NULL
+// return NULL if an attribute of proj is outside the table
+_Table* selProj(const UINT idx, const int64_t lo, const int64_t hi, const char* table_name, const Projection* proj);
+
+// shared scan: n selections on one table answered in a single pass
+// results[i] receives the result of idx[i] = cond_vals[i]
+// return -1 if the table does not exist
+int selShared(const UINT n, const UINT* idx, const INT* cond_vals, const char* table_name, _Table** results);
+
 _Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name);
+
+// join keeping only the attributes of proj, indexes into table1 attributes followed by table2 attributes
+// only the projected attributes of a match are copied, and the hash join build side holds the join key
+// and the projected attributes of the build table only
+// return NULL if an attribute of proj is outside the result
+_Table* joinProj(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name, const Projection* proj);
 #endif
\ No newline at end of file
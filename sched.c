@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sched.h"
+#include "arena.h"
+#include "perf.h"
+
+
+// the tasks of a worker are a run of consecutive ones: it takes them from the head, thieves from the tail
+typedef struct Deque{
+    pthread_mutex_t lock;
+    UINT head;
+    UINT tail; // one past the last task
+} Deque;
+
+static Deque deques[SCHED_MAXWORKERS];
+static int initialized = 0;
+
+// worker w > 0 is helper thread w, started on the first run that needs it and kept until schedShutdown()
+static pthread_t threads[SCHED_MAXWORKERS];
+static Arena arenas[SCHED_MAXWORKERS];
+static UINT64 started[SCHED_MAXWORKERS]; // run counter when the thread was started
+static UINT nthreads = 0;
+
+// the current run, guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static UINT64 run = 0;
+static UINT run_workers = 0;
+static UINT busy = 0; // helper threads that have not finished the run
+static int stop = 0;
+static SchedTask run_fn = NULL;
+static void* run_ctx = NULL;
+
+static SchedStats stats = {0, 0};
+
+// perf counters of the helper threads when profiling, summed over the runs until schedTakeCounters()
+static UINT64 counters[NCOUNTERS];
+
+
+SchedStats* getSchedStats() {
+    return &stats;
+}
+
+
+static int take(const UINT w, UINT* task) {
+    Deque* d = &deques[w];
+    pthread_mutex_lock(&d->lock);
+    int ok = d->head < d->tail;
+    if (ok) *task = d->head++;
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+
+static int steal(const UINT victim, UINT* task) {
+    Deque* d = &deques[victim];
+    pthread_mutex_lock(&d->lock);
+    int ok = d->head < d->tail;
+    if (ok) *task = --d->tail;
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+
+// run tasks until every deque is empty, tasks never add tasks so an empty round of the victims ends the run
+static void work(const UINT w) {
+
+    UINT64 ntasks = 0;
+    UINT64 nstolen = 0;
+    UINT task;
+
+    for (;;) {
+        if (!take(w, &task)) {
+            int found = 0;
+            for (UINT i = 1; i < run_workers && !found; i++) {
+                found = steal((w + i) % run_workers, &task);
+            }
+            if (!found) break;
+            nstolen++;
+        }
+        run_fn(run_ctx, task, w);
+        ntasks++;
+    }
+
+    __sync_fetch_and_add(&stats.tasks, ntasks);
+    __sync_fetch_and_add(&stats.stolen, nstolen);
+
+}
+
+
+static void* helper(void* arg) {
+
+    UINT w = (UINT)(size_t)arg;
+    arenaInit(&arenas[w], ARENA_CHUNK);
+    setThreadArena(&arenas[w]);
+    UINT64 seen = started[w];
+    PerfGroup group = {{0}, {0}, -1, 0};
+    if (get_conf()->profile) perfGroupOpen(&group);
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (run == seen && !stop) pthread_cond_wait(&wake, &lock);
+        if (stop) break;
+        seen = run;
+        int member = w < run_workers;
+        pthread_mutex_unlock(&lock);
+
+        UINT64 before[NCOUNTERS];
+        UINT64 after[NCOUNTERS];
+        if (member) {
+            arenaReset(&arenas[w]);
+            perfGroupRead(&group, before);
+            work(w);
+            perfGroupRead(&group, after);
+        }
+
+        pthread_mutex_lock(&lock);
+        for (int c = 0; c < NCOUNTERS && member; c++) counters[c] += after[c] - before[c];
+        if (--busy == 0) pthread_cond_signal(&done);
+    }
+    pthread_mutex_unlock(&lock);
+
+    perfGroupClose(&group);
+    arenaFree(&arenas[w]);
+    return NULL;
+
+}
+
+
+void schedRun(const UINT nworkers, const UINT ntasks, SchedTask fn, void* ctx) {
+
+    UINT n = nworkers < ntasks ? nworkers : ntasks;
+    if (n > SCHED_MAXWORKERS) n = SCHED_MAXWORKERS;
+
+    // a single worker runs the tasks in order without touching the threads
+    if (n <= 1) {
+        for (UINT t = 0; t < ntasks; t++) fn(ctx, t, 0);
+        stats.tasks += ntasks;
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (!initialized) {
+        for (int w = 0; w < SCHED_MAXWORKERS; w++) pthread_mutex_init(&deques[w].lock, NULL);
+        initialized = 1;
+    }
+
+    while (nthreads + 1 < n) {
+        UINT w = nthreads + 1;
+        started[w] = run;
+        if (pthread_create(&threads[w], NULL, helper, (void*)(size_t)w) != 0) break;
+        nthreads++;
+    }
+    if (n > nthreads + 1) n = nthreads + 1;
+
+    for (UINT w = 0; w < n; w++) {
+        deques[w].head = (UINT)((UINT64)ntasks * w / n);
+        deques[w].tail = (UINT)((UINT64)ntasks * (w + 1) / n);
+    }
+    run_fn = fn;
+    run_ctx = ctx;
+    run_workers = n;
+    busy = nthreads;
+    run++;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    work(0);
+
+    pthread_mutex_lock(&lock);
+    while (busy > 0) pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+
+}
+
+
+void schedTakeCounters(UINT64* values) {
+    pthread_mutex_lock(&lock);
+    memcpy(values, counters, sizeof(counters));
+    memset(counters, 0, sizeof(counters));
+    pthread_mutex_unlock(&lock);
+}
+
+
+void schedResetArenas() {
+    pthread_mutex_lock(&lock);
+    for (UINT w = 1; w <= nthreads; w++) arenaReset(&arenas[w]);
+    pthread_mutex_unlock(&lock);
+}
+
+
+void schedShutdown() {
+
+    pthread_mutex_lock(&lock);
+    stop = 1;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for (UINT w = 1; w <= nthreads; w++) pthread_join(threads[w], NULL);
+
+    nthreads = 0;
+    stop = 0;
+
+}
@@ -0,0 +1,36 @@
+#ifndef SCHED_H
+#define SCHED_H
+#include "db.h"
+
+#define SCHED_MAXWORKERS 64
+#define SCHED_SPLIT 4 // tasks per worker an operator should cut its work into, so there is something to steal
+
+// a task of a parallel operator, worker is the one running it, 0 being the caller of schedRun()
+typedef void (*SchedTask)(void* ctx, const UINT task, const UINT worker);
+
+// run tasks 0 to ntasks - 1 on nworkers workers and return once they are all done
+// every worker starts with an equal run of consecutive tasks in its own deque and takes them in order,
+// a worker whose deque is empty steals the last task of another one
+// queryArena() of a worker other than 0 is its own, reset when the next run starts or by schedResetArenas()
+void schedRun(const UINT nworkers, const UINT ntasks, SchedTask fn, void* ctx);
+
+// reset the arenas of the workers once the caller no longer needs what the tasks of the last run left there,
+// so that they are not charged to the memory governor until the next run
+void schedResetArenas();
+
+// tasks run and stolen since the start
+typedef struct SchedStats{
+    UINT64 tasks;
+    UINT64 stolen;
+} SchedStats;
+
+SchedStats* getSchedStats();
+
+// perf counters of the helper threads over the runs since the last call, NCOUNTERS values, 0 unless profiling
+// the caller of schedRun() counts its own share of a run with perfRead()
+void schedTakeCounters(UINT64* values);
+
+// stop the worker threads
+void schedShutdown();
+
+#endif
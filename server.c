@@ -0,0 +1,273 @@
+#define _GNU_SOURCE // fmemopen, open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+// what the server does after a request line
+enum { REQ_NEXT, REQ_QUIT, REQ_SHUTDOWN };
+
+// connection with its partial request line
+typedef struct Client{
+    int fd;
+    size_t len;
+    char buf[SERVER_LINE];
+} Client;
+
+// latencies of the served queries in ns
+UINT64* latencies = NULL;
+size_t nlatencies = 0;
+size_t latencies_cap = 0;
+
+volatile sig_atomic_t stopping = 0;
+
+
+static void onSignal(int sig) {
+    stopping = 1;
+}
+
+
+static UINT64 nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void recordLatency(const UINT64 ns) {
+    if (nlatencies == latencies_cap) {
+        latencies_cap = latencies_cap == 0 ? 1024 : latencies_cap * 2;
+        latencies = realloc(latencies, sizeof(UINT64) * latencies_cap);
+    }
+    latencies[nlatencies++] = ns;
+}
+
+
+static int cmpLatency(const void* a, const void* b) {
+    UINT64 x = *(const UINT64*)a;
+    UINT64 y = *(const UINT64*)b;
+    return (x > y) - (x < y);
+}
+
+
+// nearest-rank percentile p of n sorted latencies, in us
+static double percentile(const UINT64* sorted, const size_t n, const double p) {
+    size_t rank = (size_t)(p / 100 * n);
+    if (rank >= n) rank = n - 1;
+    return sorted[rank] / 1000.0;
+}
+
+
+// latency percentiles of the queries served so far
+static void writeLatency(FILE* fp) {
+    if (nlatencies == 0) {
+        fprintf(fp, "latency_us: queries=0\n");
+        return;
+    }
+
+    UINT64* sorted = malloc(sizeof(UINT64) * nlatencies);
+    memcpy(sorted, latencies, sizeof(UINT64) * nlatencies);
+    qsort(sorted, nlatencies, sizeof(UINT64), cmpLatency);
+
+    fprintf(fp, "latency_us: queries=%lu p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+        (unsigned long)nlatencies, percentile(sorted, nlatencies, 50), percentile(sorted, nlatencies, 90),
+        percentile(sorted, nlatencies, 99), percentile(sorted, nlatencies, 99.9), sorted[nlatencies - 1] / 1000.0);
+
+    free(sorted);
+}
+
+
+// run one request line, its response goes to out
+static int handle(char* line, QueryRunner runner, FILE* out) {
+
+    char cmd[SERVER_LINE];
+    if (sscanf(line, "%255s", cmd) == 1 && cmd[0] != '#') {
+
+        if (strcmp(cmd, "quit") == 0) return REQ_QUIT;
+        if (strcmp(cmd, "shutdown") == 0) return REQ_SHUTDOWN;
+
+        if (strcmp(cmd, "stats") == 0) {
+            writeLatency(out);
+        } else {
+            // the line is run as a query file of its own
+            FILE* in = fmemopen(line, strlen(line), "r");
+            UINT64 t0 = nowNs();
+            runner(in, out);
+            recordLatency(nowNs() - t0);
+            fclose(in);
+        }
+
+    }
+
+    fputs(SERVER_DONE, out);
+    return REQ_NEXT;
+
+}
+
+
+static int sendAll(const int fd, const char* buf, size_t n) {
+    while (n > 0) {
+        ssize_t sent = send(fd, buf, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return -1;
+        buf += sent;
+        n -= sent;
+    }
+    return 0;
+}
+
+
+// read what a client sent and answer its complete lines, REQ_QUIT also when it disconnected
+static int serveClient(Client* c, QueryRunner runner) {
+
+    ssize_t n = read(c->fd, c->buf + c->len, SERVER_LINE - 1 - c->len);
+    if (n < 0 && errno == EINTR) return REQ_NEXT;
+    if (n <= 0) return REQ_QUIT;
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    // the responses of all complete lines are sent at once
+    char* out = NULL;
+    size_t outlen = 0;
+    FILE* out_fp = open_memstream(&out, &outlen);
+
+    int r = REQ_NEXT;
+    char* line = c->buf;
+    char* eol;
+    while (r == REQ_NEXT && (eol = strchr(line, '\n')) != NULL) {
+        char saved = eol[1];
+        eol[1] = '\0';
+        r = handle(line, runner, out_fp);
+        eol[1] = saved;
+        line = eol + 1;
+    }
+
+    fclose(out_fp);
+    if (outlen > 0 && sendAll(c->fd, out, outlen) < 0 && r == REQ_NEXT) r = REQ_QUIT;
+    free(out);
+
+    // keep the partial line, a line longer than a query line ends the connection
+    c->len -= line - c->buf;
+    memmove(c->buf, line, c->len);
+    if (c->len == SERVER_LINE - 1) return REQ_QUIT;
+
+    return r;
+
+}
+
+
+static int serveSocket(const char* path, QueryRunner runner) {
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, SERVER_MAXCLIENTS) < 0) {
+        perror("Fail to open the server socket.\n");
+        if (lfd >= 0) close(lfd);
+        return -1;
+    }
+
+    trace("\nserving on %s\n", path);
+
+    Client* clients = malloc(sizeof(Client) * SERVER_MAXCLIENTS);
+    struct pollfd fds[SERVER_MAXCLIENTS + 1];
+    int nclients = 0;
+    int stop = 0;
+
+    // one query runs at a time, clients are served in turn as their requests arrive
+    while (!stopping && !stop) {
+
+        fds[0].fd = lfd;
+        fds[0].events = nclients < SERVER_MAXCLIENTS ? POLLIN : 0;
+        for (int i = 0; i < nclients; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        if (poll(fds, nclients + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // backwards, a closed connection is replaced by the last one, which is already served
+        for (int i = nclients - 1; i >= 0 && !stop; i--) {
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            int r = serveClient(&clients[i], runner);
+            if (r == REQ_SHUTDOWN) stop = 1;
+            if (r != REQ_NEXT) {
+                trace("client %d disconnected\n", clients[i].fd);
+                close(clients[i].fd);
+                clients[i] = clients[--nclients];
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+            if (fd >= 0) {
+                trace("client %d connected\n", fd);
+                clients[nclients].fd = fd;
+                clients[nclients].len = 0;
+                nclients++;
+            }
+        }
+
+    }
+
+    for (int i = 0; i < nclients; i++) close(clients[i].fd);
+    free(clients);
+    close(lfd);
+    unlink(path);
+    return 0;
+
+}
+
+
+// stdout carries the responses, the caller runs quiet
+static void serveStdin(QueryRunner runner) {
+
+    char line[SERVER_LINE];
+    while (!stopping && fgets(line, SERVER_LINE, stdin) != NULL) {
+        int r = handle(line, runner, stdout);
+        fflush(stdout);
+        if (r != REQ_NEXT) break;
+    }
+
+}
+
+
+int serve(const char* path, QueryRunner runner) {
+
+    // no SA_RESTART: a signal interrupts poll() and fgets() so the server stops
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int ret = 0;
+    if (strcmp(path, "-") == 0) serveStdin(runner);
+    else ret = serveSocket(path, runner);
+
+    writeLatency(stderr);
+    free(latencies);
+    latencies = NULL;
+    nlatencies = latencies_cap = 0;
+
+    return ret;
+
+}
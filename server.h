@@ -0,0 +1,20 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdio.h>
+#include "db.h"
+
+#define SERVER_MAXCLIENTS 64
+#define SERVER_LINE 256 // longest request line, as in a query file
+#define SERVER_DONE "#done\n" // ends the response to every request line
+
+// runs the query lines of query_fp and writes their results in the log format to log_fp
+typedef void (*QueryRunner)(FILE* query_fp, FILE* log_fp);
+
+// serve requests on the loaded database until shutdown
+// path is a Unix domain socket, or "-" for requests on stdin and responses on stdout
+// besides queries, a client can send "stats" for latency percentiles, "quit" to disconnect
+// and "shutdown" to stop the server; SIGINT and SIGTERM stop it as well
+// return -1 if the socket cannot be opened
+int serve(const char* path, QueryRunner runner);
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+#define min(x,y) (((x)<(y))?(x):(y))
+#define max(x,y) (((x)>(y))?(x):(y))
+
+
+// 64-bit mixer (splitmix64 finalizer), spreads integer keys over all bits
+static UINT64 mix64(UINT64 x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+// xorshift generator for reservoir sampling, seeded identically for every table
+static UINT64 nextRand(TableStats* ts) {
+    ts->rng ^= ts->rng << 13;
+    ts->rng ^= ts->rng >> 7;
+    ts->rng ^= ts->rng << 17;
+    return ts->rng;
+}
+
+
+static int cmpINT(const void* a, const void* b) {
+    INT x = *(const INT*)a;
+    INT y = *(const INT*)b;
+    return (x > y) - (x < y);
+}
+
+
+TableStats* newTableStats(const UINT nattrs) {
+
+    TableStats* ts = malloc(sizeof(TableStats));
+    ts->nattrs = nattrs;
+    ts->ntuples = 0;
+    ts->nsample = 0;
+    ts->cols = calloc(nattrs, sizeof(ColStats));
+    ts->hll = calloc(nattrs * HLL_REGS, sizeof(INT8));
+    ts->sample = malloc(sizeof(INT) * STATS_SAMPLE * nattrs);
+    ts->rng = 0x2545f4914f6cdd1dULL;
+
+    for (int x = 0; x < nattrs; x++) {
+        ts->cols[x].min = INT32_MAX;
+        ts->cols[x].max = INT32_MIN;
+    }
+
+    return ts;
+
+}
+
+
+void freeTableStats(TableStats* ts) {
+    if (ts == NULL) return;
+    free(ts->cols);
+    free(ts->hll);
+    free(ts->sample);
+    free(ts);
+}
+
+
+// fold one tuple into min/max, the HyperLogLog sketches and the reservoir sample
+void statsAddTuple(TableStats* ts, const INT* tuple) {
+
+    for (int x = 0; x < ts->nattrs; x++) {
+
+        ColStats* c = &ts->cols[x];
+        c->min = min(c->min, tuple[x]);
+        c->max = max(c->max, tuple[x]);
+
+        // register index from the top bits, rank from the leading zeros of the rest
+        UINT64 h = mix64((UINT64)(UINT)tuple[x]);
+        UINT reg = h >> (64 - HLL_BITS);
+        UINT64 rest = h << HLL_BITS;
+        INT8 rank = rest == 0 ? 64 - HLL_BITS + 1 : __builtin_clzll(rest) + 1;
+        INT8* regs = ts->hll + x * HLL_REGS;
+        if (rank > regs[reg]) regs[reg] = rank;
+
+    }
+
+    // reservoir sampling (algorithm R)
+    UINT64 slot = ts->ntuples;
+    if (ts->ntuples >= STATS_SAMPLE) slot = nextRand(ts) % (ts->ntuples + 1);
+    if (slot < STATS_SAMPLE) {
+        memcpy(ts->sample + slot * ts->nattrs, tuple, sizeof(INT) * ts->nattrs);
+    }
+
+    ts->ntuples++;
+    ts->nsample = min(ts->ntuples, STATS_SAMPLE);
+
+}
+
+
+// HyperLogLog cardinality estimate, linear counting for small ranges
+static UINT64 hllEstimate(const INT8* regs) {
+
+    double m = HLL_REGS;
+    double sum = 0;
+    int zeros = 0;
+
+    for (int i = 0; i < HLL_REGS; i++) {
+        sum += ldexp(1.0, -regs[i]);
+        if (regs[i] == 0) zeros++;
+    }
+
+    double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    if (e <= 2.5 * m && zeros > 0) e = m * log(m / zeros);
+
+    return (UINT64)(e + 0.5);
+
+}
+
+
+// derive ndistinct, MCVs and histogram, then drop the builder state
+void statsFinish(TableStats* ts) {
+
+    INT* vals = malloc(sizeof(INT) * max(ts->nsample, 1));
+
+    for (int x = 0; x < ts->nattrs; x++) {
+
+        ColStats* c = &ts->cols[x];
+        c->ndistinct = min(hllEstimate(ts->hll + x * HLL_REGS), ts->ntuples);
+        c->nmcv = 0;
+        c->nbounds = 0;
+        if (ts->nsample == 0) continue;
+
+        for (int i = 0; i < ts->nsample; i++) vals[i] = ts->sample[i * ts->nattrs + x];
+        qsort(vals, ts->nsample, sizeof(INT), cmpINT);
+
+        // most common values: longest runs in the sorted sample that repeat more than average
+        double avg = (double)ts->nsample / max(c->ndistinct, 1);
+        UINT counts[STATS_NMCV];
+        for (int i = 0; i < ts->nsample; ) {
+            int j = i;
+            while (j < ts->nsample && vals[j] == vals[i]) j++;
+            UINT run = j - i;
+            if (run > 1 && run > avg) {
+                // insertion into the list ordered by descending count
+                int pos = c->nmcv;
+                while (pos > 0 && counts[pos - 1] < run) pos--;
+                if (pos < STATS_NMCV) {
+                    int last = min(c->nmcv, STATS_NMCV - 1);
+                    for (int k = last; k > pos; k--) {
+                        counts[k] = counts[k - 1];
+                        c->mcv_vals[k] = c->mcv_vals[k - 1];
+                    }
+                    counts[pos] = run;
+                    c->mcv_vals[pos] = vals[i];
+                    if (c->nmcv < STATS_NMCV) c->nmcv++;
+                }
+            }
+            i = j;
+        }
+        for (int k = 0; k < c->nmcv; k++) c->mcv_freqs[k] = (double)counts[k] / ts->nsample;
+
+        // equi-depth histogram: bucket boundaries at the sample quantiles
+        c->nbounds = min(STATS_NBUCKETS + 1, ts->nsample);
+        for (int b = 0; b < c->nbounds; b++) {
+            UINT64 pos = c->nbounds == 1 ? 0 : (UINT64)b * (ts->nsample - 1) / (c->nbounds - 1);
+            c->bounds[b] = vals[pos];
+        }
+
+    }
+
+    free(vals);
+    free(ts->hll);
+    free(ts->sample);
+    ts->hll = NULL;
+    ts->sample = NULL;
+
+}
+
+
+void printTableStats(const char* table_name, const TableStats* ts) {
+
+    trace("\nSTATS %s | ntuples: %lu\n", table_name, (unsigned long)ts->ntuples);
+
+    for (int x = 0; x < ts->nattrs; x++) {
+        const ColStats* c = &ts->cols[x];
+        trace("attr %i | ndistinct: %lu | min: %i | max: %i\n", x, (unsigned long)c->ndistinct, c->min, c->max);
+        trace("  mcv:");
+        for (int k = 0; k < c->nmcv; k++) trace(" %i(%.3f)", c->mcv_vals[k], c->mcv_freqs[k]);
+        trace("\n  histogram:");
+        for (int b = 0; b < c->nbounds; b++) trace(" %i", c->bounds[b]);
+        trace("\n");
+    }
+
+}
+
+
+// fraction of tuples with attr = val
+double estSelEq(const ColStats* c, const INT val) {
+
+    if (val < c->min || val > c->max) return 0;
+
+    double mcv_total = 0;
+    for (int k = 0; k < c->nmcv; k++) {
+        if (c->mcv_vals[k] == val) return c->mcv_freqs[k];
+        mcv_total += c->mcv_freqs[k];
+    }
+
+    // the remaining values share the non-MCV fraction evenly
+    double nrest = (double)c->ndistinct - c->nmcv;
+    if (nrest < 1) nrest = 1;
+    return max(1.0 - mcv_total, 0) / nrest;
+
+}
+
+
+// fraction of tuples with lo <= attr <= hi
+// each histogram bucket holds an equal share of the tuples, spread evenly over its values
+double estSelRange(const ColStats* c, const int64_t lo, const int64_t hi) {
+
+    if (lo > hi || hi < c->min || lo > c->max) return 0;
+    if (lo <= c->min && hi >= c->max) return 1;
+    if (c->nbounds < 2) return 1;
+
+    UINT nbuckets = c->nbounds - 1;
+    double sel = 0;
+    for (UINT b = 0; b < nbuckets; b++) {
+        double l = max(lo, c->bounds[b]);
+        double h = min(hi, c->bounds[b + 1]);
+        if (l > h) continue;
+        double width = (double)c->bounds[b + 1] - c->bounds[b] + 1;
+        sel += (h - l + 1) / width / nbuckets;
+    }
+    return min(sel, 1.0);
+
+}
+
+
+// fraction of the cross product satisfying attr1 = attr2
+// matching MCVs are counted exactly, the rest assumes containment of the smaller domain
+double estSelJoin(const ColStats* c1, const ColStats* c2) {
+
+    if (c1->max < c2->min || c2->max < c1->min) return 0;
+
+    double matched = 0;
+    double hit1 = 0;
+    double hit2 = 0;
+    int nhits = 0;
+
+    for (int i = 0; i < c1->nmcv; i++) {
+        for (int j = 0; j < c2->nmcv; j++) {
+            if (c1->mcv_vals[i] == c2->mcv_vals[j]) {
+                matched += c1->mcv_freqs[i] * c2->mcv_freqs[j];
+                hit1 += c1->mcv_freqs[i];
+                hit2 += c2->mcv_freqs[j];
+                nhits++;
+            }
+        }
+    }
+
+    // values of one side outside the matched MCVs
+    double rest1 = max(1.0 - hit1, 0);
+    double rest2 = max(1.0 - hit2, 0);
+    double nd1 = max((double)c1->ndistinct - nhits, 1);
+    double nd2 = max((double)c2->ndistinct - nhits, 1);
+
+    return matched + rest1 * rest2 / max(nd1, nd2);
+
+}
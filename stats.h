@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+#include "db.h"
+
+#define HLL_BITS 12 // 2^12 HyperLogLog registers per column
+#define HLL_REGS (1 << HLL_BITS)
+#define STATS_SAMPLE 30000 // rows kept in the reservoir sample
+#define STATS_NMCV 8 // most common values kept per column
+#define STATS_NBUCKETS 10 // buckets of the equi-depth histogram
+
+// statistics of a single column
+typedef struct ColStats{
+    UINT64 ndistinct; // HyperLogLog estimate
+    INT min;
+    INT max;
+    UINT nmcv;
+    INT mcv_vals[STATS_NMCV];
+    double mcv_freqs[STATS_NMCV]; // fraction of the table holding each value
+    UINT nbounds;
+    INT bounds[STATS_NBUCKETS + 1]; // equi-depth histogram bucket boundaries
+} ColStats;
+
+// statistics of a table, built by feeding every tuple to statsAddTuple()
+typedef struct TableStats{
+    UINT nattrs;
+    UINT64 ntuples;
+    UINT nsample;
+    ColStats* cols;
+    INT8* hll; // nattrs * HLL_REGS registers, freed by statsFinish()
+    INT* sample; // nsample * nattrs reservoir, freed by statsFinish()
+    UINT64 rng;
+} TableStats;
+
+TableStats* newTableStats(const UINT nattrs);
+void freeTableStats(TableStats* ts);
+void statsAddTuple(TableStats* ts, const INT* tuple);
+void statsFinish(TableStats* ts);
+void printTableStats(const char* table_name, const TableStats* ts);
+
+// selectivity estimators, fraction of tuples in [0, 1]
+double estSelEq(const ColStats* c, const INT val);
+double estSelRange(const ColStats* c, const int64_t lo, const int64_t hi);
+double estSelJoin(const ColStats* c1, const ColStats* c2);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topn.h"
+
+#define TOPN_INITCAP 64
+
+
+TopN* newTopN(const UINT n, const UINT attr, const int desc) {
+    TopN* tn = arenaAlloc(queryArena(), sizeof(TopN));
+    tn->n = n;
+    tn->attr = attr;
+    tn->desc = desc;
+    tn->bad = 0;
+    tn->width = 0;
+    tn->nrows = 0;
+    tn->cap = 0;
+    tn->rows = NULL;
+    tn->heap = NULL;
+    return tn;
+}
+
+
+// order of the result: attr, then the attributes of the row, reversed for desc
+static int cmpRows(const TopN* tn, const INT* a, const INT* b) {
+    int c = (a[tn->attr] > b[tn->attr]) - (a[tn->attr] < b[tn->attr]);
+    for (UINT x = 0; x < tn->width && c == 0; x++) c = (a[x] > b[x]) - (a[x] < b[x]);
+    return tn->desc ? -c : c;
+}
+
+
+static const INT* heapRow(const TopN* tn, const UINT pos) {
+    return tn->rows + (size_t)tn->heap[pos] * tn->width;
+}
+
+
+static void swap(TopN* tn, const UINT i, const UINT j) {
+    UINT t = tn->heap[i];
+    tn->heap[i] = tn->heap[j];
+    tn->heap[j] = t;
+}
+
+
+// the root holds the row ordered last
+static void siftUp(TopN* tn, UINT pos) {
+    while (pos > 0) {
+        UINT parent = (pos - 1) / 2;
+        if (cmpRows(tn, heapRow(tn, pos), heapRow(tn, parent)) <= 0) break;
+        swap(tn, pos, parent);
+        pos = parent;
+    }
+}
+
+
+static void siftDown(TopN* tn, UINT pos) {
+    for (;;) {
+        UINT last = pos;
+        UINT l = 2 * pos + 1;
+        UINT r = l + 1;
+        if (l < tn->nrows && cmpRows(tn, heapRow(tn, l), heapRow(tn, last)) > 0) last = l;
+        if (r < tn->nrows && cmpRows(tn, heapRow(tn, r), heapRow(tn, last)) > 0) last = r;
+        if (last == pos) break;
+        swap(tn, pos, last);
+        pos = last;
+    }
+}
+
+
+// room for the rows up to n, doubled as they come, charged to the result
+static void grow(TopN* tn) {
+    UINT cap = tn->cap == 0 ? TOPN_INITCAP : tn->cap * 2;
+    if (cap > tn->n) cap = tn->n;
+    MemOp prev = memOperator(MEM_RESULT);
+    tn->rows = arenaRealloc(queryArena(), tn->rows, sizeof(INT) * tn->width * tn->cap, sizeof(INT) * tn->width * cap);
+    tn->heap = arenaRealloc(queryArena(), tn->heap, sizeof(UINT) * tn->cap, sizeof(UINT) * cap);
+    memOperator(prev);
+    tn->cap = cap;
+}
+
+
+void topConsume(void* ctx, const INT* row, const UINT width) {
+
+    TopN* tn = ctx;
+    tn->width = width;
+    if (tn->attr >= width) {
+        tn->bad = 1;
+        return;
+    }
+    if (tn->n == 0) return;
+
+    // a row is added while the heap is not full, then it replaces the root if it is ordered before it
+    if (tn->nrows < tn->n) {
+        if (tn->nrows == tn->cap) grow(tn);
+        memcpy(tn->rows + (size_t)tn->nrows * width, row, sizeof(INT) * width);
+        tn->heap[tn->nrows] = tn->nrows;
+        siftUp(tn, tn->nrows++);
+        return;
+    }
+
+    if (cmpRows(tn, row, heapRow(tn, 0)) >= 0) return;
+    memcpy(tn->rows + (size_t)tn->heap[0] * width, row, sizeof(INT) * width);
+    siftDown(tn, 0);
+
+}
+
+
+static const TopN* sort_tn;
+
+static int cmpHeap(const void* a, const void* b) {
+    const TopN* tn = sort_tn;
+    return cmpRows(tn, tn->rows + (size_t)*(const UINT*)a * tn->width, tn->rows + (size_t)*(const UINT*)b * tn->width);
+}
+
+
+_Table* topFinish(TopN* tn, const UINT width) {
+
+    if (tn->bad || tn->attr >= width) {
+        trace("Top attribute %u out of range\n", tn->attr);
+        return NULL;
+    }
+    tn->width = width;
+
+    sort_tn = tn;
+    if (tn->nrows > 0) qsort(tn->heap, tn->nrows, sizeof(UINT), cmpHeap);
+
+    RowBuf out;
+    rowbufInit(&out, queryArena(), width);
+    rowbufSpill(&out);
+    for (UINT i = 0; i < tn->nrows; i++) {
+        memcpy(rowbufAppend(&out), heapRow(tn, i), sizeof(INT) * width);
+    }
+
+    trace("top: %u rows kept\n", tn->nrows);
+    return rowbufTable(&out);
+
+}
@@ -0,0 +1,31 @@
+#ifndef TOPN_H
+#define TOPN_H
+#include "db.h"
+#include "arena.h"
+
+// the first n rows of a query in the order of one attribute, "query top n by attr [desc]"
+// rows are kept in a bounded heap whose root is the row the next better one replaces,
+// so the query is read once and only the rows kept are sorted
+// ties on attr are ordered on the attributes of the row, first to last
+typedef struct TopN{
+    UINT n;
+    UINT attr;
+    int desc; // largest values first
+    int bad; // attr is outside the input rows
+    UINT width; // of an input row
+    UINT nrows; // rows held, at most n
+    UINT cap;
+    INT* rows; // cap rows of width attributes, in the query arena
+    UINT* heap; // rows by heap position
+} TopN;
+
+TopN* newTopN(const UINT n, const UINT attr, const int desc);
+
+// RowSink consumer, ctx is the TopN
+void topConsume(void* ctx, const INT* row, const UINT width);
+
+// the rows held in order in the query arena, width is the one of the query rows, known without rows
+// NULL if attr is outside them
+_Table* topFinish(TopN* tn, const UINT width);
+
+#endif
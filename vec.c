@@ -0,0 +1,390 @@
+#include <string.h>
+#include "vec.h"
+
+
+// the inner loops below have no data-dependent branch: every row is written to the
+// selection vector and only kept by advancing the count
+
+// every primitive over rows is written once as a body taking the row stride, expanded below into
+// the generic function with the runtime stride and one static kernel per width with a constant one,
+// for which the compiler turns the row addressing into fixed offsets and unrolls the row copies
+
+
+#define FILTER_RANGE(STRIDE) { \
+    const INT* col = rows + attr; \
+    UINT k = 0; \
+    for (UINT i = 0; i < n; i++) { \
+        int64_t v = col[(size_t)i * (STRIDE)]; \
+        sel[k] = i; \
+        k += (v >= lo) & (v <= hi); \
+    } \
+    return k; \
+}
+
+#define FILTER_EQ(STRIDE) { \
+    const INT* col = rows + attr; \
+    UINT k = 0; \
+    for (UINT i = 0; i < n; i++) { \
+        sel[k] = i; \
+        k += col[(size_t)i * (STRIDE)] == val; \
+    } \
+    return k; \
+}
+
+#define HASH(KEY) (((UINT)(KEY) * 0x9E3779B1u) ^ (((UINT)(KEY) * 0x9E3779B1u) >> 15))
+
+#define HASH_KEYS(STRIDE) { \
+    const INT* col = rows + attr; \
+    for (UINT i = 0; i < n; i++) { \
+        hashes[i] = HASH(col[(size_t)i * (STRIDE)]); \
+    } \
+}
+
+#define GATHER(STRIDE) { \
+    const INT* col = rows + attr; \
+    for (UINT k = 0; k < n; k++) { \
+        out[(size_t)k * out_stride] = col[(size_t)sel[k] * (STRIDE)]; \
+    } \
+}
+
+#define GATHER_ROWS(STRIDE) { \
+    for (UINT k = 0; k < n; k++) { \
+        const INT* row = rows + (size_t)sel[k] * (STRIDE); \
+        INT* o = out + (size_t)k * out_stride; \
+        for (UINT x = 0; x < (STRIDE); x++) o[x] = row[x]; \
+    } \
+}
+
+#define COLUMN(STRIDE) { \
+    const INT* col = rows + attr; \
+    for (UINT i = 0; i < n; i++) { \
+        out[i] = col[(size_t)i * (STRIDE)]; \
+    } \
+}
+
+#define POINTERS(STRIDE) { \
+    for (UINT i = 0; i < n; i++) { \
+        out[i] = rows + (size_t)i * (STRIDE); \
+    } \
+}
+
+#define CHAIN(I, KEY, HASH) \
+    for (UINT e = ht->heads[(HASH) & ht->mask]; e != VEC_NONE; e = ht->next[e]) { \
+        if (ht->keys[e] != (KEY)) continue; \
+        if (pairs->n == pairs->cap) growPairs(pairs); \
+        pairs->probe[pairs->n] = (I); \
+        pairs->build[pairs->n] = e; \
+        pairs->n++; \
+    }
+
+#define PROBE(STRIDE) { \
+    const INT* col = rows + attr; \
+    pairs->n = 0; \
+    for (UINT i = 0; i < n; i++) { \
+        INT key = col[(size_t)i * (STRIDE)]; \
+        CHAIN(i, key, hashes[i]) \
+    } \
+    return pairs->n; \
+}
+
+
+static void growPairs(VecPairs* pairs) {
+    UINT cap = pairs->cap == 0 ? VEC_SIZE : pairs->cap * 2;
+    pairs->probe = arenaRealloc(queryArena(), pairs->probe, sizeof(UINT) * pairs->cap, sizeof(UINT) * cap);
+    pairs->build = arenaRealloc(queryArena(), pairs->build, sizeof(UINT) * pairs->cap, sizeof(UINT) * cap);
+    pairs->cap = cap;
+}
+
+
+UINT vecFilterRange(const INT* rows, const UINT stride, const UINT attr, const UINT n, const int64_t lo, const int64_t hi, UINT* sel)
+    FILTER_RANGE(stride)
+
+UINT vecFilterEq(const INT* rows, const UINT stride, const UINT attr, const UINT n, const INT val, UINT* sel)
+    FILTER_EQ(stride)
+
+void vecHashKeys(const INT* rows, const UINT stride, const UINT attr, const UINT n, UINT* hashes)
+    HASH_KEYS(stride)
+
+void vecGather(const INT* rows, const UINT stride, const UINT attr, const UINT* sel, const UINT n, INT* out, const UINT out_stride)
+    GATHER(stride)
+
+void vecGatherRows(const INT* rows, const UINT stride, const UINT* sel, const UINT n, INT* out, const UINT out_stride)
+    GATHER_ROWS(stride)
+
+void vecColumn(const INT* rows, const UINT stride, const UINT attr, const UINT n, INT* out)
+    COLUMN(stride)
+
+void vecPointers(INT* rows, const UINT stride, const UINT n, INT** out)
+    POINTERS(stride)
+
+UINT vecProbe(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes, VecPairs* pairs)
+    PROBE(stride)
+
+
+// the kernels of width W, the stride argument is only there to share the signatures
+#define KERNELS(W) \
+static UINT filterRange##W(const INT* rows, const UINT stride, const UINT attr, const UINT n, const int64_t lo, const int64_t hi, UINT* sel) \
+    FILTER_RANGE(W) \
+static UINT filterEq##W(const INT* rows, const UINT stride, const UINT attr, const UINT n, const INT val, UINT* sel) \
+    FILTER_EQ(W) \
+static void hashKeys##W(const INT* rows, const UINT stride, const UINT attr, const UINT n, UINT* hashes) \
+    HASH_KEYS(W) \
+static void gather##W(const INT* rows, const UINT stride, const UINT attr, const UINT* sel, const UINT n, INT* out, const UINT out_stride) \
+    GATHER(W) \
+static void gatherRows##W(const INT* rows, const UINT stride, const UINT* sel, const UINT n, INT* out, const UINT out_stride) \
+    GATHER_ROWS(W) \
+static void column##W(const INT* rows, const UINT stride, const UINT attr, const UINT n, INT* out) \
+    COLUMN(W) \
+static void pointers##W(INT* rows, const UINT stride, const UINT n, INT** out) \
+    POINTERS(W) \
+static UINT probe##W(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes, VecPairs* pairs) \
+    PROBE(W)
+
+#define KERNEL_ENTRY(W) {W, filterRange##W, filterEq##W, hashKeys##W, gather##W, gatherRows##W, column##W, pointers##W, probe##W},
+
+// widths 1 to VEC_MAXKERNEL
+#define EACH_WIDTH(X) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15) X(16)
+
+EACH_WIDTH(KERNELS)
+
+static const VecKernels kernels[VEC_MAXKERNEL + 1] = {
+    {0, vecFilterRange, vecFilterEq, vecHashKeys, vecGather, vecGatherRows, vecColumn, vecPointers, vecProbe},
+    EACH_WIDTH(KERNEL_ENTRY)
+};
+
+
+const VecKernels* vecKernels(const UINT width) {
+    return width <= VEC_MAXKERNEL ? &kernels[width] : &kernels[0];
+}
+
+
+void vecHashInit(VecHashTable* ht) {
+    memset(ht, 0, sizeof(VecHashTable));
+}
+
+
+// size the arrays for n entries and hash the keys
+static void prepare(VecHashTable* ht, const INT* keys, const UINT n) {
+
+    // at least 2 buckets per entry keeps the chains short
+    if (n > ht->cap || ht->heads == NULL) {
+        ht->cap = n > 2 * ht->cap ? n : 2 * ht->cap;
+        if (ht->cap < 8) ht->cap = 8;
+        UINT nbuckets = 16;
+        while (nbuckets < 2 * ht->cap) nbuckets *= 2;
+        ht->mask = nbuckets - 1;
+        ht->heads = arenaAlloc(queryArena(), sizeof(UINT) * nbuckets);
+        ht->next = arenaAlloc(queryArena(), sizeof(UINT) * ht->cap);
+        ht->hashes = arenaAlloc(queryArena(), sizeof(UINT) * ht->cap);
+    }
+
+    ht->nentries = n;
+    ht->keys = keys;
+    ht->nheavy = 0;
+    memset(ht->heads, 0xFF, sizeof(UINT) * (ht->mask + 1));
+    hashKeys1(keys, 1, 0, n, ht->hashes);
+
+}
+
+
+// chain the entries, inserted backwards at the chain heads so every chain is in insertion order
+// with heavy hitters, next[i] holds the heavy hitter of entry i until it is chained
+static void chain(VecHashTable* ht, const UINT n) {
+    for (UINT i = n; i-- > 0; ) {
+        if (ht->nheavy > 0 && ht->next[i] != VEC_NONE) continue;
+        UINT b = ht->hashes[i] & ht->mask;
+        ht->next[i] = ht->heads[b];
+        ht->heads[b] = i;
+    }
+}
+
+
+void vecHashBuild(VecHashTable* ht, const INT* keys, const UINT n) {
+    prepare(ht, keys, n);
+    chain(ht, n);
+}
+
+
+UINT vecHeavyOf(const VecHashTable* ht, const INT key, const UINT hash) {
+    if (ht->nheavy == 0) return VEC_NONE;
+    for (UINT s = hash & ht->hmask; ht->hslots[s] != VEC_NONE; s = (s + 1) & ht->hmask) {
+        if (ht->hkeys[ht->hslots[s]] == key) return ht->hslots[s];
+    }
+    return VEC_NONE;
+}
+
+
+// slots of the heavy keys 0 to nheavy - 1
+static void heavySlots(VecHashTable* ht) {
+    memset(ht->hslots, 0xFF, sizeof(UINT) * (ht->hmask + 1));
+    for (UINT h = 0; h < ht->nheavy; h++) {
+        UINT s = HASH(ht->hkeys[h]) & ht->hmask;
+        while (ht->hslots[s] != VEC_NONE) s = (s + 1) & ht->hmask;
+        ht->hslots[s] = h;
+    }
+}
+
+
+void vecHashBuildSkew(VecHashTable* ht, const INT* keys, const UINT n, const INT* cand, const UINT ncand) {
+
+    prepare(ht, keys, n);
+    if (ncand == 0) {
+        chain(ht, n);
+        return;
+    }
+
+    // distinct candidates
+    Arena* a = queryArena();
+    UINT nslots = 16;
+    while (nslots < 2 * ncand) nslots *= 2;
+    ht->hmask = nslots - 1;
+    ht->hslots = arenaAlloc(a, sizeof(UINT) * nslots);
+    ht->hkeys = arenaAlloc(a, sizeof(INT) * ncand);
+    memset(ht->hslots, 0xFF, sizeof(UINT) * nslots);
+    for (UINT c = 0; c < ncand; c++) {
+        UINT s = HASH(cand[c]) & ht->hmask;
+        while (ht->hslots[s] != VEC_NONE && ht->hkeys[ht->hslots[s]] != cand[c]) s = (s + 1) & ht->hmask;
+        if (ht->hslots[s] != VEC_NONE) continue;
+        ht->hslots[s] = ht->nheavy;
+        ht->hkeys[ht->nheavy++] = cand[c];
+    }
+
+    // exact number of entries of every candidate, those with fewer than VEC_HEAVY_MIN are chained after all
+    UINT* count = arenaAlloc(a, sizeof(UINT) * ht->nheavy);
+    UINT* renum = arenaAlloc(a, sizeof(UINT) * ht->nheavy);
+    memset(count, 0, sizeof(UINT) * ht->nheavy);
+    for (UINT i = 0; i < n; i++) {
+        ht->next[i] = vecHeavyOf(ht, keys[i], ht->hashes[i]);
+        if (ht->next[i] != VEC_NONE) count[ht->next[i]]++;
+    }
+    UINT m = 0;
+    for (UINT h = 0; h < ht->nheavy; h++) {
+        renum[h] = count[h] >= VEC_HEAVY_MIN ? m : VEC_NONE;
+        if (renum[h] == VEC_NONE) continue;
+        ht->hkeys[m] = ht->hkeys[h];
+        count[m] = count[h];
+        m++;
+    }
+    ht->nheavy = m;
+    heavySlots(ht);
+
+    // runs of entries of the heavy keys
+    ht->hfirst = arenaAlloc(a, sizeof(UINT) * (m + 1));
+    ht->hfirst[0] = 0;
+    for (UINT h = 0; h < m; h++) ht->hfirst[h + 1] = ht->hfirst[h] + count[h];
+    ht->hentries = arenaAlloc(a, sizeof(UINT) * (ht->hfirst[m] + 1));
+    memcpy(count, ht->hfirst, sizeof(UINT) * m);
+    for (UINT i = 0; i < n; i++) {
+        if (ht->next[i] != VEC_NONE) ht->next[i] = renum[ht->next[i]];
+        if (ht->next[i] != VEC_NONE) ht->hentries[count[ht->next[i]]++] = i;
+    }
+
+    chain(ht, n);
+
+}
+
+
+UINT vecProbeSkew(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes,
+    VecPairs* pairs, VecRuns* runs) {
+
+    const INT* col = rows + attr;
+    pairs->n = 0;
+    runs->n = 0;
+    for (UINT i = 0; i < n; i++) {
+        INT key = col[(size_t)i * stride];
+        UINT h = vecHeavyOf(ht, key, hashes[i]);
+        if (h != VEC_NONE) {
+            runs->probe[runs->n] = i;
+            runs->heavy[runs->n] = h;
+            runs->n++;
+            continue;
+        }
+        CHAIN(i, key, hashes[i])
+    }
+    return pairs->n;
+
+}
+
+
+// the counter slots of the summary are rebuilt whenever counters are dropped
+static UINT counterSlot(const INT key) {
+    return HASH(key) & (2 * VEC_MAXHEAVY - 1);
+}
+
+
+static int findCounter(const VecHeavy* hh, const INT key) {
+    for (UINT s = counterSlot(key); hh->slots[s] != -1; s = (s + 1) & (2 * VEC_MAXHEAVY - 1)) {
+        if (hh->keys[hh->slots[s]] == key) return hh->slots[s];
+    }
+    return -1;
+}
+
+
+static void counterSlots(VecHeavy* hh) {
+    memset(hh->slots, 0xFF, sizeof(hh->slots));
+    for (UINT c = 0; c < hh->ncounters; c++) {
+        UINT s = counterSlot(hh->keys[c]);
+        while (hh->slots[s] != -1) s = (s + 1) & (2 * VEC_MAXHEAVY - 1);
+        hh->slots[s] = c;
+    }
+}
+
+
+void vecHeavyInit(VecHeavy* hh) {
+    hh->n = 0;
+    hh->ncounters = 0;
+    memset(hh->slots, 0xFF, sizeof(hh->slots));
+}
+
+
+void vecHeavyAdd(VecHeavy* hh, const INT* keys, const UINT n) {
+
+    for (UINT i = 0; i < n; i++) {
+
+        int c = findCounter(hh, keys[i]);
+        if (c >= 0) {
+            hh->counts[c]++;
+            continue;
+        }
+
+        if (hh->ncounters < VEC_MAXHEAVY) {
+            c = hh->ncounters++;
+            hh->keys[c] = keys[i];
+            hh->counts[c] = 1;
+            UINT s = counterSlot(keys[i]);
+            while (hh->slots[s] != -1) s = (s + 1) & (2 * VEC_MAXHEAVY - 1);
+            hh->slots[s] = c;
+            continue;
+        }
+
+        // no counter left: the key and one occurrence of every counted key cancel out
+        UINT m = 0;
+        for (UINT k = 0; k < hh->ncounters; k++) {
+            if (--hh->counts[k] == 0) continue;
+            hh->keys[m] = hh->keys[k];
+            hh->counts[m] = hh->counts[k];
+            m++;
+        }
+        hh->ncounters = m;
+        counterSlots(hh);
+
+    }
+
+    hh->n += n;
+
+}
+
+
+UINT vecHeavyCount(const VecHeavy* hh, const INT key) {
+    int c = findCounter(hh, key);
+    return c >= 0 ? hh->counts[c] : 0;
+}
+
+
+UINT vecHeavyKeys(const VecHeavy* hh, const UINT min, INT* keys) {
+    UINT m = 0;
+    for (UINT c = 0; c < hh->ncounters; c++) {
+        if (hh->counts[c] >= min) keys[m++] = hh->keys[c];
+    }
+    return m;
+}
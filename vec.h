@@ -0,0 +1,130 @@
+#ifndef VEC_H
+#define VEC_H
+#include "db.h"
+#include "arena.h"
+
+#define VEC_SIZE 1024 // tuples per batch
+#define VEC_NONE 0xFFFFFFFFu // end of a hash chain
+#define VEC_MAXKERNEL 16 // widest rows with their own kernels
+#define VEC_MAXHEAVY 256 // heavy hitters tracked
+#define VEC_HEAVY_MIN 64 // entries of a key that make it a heavy hitter
+
+// batch primitives over row blocks: n rows of stride attributes, attribute attr of row i at rows[i * stride + attr]
+// a selection vector holds the positions of the rows of a batch that qualify, in row order
+
+// positions of the rows whose attribute lies in [lo, hi], return how many
+UINT vecFilterRange(const INT* rows, const UINT stride, const UINT attr, const UINT n, const int64_t lo, const int64_t hi, UINT* sel);
+
+// positions of the rows whose attribute equals val, return how many
+UINT vecFilterEq(const INT* rows, const UINT stride, const UINT attr, const UINT n, const INT val, UINT* sel);
+
+// hash of the attribute of every row
+void vecHashKeys(const INT* rows, const UINT stride, const UINT attr, const UINT n, UINT* hashes);
+
+// copy the attribute of the selected rows into one column of out, out_stride attributes apart
+// with stride 0 every row is rows itself
+void vecGather(const INT* rows, const UINT stride, const UINT attr, const UINT* sel, const UINT n, INT* out, const UINT out_stride);
+
+// copy every attribute of the selected rows, each copy starting out_stride attributes after the last
+void vecGatherRows(const INT* rows, const UINT stride, const UINT* sel, const UINT n, INT* out, const UINT out_stride);
+
+// copy the attribute of every row into one contiguous column
+void vecColumn(const INT* rows, const UINT stride, const UINT attr, const UINT n, INT* out);
+
+// address of every row
+void vecPointers(INT* rows, const UINT stride, const UINT n, INT** out);
+
+// join build side: entries are chained per bucket in insertion order
+// the entries of heavy hitters are not chained but kept in one run per key, see vecHashBuildSkew()
+typedef struct VecHashTable{
+    UINT cap; // entries the arrays are sized for
+    UINT mask; // buckets - 1
+    UINT nentries;
+    UINT* heads; // first entry of each bucket
+    UINT* next; // next entry of the chain
+    UINT* hashes;
+    const INT* keys; // join key of each entry
+    UINT nheavy;
+    UINT hmask; // slots of the heavy keys - 1
+    UINT* hslots; // heavy key of each slot, VEC_NONE if empty
+    INT* hkeys;
+    UINT* hfirst; // entries of heavy key h are hentries[hfirst[h]] to hentries[hfirst[h + 1] - 1], in insertion order
+    UINT* hentries;
+} VecHashTable;
+
+// Misra-Gries summary of a stream of keys: a key making up more than 1 / (VEC_MAXHEAVY + 1) of the stream
+// has a counter, which is below its number of occurrences by at most that fraction of the stream
+typedef struct VecHeavy{
+    UINT64 n; // keys seen
+    UINT ncounters;
+    INT keys[VEC_MAXHEAVY];
+    UINT counts[VEC_MAXHEAVY];
+    int slots[2 * VEC_MAXHEAVY]; // counter of a key by its hash, -1 if empty
+} VecHeavy;
+
+// heavy hitters of a probe: probe row i has the key of heavy hitter h of the table, in probe order
+typedef struct VecRuns{
+    UINT n;
+    UINT probe[VEC_SIZE];
+    UINT heavy[VEC_SIZE];
+} VecRuns;
+
+// matches of a probe: probe row and build entry pairs, in probe order, grown in the query arena
+typedef struct VecPairs{
+    UINT n;
+    UINT cap;
+    UINT* probe;
+    UINT* build;
+} VecPairs;
+
+// empty hash table, its arrays are held by the query arena
+void vecHashInit(VecHashTable* ht);
+
+// replace the entries by n keys, the arrays are reused while they are large enough
+void vecHashBuild(VecHashTable* ht, const INT* keys, const UINT n);
+
+// all build entries matching the attribute of each probe row, the previous pairs are dropped
+// return the number of pairs
+UINT vecProbe(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes, VecPairs* pairs);
+
+// empty summary
+void vecHeavyInit(VecHeavy* hh);
+
+// count n more keys
+void vecHeavyAdd(VecHeavy* hh, const INT* keys, const UINT n);
+
+// counter of key, 0 if it has none
+UINT vecHeavyCount(const VecHeavy* hh, const INT key);
+
+// keys whose counter reaches min, return how many
+UINT vecHeavyKeys(const VecHeavy* hh, const UINT min, INT* keys);
+
+// vecHashBuild() that keeps apart the candidates occurring at least VEC_HEAVY_MIN times among the keys,
+// so the chains only hold the other keys and stay short
+void vecHashBuildSkew(VecHashTable* ht, const INT* keys, const UINT n, const INT* cand, const UINT ncand);
+
+// heavy hitter of key, VEC_NONE if it is not one
+UINT vecHeavyOf(const VecHashTable* ht, const INT key, const UINT hash);
+
+// vecProbe() of a table with heavy hitters: the probe rows of heavy keys are listed in runs instead of pairs
+// return the number of pairs
+UINT vecProbeSkew(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes,
+    VecPairs* pairs, VecRuns* runs);
+
+// the primitives above compiled for one row width, which then ignore their stride argument
+typedef struct VecKernels{
+    UINT width; // 0 for the generic primitives
+    UINT (*filterRange)(const INT* rows, const UINT stride, const UINT attr, const UINT n, const int64_t lo, const int64_t hi, UINT* sel);
+    UINT (*filterEq)(const INT* rows, const UINT stride, const UINT attr, const UINT n, const INT val, UINT* sel);
+    void (*hashKeys)(const INT* rows, const UINT stride, const UINT attr, const UINT n, UINT* hashes);
+    void (*gather)(const INT* rows, const UINT stride, const UINT attr, const UINT* sel, const UINT n, INT* out, const UINT out_stride);
+    void (*gatherRows)(const INT* rows, const UINT stride, const UINT* sel, const UINT n, INT* out, const UINT out_stride);
+    void (*column)(const INT* rows, const UINT stride, const UINT attr, const UINT n, INT* out);
+    void (*pointers)(INT* rows, const UINT stride, const UINT n, INT** out);
+    UINT (*probe)(const VecHashTable* ht, const INT* rows, const UINT stride, const UINT attr, const UINT n, const UINT* hashes, VecPairs* pairs);
+} VecKernels;
+
+// kernels for rows of width attributes, the generic primitives past VEC_MAXKERNEL
+const VecKernels* vecKernels(const UINT width);
+
+#endif